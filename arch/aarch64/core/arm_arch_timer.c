@@ -162,6 +162,11 @@ void sched_tick_disable(void)
 	isb();
 }
 
+int sched_tick_enabled(void)
+{
+	return !!(read_sysreg32(CNTHP_CTL_EL2) & (1 << 0));
+}
+
 void sched_tick_enable(unsigned long exp)
 {
 	unsigned long deadline;
@@ -187,6 +187,8 @@ void cpu_idle(void)
 		while (!need_resched() && pcpu_can_idle(pcpu)) {
 			local_irq_disable();
 			if (pcpu_can_idle(pcpu)) {
+				sched_balance(pcpu);
+				tick_nohz_idle_enter();
 				pcpu->state = PCPU_STATE_IDLE;
 				wfi();
 				nop();
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2020 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * buddy backend of the page pool, this file is included by
+ * mm_default.c when CONFIG_PAGE_ALLOCATOR_BUDDY is selected.
+ *
+ * each mem_block of the pool is split into power of 2 page
+ * chunks, the free chunks of each order are linked by the
+ * list_head stored in the free memory itself, and the struct
+ * page of the chunk's first page records its order, so both
+ * allocate and free only need O(log n) split or merge.
+ */
+#define BUDDY_MAX_ORDER		(MEM_BLOCK_SHIFT - PAGE_SHIFT)
+#define BUDDY_FREE_MAGIC	(0xb0dd0001UL)
+#define BUDDY_FREE(order)	(BUDDY_FREE_MAGIC | ((order) << 4))
+
+static inline int buddy_order(int count, int align)
+{
+	int nr = (count > align) ? count : align;
+
+	return (nr == 1) ? 0 : fls(nr - 1);
+}
+
+static inline struct list_head *buddy_chunk(struct mem_block *block, int idx)
+{
+	return (struct list_head *)PAGE_ADDR(block->phy_base,
+			(unsigned long)idx);
+}
+
+static void buddy_add_free(struct page_pool *pool,
+		struct mem_block *block, int idx, int order)
+{
+	struct page *meta = (struct page *)block_meta_base(block);
+
+	meta[idx].magic = BUDDY_FREE(order);
+	list_add(&pool->free_area[order], buddy_chunk(block, idx));
+	pool->nr_free[order]++;
+}
+
+static void buddy_del_free(struct page_pool *pool,
+		struct mem_block *block, int idx, int order)
+{
+	struct page *meta = (struct page *)block_meta_base(block);
+
+	meta[idx].magic = 0;
+	list_del(buddy_chunk(block, idx));
+	pool->nr_free[order]--;
+}
+
+static void buddy_free_chunk(struct page_pool *pool,
+		struct mem_block *block, int idx, int order)
+{
+	struct page *meta = (struct page *)block_meta_base(block);
+	int buddy;
+
+	while (order < BUDDY_MAX_ORDER) {
+		buddy = idx ^ (1 << order);
+		if (meta[buddy].magic != BUDDY_FREE(order))
+			break;
+
+		buddy_del_free(pool, block, buddy, order);
+		idx &= buddy;
+		order++;
+	}
+
+	buddy_add_free(pool, block, idx, order);
+}
+
+/*
+ * the pages count may not be power of 2, free them as the
+ * biggest aligned chunks.
+ */
+static void buddy_free_range(struct page_pool *pool,
+		struct mem_block *block, int idx, int count)
+{
+	int order;
+
+	while (count > 0) {
+		order = fls(count) - 1;
+		if (idx && (__ffs(idx) < order))
+			order = __ffs(idx);
+
+		buddy_free_chunk(pool, block, idx, order);
+		idx += 1 << order;
+		count -= 1 << order;
+	}
+}
+
+static int buddy_add_block(struct page_pool *pool, unsigned long flags)
+{
+	struct mem_block *block;
+	unsigned long *page_meta;
+
+	block = alloc_mem_block(flags);
+	if (!block)
+		return -ENOMEM;
+
+	page_meta = get_page_meta(pool);
+	if (!page_meta) {
+		release_mem_block(block);
+		return -ENOMEM;
+	}
+
+	memset(page_meta, 0, PAGE_META_SIZE);
+	block->pages_bitmap = page_meta;
+	list_add(&pool->block_list, &block->list);
+	pool->page_blocks++;
+	buddy_add_free(pool, block, 0, BUDDY_MAX_ORDER);
+
+	return 0;
+}
+
+static struct page *alloc_pages_from_pool(struct page_pool *pool,
+		int count, int align, unsigned long flags)
+{
+	int order, i, idx;
+	unsigned long addr;
+	struct mem_block *block;
+	struct page *meta, *page = NULL;
+
+	order = buddy_order(count, align);
+	if (order > BUDDY_MAX_ORDER)
+		return NULL;
+
+	spin_lock(&pool->lock);
+
+	for (i = order; i <= BUDDY_MAX_ORDER; i++) {
+		if (!is_list_empty(&pool->free_area[i]))
+			break;
+	}
+
+	if (i > BUDDY_MAX_ORDER) {
+		if (buddy_add_block(pool, flags))
+			goto out;
+		i = BUDDY_MAX_ORDER;
+	}
+
+	addr = (unsigned long)pool->free_area[i].next;
+	block = addr_to_mem_block(addr);
+	idx = offset_in_block_bitmap(addr, block);
+	buddy_del_free(pool, block, idx, i);
+
+	/* give back the tail pages which are not needed */
+	if ((1 << i) > count)
+		buddy_free_range(pool, block, idx + count, (1 << i) - count);
+
+	block->free_pages -= count;
+	meta = (struct page *)block_meta_base(block) + idx;
+	page = meta;
+	meta->phy_base = addr | (count & 0xfff);
+	for (i = 1; i < count; i++) {
+		meta++;
+		meta->phy_base = (addr + PAGE_SIZE * i) | 0xfff;
+	}
+
+out:
+	spin_unlock(&pool->lock);
+	return page;
+}
+
+static void free_pages_in_block(void *addr, struct mem_block *block)
+{
+	int idx, i, count;
+	struct page *meta;
+	struct page_pool *pool;
+
+	if (!(block->flags & GFB_PAGE)) {
+		pr_err("addr is not a page 0x%p\n", addr);
+		return;
+	}
+
+	if (block->flags & GFB_IO)
+		pool = io_pool;
+	else
+		pool = page_pool;
+
+	idx = offset_in_block_bitmap((unsigned long)addr, block);
+	meta = (struct page *)block_meta_base(block) + idx;
+
+	spin_lock(&pool->lock);
+
+	count = meta->phy_base & 0xfff;
+	if ((count == 0) || (count == 0xfff)) {
+		spin_unlock(&pool->lock);
+		pr_err("addr is not the first allocated page 0x%p\n", addr);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		meta[i].phy_base = 0;
+
+	block->free_pages += count;
+	buddy_free_range(pool, block, idx, count);
+
+	spin_unlock(&pool->lock);
+}
+
+static void page_pool_stat(struct page_pool *pool,
+		unsigned long *free, unsigned long *largest)
+{
+	int i;
+
+	*free = 0;
+	*largest = 0;
+
+	spin_lock(&pool->lock);
+	for (i = 0; i <= BUDDY_MAX_ORDER; i++) {
+		*free += pool->nr_free[i] << i;
+		if (pool->nr_free[i])
+			*largest = 1UL << i;
+	}
+	spin_unlock(&pool->lock);
+}
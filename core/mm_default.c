@@ -22,6 +22,7 @@
 #include <minos/mm.h>
 #include <minos/mmu.h>
 #include <minos/tlb.h>
+#include <minos/shell_command.h>
 
 extern unsigned char __code_start;
 extern void *bootmem_end;
@@ -88,6 +89,10 @@ struct page_pool {
 	uint32_t page_blocks;
 	struct list_head meta_list;
 	struct list_head block_list;
+#ifdef CONFIG_PAGE_ALLOCATOR_BUDDY
+	struct list_head free_area[MEM_BLOCK_SHIFT - PAGE_SHIFT + 1];
+	unsigned long nr_free[MEM_BLOCK_SHIFT - PAGE_SHIFT + 1];
+#endif
 };
 
 #define MIN_BLOCK_PAGE_SIZE	(8 * PAGE_SIZE)
@@ -580,6 +585,58 @@ struct mem_block *alloc_mem_block(unsigned long flags)
 	return block;
 }
 
+/*
+ * allocate count contiguous memory blocks whose physical
+ * address is aligned with align blocks, this is used for
+ * guest vm memory, so the blocks are not mapped to host.
+ */
+struct mem_block *alloc_mem_blocks(int count, int align, unsigned long flags)
+{
+	int i, j;
+	unsigned long bit, off;
+	struct mem_section *section;
+	struct mem_block *block;
+
+	for (i = 0; i < nr_sections; i++) {
+		section = &mem_sections[i];
+		if (!(section->type & MEM_SECTION_F_BLOCK))
+			continue;
+
+		spin_lock(&section->lock);
+		if (section->free_blocks < count) {
+			spin_unlock(&section->lock);
+			continue;
+		}
+
+		/* the first block of the section may not be aligned */
+		off = (section->phy_base >> MEM_BLOCK_SHIFT) & (align - 1);
+		bit = bitmap_find_next_zero_area_off(section->bitmap,
+				section->nr_blocks, 0, count, align - 1, off);
+		if (bit >= section->nr_blocks) {
+			spin_unlock(&section->lock);
+			continue;
+		}
+
+		bitmap_set(section->bitmap, bit, count);
+		section->free_blocks -= count;
+		free_blocks -= count;
+		spin_unlock(&section->lock);
+
+		block = &section->blocks[bit];
+		memset(block, 0, sizeof(struct mem_block) * count);
+		for (j = 0; j < count; j++) {
+			block[j].free_pages = PAGES_IN_BLOCK;
+			block[j].flags = flags & GFB_MASK;
+			block[j].phy_base = section->phy_base +
+				(bit + j) * MEM_BLOCK_SIZE;
+		}
+
+		return block;
+	}
+
+	return NULL;
+}
+
 static unsigned long *get_page_meta(struct page_pool *pool)
 {
 	int bit;
@@ -627,6 +684,9 @@ static inline void *block_meta_base(struct mem_block *block)
 	return ((void *)block->pages_bitmap + BLOCK_BITMAP_SIZE);
 }
 
+#ifdef CONFIG_PAGE_ALLOCATOR_BUDDY
+#include "mm_buddy.c"
+#else
 static struct page *alloc_pages_from_block(struct mem_block *block,
 		int count, int align)
 {
@@ -719,6 +779,47 @@ out:
 	return page;
 }
 
+static unsigned long block_largest_free(struct mem_block *block)
+{
+	unsigned long start = 0, end, largest = 0;
+
+	while (start < PAGES_IN_BLOCK) {
+		start = find_next_zero_bit(block->pages_bitmap,
+				PAGES_IN_BLOCK, start);
+		if (start >= PAGES_IN_BLOCK)
+			break;
+
+		end = find_next_bit(block->pages_bitmap,
+				PAGES_IN_BLOCK, start);
+		if ((end - start) > largest)
+			largest = end - start;
+		start = end;
+	}
+
+	return largest;
+}
+
+static void page_pool_stat(struct page_pool *pool,
+		unsigned long *free, unsigned long *largest)
+{
+	struct mem_block *block;
+	unsigned long tmp;
+
+	*free = 0;
+	*largest = 0;
+
+	spin_lock(&pool->lock);
+	list_for_each_entry(block, &pool->block_list, list) {
+		*free += block->free_pages;
+		tmp = block_largest_free(block);
+		if (tmp > *largest)
+			*largest = tmp;
+	}
+	spin_unlock(&pool->lock);
+}
+
+#endif
+
 static struct page *__alloc_pages_from_section(struct mem_section *section,
 		int count, int align)
 {
@@ -1148,6 +1249,154 @@ static void *get_big_slab(size_t size)
 	return SLAB_HEADER_TO_ADDR(header);
 }
 
+#ifdef CONFIG_SLAB_PERCPU_CACHE
+/*
+ * the slab size from 16 to 256 byte have magazine on
+ * each pcpu, the slab in the magazine does not have
+ * the SLAB_MAGIC, so double free can still be found
+ */
+#define SLAB_MAG_CLASSES	(16)
+#define SLAB_MAG_SIZE		(32)
+#define SLAB_MAG_BATCH		(SLAB_MAG_SIZE / 2)
+
+struct slab_magazine {
+	int nr;
+	struct slab_header *objs[SLAB_MAG_SIZE];
+	unsigned long hit;
+	unsigned long miss;
+	unsigned long refill;
+	unsigned long drain;
+};
+
+struct slab_cache {
+	struct slab_magazine mags[SLAB_MAG_CLASSES];
+};
+
+static DEFINE_PER_CPU(struct slab_cache, slab_cache);
+
+static void slab_cache_refill(struct slab_magazine *mag, size_t size, int id)
+{
+	struct slab_pool *pool = &pslab->pool[id];
+	struct slab_header *header;
+	void *addr;
+
+	spin_lock(&pslab->lock);
+
+	while ((mag->nr < SLAB_MAG_BATCH) && pool->head) {
+		header = get_slab_from_slab_pool(pool);
+		header->magic = 0;
+		mag->objs[mag->nr++] = header;
+	}
+
+	/* carve the left from the free slab memory */
+	while (mag->nr < SLAB_MAG_BATCH) {
+		addr = get_slab_from_slab_free(size);
+		if (!addr)
+			break;
+
+		header = ADDR_TO_SLAB_HEADER(addr);
+		header->magic = 0;
+		mag->objs[mag->nr++] = header;
+	}
+
+	spin_unlock(&pslab->lock);
+
+	if (mag->nr)
+		mag->refill++;
+}
+
+static void slab_cache_drain(struct slab_magazine *mag, int id)
+{
+	struct slab_pool *pool = &pslab->pool[id];
+	int i;
+
+	spin_lock(&pslab->lock);
+	for (i = 0; i < SLAB_MAG_BATCH; i++)
+		add_slab_to_slab_pool(mag->objs[--mag->nr], pool);
+	spin_unlock(&pslab->lock);
+
+	mag->drain++;
+}
+
+static void *slab_cache_alloc(size_t size)
+{
+	struct slab_magazine *mag;
+	struct slab_header *header = NULL;
+	unsigned long flags;
+	int id = slab_pool_id(size);
+
+	if (id >= SLAB_MAG_CLASSES)
+		return NULL;
+
+	local_irq_save(flags);
+
+	mag = &get_cpu_var(slab_cache).mags[id];
+	if (mag->nr) {
+		mag->hit++;
+	} else {
+		mag->miss++;
+		slab_cache_refill(mag, size, id);
+	}
+
+	if (mag->nr) {
+		header = mag->objs[--mag->nr];
+		header->magic = SLAB_MAGIC;
+	}
+
+	local_irq_restore(flags);
+
+	return header ? SLAB_HEADER_TO_ADDR(header) : NULL;
+}
+
+static int slab_cache_free(struct slab_header *header)
+{
+	struct slab_magazine *mag;
+	unsigned long flags;
+	int id = slab_pool_id(header->size);
+
+	if (id >= SLAB_MAG_CLASSES)
+		return -EINVAL;
+
+	local_irq_save(flags);
+
+	mag = &get_cpu_var(slab_cache).mags[id];
+	if (mag->nr == SLAB_MAG_SIZE)
+		slab_cache_drain(mag, id);
+
+	header->magic = 0;
+	mag->objs[mag->nr++] = header;
+
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+static int slab_cache_cmd(int argc, char **argv)
+{
+	int cpu, id;
+	struct slab_magazine *mag;
+
+	printf(" CPU SIZE CACHED        HIT       MISS   REFILL    DRAIN\n");
+
+	for_each_online_cpu(cpu) {
+		for (id = 0; id < SLAB_MAG_CLASSES; id++) {
+			mag = &get_per_cpu(slab_cache, cpu).mags[id];
+			if (!mag->hit && !mag->miss && !mag->nr)
+				continue;
+
+			printf("%4d %4d %6d %10lu %10lu %8lu %8lu\n",
+				cpu, (id + 1) * SLAB_MIN_DATA_SIZE, mag->nr,
+				mag->hit, mag->miss, mag->refill, mag->drain);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(slabcache, "slabcache",
+		"show the percpu slab cache statistics",
+		slab_cache_cmd, 0);
+#endif
+
 typedef void *(*slab_alloc_func)(size_t size);
 
 static slab_alloc_func alloc_func[] = {
@@ -1170,6 +1419,13 @@ void *malloc(size_t size)
 		return NULL;
 
 	size = get_slab_alloc_size(size);
+
+#ifdef CONFIG_SLAB_PERCPU_CACHE
+	ret = slab_cache_alloc(size);
+	if (ret)
+		return ret;
+#endif
+
 	spin_lock(&pslab->lock);
 
 	while (1) {
@@ -1234,6 +1490,7 @@ out:
 	spin_unlock(&section->lock);
 }
 
+#ifndef CONFIG_PAGE_ALLOCATOR_BUDDY
 static void free_pages_in_block(void *addr, struct mem_block *block)
 {
 	unsigned long start;
@@ -1275,6 +1532,7 @@ static void free_pages_in_block(void *addr, struct mem_block *block)
 
 	spin_unlock(&pool->lock);
 }
+#endif
 
 static int free_pages_in_section(void *addr, struct mem_section *ms)
 {
@@ -1360,6 +1618,11 @@ free_slab:
 		return;
 	}
 
+#ifdef CONFIG_SLAB_PERCPU_CACHE
+	if (!slab_cache_free(header))
+		return;
+#endif
+
 	/* big slab will default push to free cache pool */
 	spin_lock(&pslab->lock);
 	id = slab_pool_id(header->size);
@@ -1378,17 +1641,32 @@ static void slab_init(void)
 	spin_lock_init(&pslab->lock);
 }
 
+static void __page_pool_init(struct page_pool *pool)
+{
+#ifdef CONFIG_PAGE_ALLOCATOR_BUDDY
+	int i;
+#endif
+
+	memset(pool, 0, sizeof(struct page_pool));
+	spin_lock_init(&pool->lock);
+	init_list(&pool->meta_list);
+	init_list(&pool->block_list);
+
+#ifdef CONFIG_PAGE_ALLOCATOR_BUDDY
+	for (i = 0; i <= BUDDY_MAX_ORDER; i++)
+		init_list(&pool->free_area[i]);
+#endif
+}
+
 static void page_pool_init(void)
 {
-	memset(page_pool, 0, sizeof(struct page_pool));
-	spin_lock_init(&page_pool->lock);
-	init_list(&page_pool->meta_list);
-	init_list(&page_pool->block_list);
-
-	memset(io_pool, 0, sizeof(struct page_pool));
-	spin_lock_init(&io_pool->lock);
-	init_list(&io_pool->meta_list);
-	init_list(&io_pool->block_list);
+	__page_pool_init(page_pool);
+	__page_pool_init(io_pool);
+}
+
+void get_page_pool_stat(int io, unsigned long *free, unsigned long *largest)
+{
+	page_pool_stat(io ? io_pool : page_pool, free, largest);
 }
 
 int has_enough_memory(size_t size)
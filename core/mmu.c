@@ -422,7 +422,9 @@ static phy_addr_t mmu_translate_address(struct mapping_struct *info)
 			if ((lvl > PTE) || (attr == NULL))
 				return 0;
 		} else {
-			return (des & VM_ADDRESS_MASK);
+			/* the address may be in a 1G or 2M block */
+			return (des & VM_ADDRESS_MASK & ~(attr->map_size - 1)) +
+				(va & (attr->map_size - 1));
 		}
 	} while (1);
 }
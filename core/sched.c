@@ -28,9 +28,11 @@
 
 DEFINE_SPIN_LOCK(__kernel_lock);
 
+#ifndef CONFIG_SCHED_RT_PERCPU
 static uint8_t __align(8) os_rdy_grp;
 static uint64_t __os_rdy_table;
 static uint8_t *os_rdy_table = (uint8_t *)&__os_rdy_table;
+#endif
 uint8_t os_highest_rdy[NR_CPUS];
 uint8_t os_prio_cur[NR_CPUS];
 
@@ -72,6 +74,7 @@ static inline void __percpu_task_ready(struct pcpu *pcpu,
 		add_task_to_ready_list_tail(pcpu, task);
 
 	pcpu->local_rdy_grp |= task->local_mask;
+	pcpu_ready_inc(pcpu, task);
 }
 
 static inline void __percpu_task_sleep(struct pcpu *pcpu,
@@ -82,6 +85,8 @@ static inline void __percpu_task_sleep(struct pcpu *pcpu,
 
 	if (is_list_empty(&pcpu->ready_list[task->local_prio]))
 		pcpu->local_rdy_grp &= ~task->local_mask;
+
+	pcpu_ready_dec(pcpu, task);
 }
 
 static inline void percpu_task_ready(struct pcpu *pcpu,
@@ -127,6 +132,46 @@ static inline void smp_percpu_task_ready(struct pcpu *pcpu,
 	spin_unlock_irqrestore(&pcpu->lock, flags);
 }
 
+#ifdef CONFIG_SCHED_RT_PERCPU
+static inline void rt_task_ready(struct task *task)
+{
+	int cpu = task->affinity;
+	struct pcpu *pcpu = get_per_cpu(pcpu, cpu);
+
+	/*
+	 * the ready bitmap of the pcpu is updated by atomic
+	 * bitops, then if the task is not affinity to this
+	 * pcpu and its prio is higher than the running task
+	 * on the target pcpu, kick the target pcpu to resched
+	 */
+	set_bit(task->prio, &pcpu->rt_rdy_map);
+	smp_mb();
+
+	if ((cpu != smp_processor_id()) && (task->prio < os_prio_cur[cpu]))
+		pcpu_resched(cpu);
+}
+
+static inline void rt_task_sleep(struct task *task)
+{
+	struct pcpu *pcpu = get_per_cpu(pcpu, task->affinity);
+
+	clear_bit(task->prio, &pcpu->rt_rdy_map);
+}
+#else
+static inline void rt_task_ready(struct task *task)
+{
+	os_rdy_grp |= task->bity;
+	os_rdy_table[task->by] |= task->bitx;
+}
+
+static inline void rt_task_sleep(struct task *task)
+{
+	os_rdy_table[task->by] &= ~task->bitx;
+	if (os_rdy_table[task->by] == 0)
+		os_rdy_grp &= ~task->bity;
+}
+#endif
+
 static void inline set_next_task(struct task *task, int cpuid)
 {
 	__next_tasks[cpuid] = task;
@@ -152,7 +197,9 @@ int set_task_ready(struct task *task, int preempt)
 
 	/*
 	 * when call this function need to ensure :
-	 * 1 - kernel sched lock is locked (rt task)
+	 * 1 - kernel sched lock is locked (rt task), if
+	 *     CONFIG_SCHED_RT_PERCPU is enabled the task
+	 *     lock is used instead
 	 * 2 - the interrupt is disabled
 	 *
 	 * if the task is a precpu task and the cpu is not
@@ -161,8 +208,7 @@ int set_task_ready(struct task *task, int preempt)
 	 * interrupt to the pcpu
 	 */
 	if (task_is_realtime(task)) {
-		os_rdy_grp |= task->bity;
-		os_rdy_table[task->by] |= task->bitx;
+		rt_task_ready(task);
 	} else {
 		pcpu = get_cpu_var(pcpu);
 		if (pcpu->pcpu_id != task->affinity) {
@@ -190,9 +236,7 @@ int set_task_sleep(struct task *task, uint32_t ms)
 	struct pcpu *pcpu;
 
 	if (task_is_realtime(task)) {
-		os_rdy_table[task->by] &= ~task->bitx;
-		if (os_rdy_table[task->by] == 0)
-			os_rdy_grp &= ~task->bity;
+		rt_task_sleep(task);
 	} else {
 		pcpu = get_cpu_var(pcpu);
 
@@ -233,6 +277,24 @@ struct task *get_highest_task(uint8_t group, uint8_t *ready)
 	return os_task_table[(y << 3) + x];
 }
 
+#ifdef CONFIG_SCHED_RT_PERCPU
+static void sched_new(struct pcpu *pcpu)
+{
+	unsigned long rdy = pcpu->rt_rdy_map;
+
+	/*
+	 * each pcpu only need to check the realtime task
+	 * which affinity to itself, the ready bitmap is
+	 * percpu, so do not need the kernel lock here, this
+	 * function need always called with interrupt disabled
+	 */
+	if (rdy == 0)
+		os_highest_rdy[pcpu->pcpu_id] = OS_PRIO_PCPU;
+	else
+		os_highest_rdy[pcpu->pcpu_id] = __ffs(rdy);
+	wmb();
+}
+#else
 static void sched_new(struct pcpu *pcpu)
 {
 	/*
@@ -339,6 +401,7 @@ static void sched_new(struct pcpu *pcpu)
 	wmb();
 #endif
 }
+#endif
 
 static void inline task_sched_return(struct task *task)
 {
@@ -413,18 +476,47 @@ recal_task_run_time(struct task *task, struct pcpu *pcpu)
 	}
 }
 
-static void global_switch_out(struct pcpu *pcpu,
-		struct task *cur, struct task *next)
+static inline void set_pcpu_prio_cur(struct pcpu *pcpu, struct task *next)
 {
 	if (task_is_percpu(next))
 		os_prio_cur[pcpu->pcpu_id] = OS_PRIO_PCPU;
 	else
 		os_prio_cur[pcpu->pcpu_id] = next->prio;
 	smp_wmb();
+}
+
+#ifndef CONFIG_SCHED_RT_PERCPU
+static void global_switch_out(struct pcpu *pcpu,
+		struct task *cur, struct task *next)
+{
+	set_pcpu_prio_cur(pcpu, next);
 
 	/* release the kernel lock now */
 	kernel_unlock();
 }
+#else
+static void rt_percpu_switch_out(struct pcpu *pcpu,
+		struct task *cur, struct task *next)
+{
+	unsigned long rdy;
+
+	set_pcpu_prio_cur(pcpu, next);
+
+	/*
+	 * other pcpu may wakeup a realtime task on this pcpu
+	 * after sched_new() and see the old prio of this pcpu,
+	 * then it will not kick this pcpu, check the ready
+	 * bitmap again after the new prio is visible
+	 */
+	smp_mb();
+	rdy = pcpu->rt_rdy_map;
+	if (task_is_realtime(next))
+		rdy &= BIT(next->prio) - 1;
+
+	if (rdy)
+		pcpu_resched(pcpu->pcpu_id);
+}
+#endif
 
 static void local_switch_out(struct pcpu *pcpu,
 		struct task *cur, struct task *next)
@@ -543,6 +635,15 @@ unsigned long sched_tick_handler(unsigned long data)
 		return 0;
 	}
 
+	/*
+	 * the idle task do not need the sched tick, this is
+	 * a stale tick which armed for the task before
+	 */
+	if (task_is_idle(task)) {
+		tick_nohz_stale_tick();
+		return 0;
+	}
+
 	now = NOW();
 	pcpu = get_cpu_var(pcpu);
 	delta = now - task->start_ns;
@@ -582,6 +683,7 @@ unsigned long sched_tick_handler(unsigned long data)
 	return 0;
 }
 
+#ifndef CONFIG_SCHED_RT_PERCPU
 void global_sched(struct pcpu *pcpu, struct task *cur)
 {
 	int i;
@@ -609,6 +711,27 @@ void global_sched(struct pcpu *pcpu, struct task *cur)
 	} else
 		kernel_unlock();
 }
+#else
+/*
+ * each pcpu only sched the realtime task which affinity
+ * to itself, so the kernel lock is not needed, the
+ * realtime task on other pcpu is waked up by setting
+ * the ready bitmap and kicked by rt_task_ready()
+ */
+void rt_percpu_sched(struct pcpu *pcpu, struct task *cur)
+{
+	struct task *next;
+
+	sched_new(pcpu);
+
+	next = get_next_global_run_task(pcpu);
+	if (cur == next)
+		return;
+
+	set_next_task(next, pcpu->pcpu_id);
+	arch_switch_task_sw();
+}
+#endif
 
 /*
  * local sched will only sched the task which
@@ -715,11 +838,21 @@ void sched_task(struct task *task)
 	local_irq_save(flags);
 
 	s_cpu = smp_processor_id();
+#ifdef CONFIG_SCHED_RT_PERCPU
+	/*
+	 * the realtime task is affinity to one pcpu, and the
+	 * dst pcpu has been kicked when the task is set to
+	 * ready state, handle it as a percpu task here
+	 */
+	t_cpu = task->affinity;
+	realtime_task = 0;
+#else
 	t_cpu = task_is_realtime(task) ?
 		task_info(task)->cpu : task->affinity;
 
 	if (realtime_task && pcpu_sched_class[s_cpu] != SCHED_CLASS_GLOBAL)
 			smp_resched = 1;
+#endif
 
 	local_irq_restore(flags);
 
@@ -790,6 +923,7 @@ static void local_irq_handler(struct pcpu *pcpu, struct task *task)
 	switch_to_task(task, next);
 }
 
+#ifndef CONFIG_SCHED_RT_PERCPU
 static void global_irq_handler(struct pcpu *pcpu, struct task *task)
 {
 	int i;
@@ -837,6 +971,23 @@ static void global_irq_handler(struct pcpu *pcpu, struct task *task)
 
 	no_task_sched_return(pcpu, next);
 }
+#else
+static void rt_percpu_irq_handler(struct pcpu *pcpu, struct task *task)
+{
+	struct task *next;
+
+	sched_new(pcpu);
+
+	next = get_next_global_run_task(pcpu);
+	if (next == task) {
+		no_task_sched_return(pcpu, task);
+		return;
+	}
+
+	set_next_task(next, pcpu->pcpu_id);
+	switch_to_task(task, next);
+}
+#endif
 
 void irq_return_handler(struct task *task)
 {
@@ -879,6 +1030,27 @@ int select_task_run_cpu(void)
 	return 0;
 }
 
+int select_rt_task_cpu(void)
+{
+#ifdef CONFIG_SCHED_RT_PERCPU
+	int i, cpu;
+	static int next_rt_cpu;
+
+	/*
+	 * spread the realtime tasks to the pcpus which can
+	 * run realtime task one by one
+	 */
+	for (i = 0; i < NR_CPUS; i++) {
+		cpu = (next_rt_cpu + i) % NR_CPUS;
+		if (pcpu_sched_class[cpu] == SCHED_CLASS_GLOBAL) {
+			next_rt_cpu = cpu + 1;
+			return cpu;
+		}
+	}
+#endif
+	return 0;
+}
+
 static inline int
 get_affinity_from_dts(struct device_node *node, uint64_t *aff)
 {
@@ -977,6 +1149,12 @@ void pcpus_init(void)
 			pcpu->irq_handler = local_irq_handler;
 			pcpu_sched_class[i] = SCHED_CLASS_LOCAL;
 		}
+#elif defined(CONFIG_SCHED_RT_PERCPU)
+		pcpu->sched = rt_percpu_sched;
+		pcpu->switch_out = rt_percpu_switch_out;
+		pcpu->switch_to = global_switch_to;
+		pcpu->irq_handler = rt_percpu_irq_handler;
+		pcpu_sched_class[i] = SCHED_CLASS_GLOBAL;
 #else
 		pcpu->sched = global_sched;
 		pcpu->switch_out = global_switch_out;
@@ -1003,6 +1181,144 @@ int sched_init(void)
 	return 0;
 }
 
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+/*
+ * the busiest pcpu need at least one task waitting
+ * on its ready list besides the running one
+ */
+#define SCHED_BALANCE_THRESHOLD		2
+
+/*
+ * called by the idle pcpu with interrupt disabled, find
+ * the busiest pcpu which has migratable ready task and
+ * send a steal request to it, the ready list is only
+ * accessed by its owner pcpu, so the busiest pcpu will
+ * push the task to this pcpu's new_list when handling
+ * the irqwork
+ */
+void sched_balance(struct pcpu *pcpu)
+{
+	int cpu, busiest = -1;
+	uint32_t nr, max = 0;
+	struct pcpu *tpcpu;
+
+	if (pcpu->steal_pending)
+		return;
+
+	for_each_online_cpu(cpu) {
+		if (cpu == pcpu->pcpu_id)
+			continue;
+
+		tpcpu = get_per_cpu(pcpu, cpu);
+		nr = *(volatile uint32_t *)&tpcpu->nr_ready;
+		if ((nr < SCHED_BALANCE_THRESHOLD) ||
+				!(*(volatile uint32_t *)&tpcpu->nr_mig_ready))
+			continue;
+
+		if (nr > max) {
+			max = nr;
+			busiest = cpu;
+		}
+	}
+
+	if (busiest < 0)
+		return;
+
+	pcpu->steal_pending = 1;
+	tpcpu = get_per_cpu(pcpu, busiest);
+	set_bit(pcpu->pcpu_id, &tpcpu->steal_req);
+	pcpu_irqwork(busiest);
+}
+
+static struct task *pick_steal_task(struct pcpu *pcpu, struct task *cur)
+{
+	int prio;
+	struct task *task;
+
+	/*
+	 * do not steal the idle task's list, and the task
+	 * which is running now on this pcpu
+	 */
+	for (prio = 0; prio < OS_LOCAL_PRIO(OS_PRIO_IDLE); prio++) {
+		list_for_each_entry(task, &pcpu->ready_list[prio], stat_list) {
+			if ((task == cur) || (task == pcpu->running_task))
+				continue;
+
+			if (!task_is_migratable(task))
+				continue;
+#ifdef CONFIG_VIRT
+			if (task_is_vcpu(task) &&
+					!vcpu_can_migrate(task_to_vcpu(task)))
+				continue;
+#endif
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
+static void migrate_ready_task(struct pcpu *pcpu,
+		struct pcpu *tpcpu, struct task *task)
+{
+	__percpu_task_sleep(pcpu, task);
+
+	raw_spin_lock(&pcpu->lock);
+	list_del(&task->list);
+	pcpu->nr_pcpu_task--;
+	pcpu->nr_stolen++;
+	raw_spin_unlock(&pcpu->lock);
+
+	/*
+	 * the task is ready and not running, so no other
+	 * pcpu will change its affinity now, other pcpu may
+	 * still kick the old pcpu for a vcpu, the pending
+	 * virqs are handled when it runs on the new pcpu
+	 */
+	task->affinity = tpcpu->pcpu_id;
+
+	raw_spin_lock(&tpcpu->lock);
+	list_add_tail(&tpcpu->task_list, &task->list);
+	list_add_tail(&tpcpu->new_list, &task->stat_list);
+	tpcpu->nr_pcpu_task++;
+	tpcpu->nr_steal++;
+	raw_spin_unlock(&tpcpu->lock);
+}
+
+static void handle_steal_request(struct pcpu *pcpu, struct task *cur)
+{
+	int cpu;
+	struct task *task;
+	struct pcpu *tpcpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (!test_and_clear_bit(cpu, &pcpu->steal_req))
+			continue;
+
+		tpcpu = get_per_cpu(pcpu, cpu);
+		task = pick_steal_task(pcpu, cur);
+		if (task)
+			migrate_ready_task(pcpu, tpcpu, task);
+
+		/*
+		 * reply to the idle pcpu, if there is no task
+		 * can be stolen, it will request again after
+		 * next wakeup
+		 */
+		tpcpu->steal_pending = 0;
+		wmb();
+
+		if (task)
+			pcpu_irqwork(cpu);
+	}
+}
+#else
+void sched_balance(struct pcpu *pcpu)
+{
+
+}
+#endif
+
 static int irqwork_handler(uint32_t irq, void *data)
 {
 	int need_resched = 0;
@@ -1038,6 +1354,11 @@ static int irqwork_handler(uint32_t irq, void *data)
 	}
 	raw_spin_unlock(&pcpu->lock);
 
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	if (pcpu->steal_req)
+		handle_steal_request(pcpu, cur);
+#endif
+
 	if (need_resched || task_is_idle(current))
 		set_need_resched();
 
@@ -211,11 +211,18 @@ int vsprintf(char *buf, const char *fmt, va_list arg)
 
 		fmt++;
 
-		if (is_digit(*fmt)) {
-			align = *fmt - '0';
+		while (is_digit(*fmt)) {
+			align = align * 10 + *fmt - '0';
 			fmt++;
 		}
 
+		/*
+		 * the number is always fetched as unsigned long,
+		 * so the long modifier only need to be skipped
+		 */
+		if (*fmt == 'l')
+			fmt++;
+
 		switch (*fmt) {
 		case 'd':
 			flag |= PRINTF_DEC | PRINTF_SIGNED;
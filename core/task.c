@@ -324,6 +324,8 @@ struct task *create_task(char *name, task_func_t func,
 
 	if (aff == PCPU_AFF_LOCAL)
 		aff = smp_processor_id();
+	else if ((aff == PCPU_AFF_ANY) && (prio <= OS_LOWEST_REALTIME_PRIO))
+		aff = select_rt_task_cpu();
 
 	pid = alloc_pid(prio, aff);
 	if (pid < 0)
@@ -361,6 +363,7 @@ struct task *create_task(char *name, task_func_t func,
 			if (aff == smp_processor_id()) {
 				add_task_to_ready_list_tail(pcpu, task);
 				pcpu->local_rdy_grp |= task->local_mask;
+				pcpu_ready_inc(pcpu, task);
 			} else {
 				list_add_tail(&pcpu->new_list, &task->stat_list);
 			}
@@ -382,9 +385,9 @@ struct task *create_task(char *name, task_func_t func,
 		 * ready list
 		 */
 		if (task_is_realtime(task)) {
-			kernel_lock_irqsave(flags);
+			task_lock_irqsave(task, flags);
 			set_task_ready(task, 0);
-			kernel_unlock_irqrestore(flags);
+			task_unlock_irqrestore(task, flags);
 			set_need_resched();
 		}
 
@@ -533,7 +536,8 @@ struct task *create_migrating_task(char *name, task_func_t func, void *arg,
 	if (prio <= OS_LOWEST_REALTIME_PRIO)
 		return NULL;
 
-	return create_task(name, func, arg, prio, PCPU_AFF_ANY, ss, flags);
+	return create_task(name, func, arg, prio, PCPU_AFF_ANY, ss,
+			flags | TASK_FLAGS_MIGRATE);
 }
 
 struct task *create_local_task(char *name, task_func_t func, void *arg,
@@ -560,7 +564,7 @@ struct task *create_realtime_task(char *name, task_func_t func, void *arg,
 	if (prio > OS_LOWEST_REALTIME_PRIO)
 		return NULL;
 
-	return create_task(name, func, arg, prio, 0, ss, flags);
+	return create_task(name, func, arg, prio, PCPU_AFF_ANY, ss, flags);
 }
 
 struct task *create_vcpu_task(char *name, task_func_t func,
@@ -25,108 +25,253 @@
 
 DEFINE_PER_CPU(struct timers, timers);
 
-static void run_timer_softirq(struct softirq_action *h)
-{
-	struct timer_list *timer;
-	unsigned long expires = ~0, now;
-	struct timers *timers = &get_cpu_var(timers);
-	struct list_head tmp_head;
-	timer_func_t fn;
-	unsigned long data;
+#ifdef CONFIG_NO_HZ_IDLE
+extern int sched_tick_enabled(void);
+extern void sched_tick_disable(void);
+#endif
 
-	now = NOW();
-	init_list(&tmp_head);
+static inline int timer_pending(const struct timer_list * timer)
+{
+	return ((timer->entry.next) != NULL);
+}
 
-	raw_spin_lock(&timers->lock);
+static inline int timers_empty(struct timers *timers)
+{
+	int i;
 
-	while (!is_list_empty(&timers->active)) {
-		timer = list_first_entry(&timers->active,
-				struct timer_list, entry);
+	for (i = 0; i < TIMER_LEVELS; i++) {
+		if (timers->pending[i])
+			return 0;
+	}
 
-		if (timer->expires <= (now + DEFAULT_TIMER_MARGIN)) {	
-			/* 
-			 * need to release the spin lock to avoid
-			 * dead lock because on the timer handler
-			 * function the task may aquire other spinlocks
-			 */
-			fn = timer->function;
-			data = timer->data;
-
-			list_del(&timer->entry);
-			timer->entry.next = NULL;
-			timers->running_timer = timer;
-			raw_spin_unlock(&timers->lock);
-
-			fn(data);
-
-			raw_spin_lock(&timers->lock);
-
-			/*
-			 * inform other cpu that this timer has been
-			 * finish processing
-			 */
-			timers->running_timer = NULL;
-			wmb();
-		} else {
-			/*
-			 * need to be careful one case, when do the expires
-			 * handler, the spin lock will be released, then other
-			 * cpu may get this lock to delete the timer from the
-			 * active list, if use the .next member to get the next
-			 * timer then there will be issues, so if this timer not
-			 * expires, then add it to the tmp timer list head, at
-			 * the end of this function, switch the actvie to the head
-			 */
-			if ((expires > timer->expires))
-				expires = timer->expires;
+	return 1;
+}
 
-			list_del(&timer->entry);
-			list_add_tail(&tmp_head, &timer->entry);
-		}
-	}
+/*
+ * find the bucket of the timer, the level is the lowest one
+ * whose 64 buckets window (start from clk) can hold the expires,
+ * so when a timer is queued it expires before the timers on the
+ * upper levels, and the timers on level N (N > 0) are never in
+ * the bucket of current clk.
+ */
+static int timer_calc_index(unsigned long clk, unsigned long expires)
+{
+	unsigned long tick = expires >> TIMER_TICK_SHIFT;
+	int lvl, shift;
 
-	if (!is_list_empty(&timers->active))
-		panic("error in timers->active list\n");
+	if (tick < clk)
+		tick = clk;
 
-	/*
-	 * swap the tmp head to the active head
-	 */
-	if (!is_list_empty(&tmp_head)) {
-		tmp_head.next->pre = &timers->active;
-		timers->active.next = tmp_head.next;
-		tmp_head.pre->next = &timers->active;
-		timers->active.pre = tmp_head.pre;
-		wmb();
+	for (lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+		shift = lvl * TIMER_LVL_BITS;
+		if (((tick >> shift) - (clk >> shift)) < TIMER_LVL_SIZE)
+			return (lvl << TIMER_LVL_BITS) +
+				((tick >> shift) & TIMER_LVL_MASK);
 	}
 
-	raw_spin_unlock(&timers->lock);
+	shift = (TIMER_LEVELS - 1) * TIMER_LVL_BITS;
 
-	if (expires != ((unsigned long)~0)) {
-		timers->running_expires = expires;
-		enable_timer(expires);
-	} else {
-		/* there is no more timer on the cpu */
-		timers->running_expires = 0;
-	}
+	return ((TIMER_LEVELS - 1) << TIMER_LVL_BITS) +
+		(((clk >> shift) + TIMER_LVL_MASK) & TIMER_LVL_MASK);
 }
 
-static inline int timer_pending(const struct timer_list * timer)
+static void enqueue_timer(struct timers *timers, struct timer_list *timer)
 {
-	return ((timer->entry.next) != NULL);
+	int idx = timer_calc_index(timers->clk, timer->expires);
+
+	list_add_tail(&timers->vectors[idx], &timer->entry);
+	timers->pending[idx >> TIMER_LVL_BITS] |=
+		BIT(idx & TIMER_LVL_MASK);
+	timer->idx = idx;
 }
 
 static int detach_timer(struct timers *timers, struct timer_list *timer)
 {
 	struct list_head *entry = &timer->entry;
+	int idx = timer->idx;
 
 	if (timer_pending(timer)) {
 		list_del(entry);
 		entry->next = NULL;
+
+		if ((idx != TIMER_IDX_NONE) &&
+				is_list_empty(&timers->vectors[idx]))
+			timers->pending[idx >> TIMER_LVL_BITS] &=
+				~BIT(idx & TIMER_LVL_MASK);
+		timer->idx = TIMER_IDX_NONE;
 	}
 
 	return 0;
 }
 
+/*
+ * move the timers of one bucket to the expired list, or
+ * cascade them to the lower level if not expired yet, the
+ * timers->clk has already been updated to now.
+ */
+static void collect_bucket(struct timers *timers, int idx, unsigned long now)
+{
+	struct timer_list *timer;
+	struct list_head *bucket = &timers->vectors[idx];
+	struct list_head head;
+
+	/*
+	 * splice out the bucket first since the timers which
+	 * are not expired may be enqueued to the same bucket
+	 * again.
+	 */
+	head.next = bucket->next;
+	head.pre = bucket->pre;
+	head.next->pre = &head;
+	head.pre->next = &head;
+	init_list(bucket);
+	timers->pending[idx >> TIMER_LVL_BITS] &= ~BIT(idx & TIMER_LVL_MASK);
+
+	while (!is_list_empty(&head)) {
+		timer = list_first_entry(&head, struct timer_list, entry);
+		list_del(&timer->entry);
+
+		if (timer->expires <= (now + DEFAULT_TIMER_MARGIN)) {
+			list_add_tail(&timers->expired, &timer->entry);
+			timer->idx = TIMER_IDX_NONE;
+		} else {
+			enqueue_timer(timers, timer);
+		}
+	}
+}
+
+static void collect_expired_timers(struct timers *timers, unsigned long now)
+{
+	unsigned long tick = now >> TIMER_TICK_SHIFT;
+	unsigned long clk = timers->clk;
+	unsigned long start, end, unit, pending;
+	int lvl, shift, base;
+
+	timers->clk = tick;
+
+	for (lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+		shift = lvl * TIMER_LVL_BITS;
+		base = lvl << TIMER_LVL_BITS;
+		start = (clk >> shift) + (lvl ? 1 : 0);
+		end = tick >> shift;
+
+		/*
+		 * no bucket of this level is reached, then the
+		 * upper level can not be reached neither
+		 */
+		if (start > end)
+			break;
+
+		if ((end - start) >= TIMER_LVL_MASK) {
+			pending = timers->pending[lvl];
+			while (pending) {
+				unit = __ffs(pending);
+				pending &= ~BIT(unit);
+				collect_bucket(timers, base + unit, now);
+			}
+			continue;
+		}
+
+		for (unit = start; unit <= end; unit++) {
+			if (timers->pending[lvl] & BIT(unit & TIMER_LVL_MASK))
+				collect_bucket(timers, base +
+						(unit & TIMER_LVL_MASK), now);
+		}
+	}
+}
+
+/*
+ * in one level the buckets are ordered from the bucket of
+ * clk, so only the first pending bucket of each level need
+ * to be checked. but a lower level is not always earlier
+ * than the upper one, since a timer queued on the upper
+ * level with an old clk may expire before the timers which
+ * are queued on the lower level later, so check all levels.
+ */
+static unsigned long timers_next_expires(struct timers *timers)
+{
+	unsigned long pending, expires = ~0;
+	struct timer_list *timer;
+	int lvl, pos;
+
+	for (lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+		pending = timers->pending[lvl];
+		if (!pending)
+			continue;
+
+		pos = ((timers->clk >> (lvl * TIMER_LVL_BITS)) +
+				(lvl ? 1 : 0)) & TIMER_LVL_MASK;
+		if (pending >> pos)
+			pos += __ffs(pending >> pos);
+		else
+			pos = __ffs(pending);
+
+		list_for_each_entry(timer, &timers->vectors[
+				(lvl << TIMER_LVL_BITS) + pos], entry) {
+			if (timer->expires < expires)
+				expires = timer->expires;
+		}
+	}
+
+	return (expires == ~0UL) ? 0 : expires;
+}
+
+static void run_timer_softirq(struct softirq_action *h)
+{
+	struct timer_list *timer;
+	unsigned long expires;
+	struct timers *timers = &get_cpu_var(timers);
+	timer_func_t fn;
+	unsigned long data;
+
+	raw_spin_lock(&timers->lock);
+
+	collect_expired_timers(timers, NOW());
+
+	/*
+	 * need to be careful one case, when do the expires
+	 * handler, the spin lock will be released, then other
+	 * cpu may get this lock to delete the timer from the
+	 * expired list, so always fetch the first one
+	 */
+	while (!is_list_empty(&timers->expired)) {
+		timer = list_first_entry(&timers->expired,
+				struct timer_list, entry);
+
+		/* 
+		 * need to release the spin lock to avoid
+		 * dead lock because on the timer handler
+		 * function the task may aquire other spinlocks
+		 */
+		fn = timer->function;
+		data = timer->data;
+
+		list_del(&timer->entry);
+		timer->entry.next = NULL;
+		timers->running_timer = timer;
+		raw_spin_unlock(&timers->lock);
+
+		fn(data);
+
+		raw_spin_lock(&timers->lock);
+
+		/*
+		 * inform other cpu that this timer has been
+		 * finish processing
+		 */
+		timers->running_timer = NULL;
+		wmb();
+	}
+
+	expires = timers_next_expires(timers);
+	timers->running_expires = expires;
+	raw_spin_unlock(&timers->lock);
+
+	/* expires is 0 if there is no more timer on the cpu */
+	if (expires)
+		enable_timer(expires);
+}
+
 static inline unsigned long slack_expires(unsigned long expires)
 {
 	return expires;
@@ -142,7 +287,16 @@ static int __mod_timer(struct timer_list *timer)
 	spin_lock_irqsave(&timers->lock, flags);
 
 	detach_timer(timers, timer);
-	list_add_tail(&timers->active, &timer->entry);
+
+	/*
+	 * the clk only moves forward in the softirq, refresh
+	 * it when the wheel is empty, then the new timer will
+	 * be put on a lower level and cascaded less
+	 */
+	if (timers_empty(timers) && is_list_empty(&timers->expired))
+		timers->clk = NOW() >> TIMER_TICK_SHIFT;
+
+	enqueue_timer(timers, timer);
 
 	/*
 	 * reprogram the timer for next event do not
@@ -198,6 +352,7 @@ void init_timer_on_cpu(struct timer_list *timer, int cpu)
 	preempt_disable();
 	init_list(&timer->entry);
 	timer->entry.next = NULL;
+	timer->idx = TIMER_IDX_NONE;
 	timer->expires = 0;
 	timer->function = NULL;
 	timer->data = 0;
@@ -246,14 +401,58 @@ void add_timer(struct timer_list *timer)
 	mod_timer(timer, timer->expires);
 }
 
+#ifdef CONFIG_NO_HZ_IDLE
+/*
+ * called by the idle task with interrupt disabled before
+ * wfi, the idle task do not need the sched tick, so stop
+ * it, then the earliest timer of this pcpu is the only
+ * deadline need to be programmed. the running_expires may
+ * belong to a timer which has been deleted, reprogram the
+ * physical timer if so, to avoid a useless wakeup
+ */
+void tick_nohz_idle_enter(void)
+{
+	unsigned long expires;
+	struct timers *timers = &get_cpu_var(timers);
+
+	timers->nr_idle_enter++;
+
+	if (sched_tick_enabled()) {
+		sched_tick_disable();
+		timers->nr_wakeup_avoided++;
+	}
+
+	raw_spin_lock(&timers->lock);
+
+	expires = timers_next_expires(timers);
+	if (expires != timers->running_expires) {
+		if (timers->running_expires)
+			timers->nr_wakeup_avoided++;
+
+		timers->running_expires = expires;
+		enable_timer(expires);
+	}
+
+	raw_spin_unlock(&timers->lock);
+}
+
+void tick_nohz_stale_tick(void)
+{
+	get_cpu_var(timers).nr_stale_tick++;
+}
+#endif
+
 void init_timers(void)
 {
-	int i;
+	int i, j;
 	struct timers *timers;
 
 	for (i = 0; i < CONFIG_NR_CPUS; i++) {
 		timers = &get_per_cpu(timers, i);
-		init_list(&timers->active);
+		for (j = 0; j < TIMER_WHEEL_SIZE; j++)
+			init_list(&timers->vectors[j]);
+		init_list(&timers->expired);
+		timers->clk = 0;
 		timers->running_expires = 0;
 		spin_lock_init(&timers->lock);
 	}
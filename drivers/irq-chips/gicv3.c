@@ -369,8 +369,11 @@ static int __init_text gicv3_init(struct device_node *node)
 	void *rbase;
 	uint64_t pr;
 	uint32_t value;
-	uint64_t array[10];
+	uint64_t array[11];
 	void *__gicr_rd_base = 0;
+#if defined CONFIG_VIRQCHIP_VGICV3 && defined CONFIG_VIRT
+	unsigned long flags;
+#endif
 
 	pr_notice("*** gicv3 init ***\n");
 
@@ -448,7 +451,11 @@ static int __init_text gicv3_init(struct device_node *node)
 	spin_unlock(&gicv3_lock);
 
 #if defined CONFIG_VIRQCHIP_VGICV3 && defined CONFIG_VIRT
-	vgicv3_init(array, 10);
+	/* the maintenance interrupt of the virtual cpu interface */
+	if (!get_device_irq_index(node, &value, &flags, 0))
+		array[10] = value;
+
+	vgicv3_init(array, 11);
 #endif
 
 	return 0;
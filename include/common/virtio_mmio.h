@@ -45,11 +45,25 @@
 #define VIRTIO_MMIO_DRIVER_FEATURE2	0x320
 #define VIRTIO_MMIO_DRIVER_FEATURE3	0x324
 
+/*
+ * queue notify fast path, the hypervisor bumps the notify
+ * sequence of the queue and the notify count, then kicks
+ * the notify irq of vm0 only when the backend has acked
+ * all the former notifies, see virtio_mmio_notify()
+ */
+#define VIRTIO_MMIO_NOTIFY_IRQ		0x328
+#define VIRTIO_MMIO_NOTIFY_COUNT	0x32c
+#define VIRTIO_MMIO_NOTIFY_ACK		0x330
+#define VIRTIO_MMIO_NOTIFY_SEQ(q)	(0x340 + (q) * 4)
+#define VIRTIO_MMIO_NR_NOTIFY_QUEUES	32
+
 #define VIRTIO_DEVICE_IOMEM_SIZE	0x1000
 
 #define VIRTIO_MMIO_INT_VRING		(1 << 0)
 #define VIRTIO_MMIO_INT_CONFIG		(1 << 1)
 
+#define VIRTIO_DEV_F_NOTIFY_FAST	(1 << 0)
+
 #define VIRTIO_EVENT_BUFFER_READY	(1 << 0)
 #define VIRTIO_EVENT_QUEUE_READY	(1 << 1)
 #define VIRTIO_EVENT_STATUS_CHANGE	(1 << 2)
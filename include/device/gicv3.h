@@ -94,6 +94,41 @@
 #define GICR_NSACR			(0x0e00)
 #define GICR_PIDR2			(0xffe8)
 
+#define GICR_CTLR_ENABLE_LPIS		(1 << 0)
+#define GICR_TYPER_PLPIS		(1 << 0)
+#define GICD_TYPER_LPIS			(1 << 17)
+
+#define GITS_CTLR			(0x0000)
+#define GITS_IIDR			(0x0004)
+#define GITS_TYPER			(0x0008)
+#define GITS_TYPER_HIGH			(0x000c)
+#define GITS_CBASER			(0x0080)
+#define GITS_CBASER_HIGH		(0x0084)
+#define GITS_CWRITER			(0x0088)
+#define GITS_CREADR			(0x0090)
+#define GITS_BASER			(0x0100)
+#define GITS_BASER_END			(0x0140 - 1)
+#define GITS_PIDR2			(0xffe8)
+#define GITS_TRANSLATER			(0x10040)
+
+#define GITS_CTLR_ENABLE		(1 << 0)
+#define GITS_CTLR_QUIESCENT		(1U << 31)
+
+#define GITS_CMD_MOVI			(0x01)
+#define GITS_CMD_INT			(0x03)
+#define GITS_CMD_CLEAR			(0x04)
+#define GITS_CMD_SYNC			(0x05)
+#define GITS_CMD_MAPD			(0x08)
+#define GITS_CMD_MAPC			(0x09)
+#define GITS_CMD_MAPTI			(0x0a)
+#define GITS_CMD_MAPI			(0x0b)
+#define GITS_CMD_INV			(0x0c)
+#define GITS_CMD_INVALL			(0x0d)
+#define GITS_CMD_MOVALL			(0x0e)
+#define GITS_CMD_DISCARD		(0x0f)
+
+#define GICV3_LPI_BASE			(8192)
+
 #define GICH_VMCR_VENG0			(1 << 0)
 #define GICH_VMCR_VENG1			(1 << 1)
 #define GICH_VMCR_VACKCTL		(1 << 2)
@@ -124,22 +159,7 @@
 #define GICV3_NR_SGI		(16)
 
 struct gicv3_context {
-	uint64_t ich_lr0_el2;
-	uint64_t ich_lr1_el2;
-	uint64_t ich_lr2_el2;
-	uint64_t ich_lr3_el2;
-	uint64_t ich_lr4_el2;
-	uint64_t ich_lr5_el2;
-	uint64_t ich_lr6_el2;
-	uint64_t ich_lr7_el2;
-	uint64_t ich_lr8_el2;
-	uint64_t ich_lr9_el2;
-	uint64_t ich_lr10_el2;
-	uint64_t ich_lr11_el2;
-	uint64_t ich_lr12_el2;
-	uint64_t ich_lr13_el2;
-	uint64_t ich_lr14_el2;
-	uint64_t ich_lr15_el2;
+	uint64_t ich_lr_el2[16];
 	uint32_t ich_ap0r2_el2;
 	uint32_t ich_ap1r2_el2;
 	uint32_t ich_ap0r1_el2;
@@ -149,6 +169,8 @@ struct gicv3_context {
 	uint32_t icc_sre_el1;
 	uint32_t ich_vmcr_el2;
 	uint32_t ich_hcr_el2;
+	uint32_t lr_live;	/* the LRs which are saved */
+	uint32_t aprn_live;	/* whether the APRn registers are not 0 */
 } __align(sizeof(unsigned long));
 
 struct gic_lr {
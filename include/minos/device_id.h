@@ -97,6 +97,7 @@ struct module_id {
 
 extern char *gicv2_match_table[];
 extern char *gicv3_match_table[];
+extern char *gicv3_its_match_table[];
 extern char *bcmirq_match_table[];
 extern char *ipmmu_match_table[];
 extern char *pl031_match_table[];
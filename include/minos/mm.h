@@ -56,6 +56,12 @@ static inline struct mem_block *alloc_mem_block(unsigned long flags)
 	return NULL;
 }
 
+static inline struct mem_block *
+alloc_mem_blocks(int count, int align, unsigned long flags)
+{
+	return NULL;
+}
+
 static inline void release_mem_block(struct mem_block *block)
 {
 
@@ -68,9 +74,11 @@ static inline void add_slab_mem(unsigned long base, size_t size)
 
 #else
 struct mem_block *alloc_mem_block(unsigned long flags);
+struct mem_block *alloc_mem_blocks(int count, int align, unsigned long flags);
 void release_mem_block(struct mem_block *block);
 int has_enough_memory(size_t size);
 void add_slab_mem(unsigned long base, size_t size);
+void get_page_pool_stat(int io, unsigned long *free, unsigned long *largest);
 #endif
 
 #endif
@@ -49,6 +49,36 @@ struct pcpu {
 	uint8_t local_rdy_grp;
 	struct list_head ready_list[8];
 
+	/*
+	 * count of the ready task on the ready list, the
+	 * idle task is not included, nr_mig_ready is the
+	 * count of the migratable task in them
+	 */
+	uint32_t nr_ready;
+	uint32_t nr_mig_ready;
+
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	/*
+	 * steal_req - bitmap of the pcpus which request to
+	 * steal a task from this pcpu.
+	 * steal_pending - this pcpu has sent a request and
+	 * is waitting for the reply.
+	 */
+	unsigned long steal_req;
+	volatile int steal_pending;
+	unsigned long nr_steal;
+	unsigned long nr_stolen;
+#endif
+
+#ifdef CONFIG_SCHED_RT_PERCPU
+	/*
+	 * realtime ready bitmap of this pcpu, one bit for
+	 * each realtime prio, it is updated by atomic bitops
+	 * so other pcpu can set it without any lock
+	 */
+	unsigned long rt_rdy_map;
+#endif
+
 	/*
 	 * each pcpu will have one kernel task which
 	 * will do some maintenance work for the pcpu
@@ -70,6 +100,20 @@ struct pcpu {
 #define add_task_to_ready_list_tail(pcpu, task)	\
 	list_add_tail(&pcpu->ready_list[task->local_prio], &task->stat_list)
 
+static inline void pcpu_ready_inc(struct pcpu *pcpu, struct task *task)
+{
+	pcpu->nr_ready++;
+	if (task->flags & TASK_FLAGS_MIGRATE)
+		pcpu->nr_mig_ready++;
+}
+
+static inline void pcpu_ready_dec(struct pcpu *pcpu, struct task *task)
+{
+	pcpu->nr_ready--;
+	if (task->flags & TASK_FLAGS_MIGRATE)
+		pcpu->nr_mig_ready--;
+}
+
 void pcpus_init(void);
 void sched(void);
 void sched_yield(void);
@@ -87,5 +131,7 @@ void irq_exit(gp_regs *regs);
 void sched_task(struct task *task);
 void cpus_resched(void);
 int select_task_run_cpu(void);
+int select_rt_task_cpu(void);
+void sched_balance(struct pcpu *pcpu);
 
 #endif
@@ -66,6 +66,11 @@ static inline int task_is_vcpu(struct task *task)
 	return (task->flags & TASK_FLAGS_VCPU);
 }
 
+static inline int task_is_migratable(struct task *task)
+{
+	return !!(task->flags & TASK_FLAGS_MIGRATE);
+}
+
 static inline void task_set_resched(struct task *task)
 {
 	struct task_info *tf = (struct task_info *)task->stack_origin;
@@ -92,6 +97,20 @@ void do_release_task(struct task *task);
 struct task *pid_to_task(int pid);
 void os_for_all_task(void (*hdl)(struct task *task));
 
+#ifdef CONFIG_SCHED_RT_PERCPU
+/*
+ * the realtime ready bitmap is percpu and updated by
+ * atomic bitops, so the realtime task is protected by
+ * its own lock the same as the percpu task, a wakeup
+ * from other pcpu do not need the kernel lock
+ */
+#define task_lock(task)			raw_spin_lock(&(task)->lock)
+#define task_unlock(task)		raw_spin_unlock(&(task)->lock)
+#define task_lock_irqsave(task, flags)	\
+	spin_lock_irqsave(&(task)->lock, flags)
+#define task_unlock_irqrestore(task, flags)	\
+	spin_unlock_irqrestore(&(task)->lock, flags)
+#else
 #define task_lock(task)					\
 	do {						\
 		if (task_is_realtime(task))		\
@@ -123,5 +142,6 @@ void os_for_all_task(void (*hdl)(struct task *task));
 		else					\
 			spin_unlock_irqrestore(&task->lock, flags);	\
 	} while (0)
+#endif
 
 #endif
@@ -39,6 +39,7 @@
 #define TASK_FLAGS_REALTIME_BIT	3
 #define TASK_FLAGS_32BIT_BIT	4
 #define TASK_FLAGS_KERNEL_BIT	5
+#define TASK_FLAGS_MIGRATE_BIT	6
 
 #define TASK_FLAGS_IDLE		BIT(TASK_FLAGS_IDLE_BIT)
 #define TASK_FLAGS_VCPU		BIT(TASK_FLAGS_VCPU_BIT)
@@ -46,6 +47,7 @@
 #define TASK_FLAGS_REALTIME	BIT(TASK_FLAGS_REALTIME_BIT)
 #define TASK_FLAGS_32BIT	BIT(TASK_FLAGS_32BIT_BIT)
 #define TASK_FLAGS_KERNEL	BIT(TASK_FLAGS_KERNEL_BIT)
+#define TASK_FLAGS_MIGRATE	BIT(TASK_FLAGS_MIGRATE_BIT)
 
 #define PCPU_AFF_ANY		0xffff
 #define PCPU_AFF_LOCAL		0xfffe
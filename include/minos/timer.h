@@ -8,10 +8,26 @@
 
 #define DEFAULT_TIMER_MARGIN	(10)
 
+/*
+ * each pcpu keeps its timers in a hierarchical timer wheel,
+ * the tick of level 0 is 1024ns, every upper level has a 64
+ * times bigger granularity, 6 levels can cover about 19 hours
+ * timers beyond that are parked at the last bucket and will be
+ * cascaded again when the bucket is reached.
+ */
+#define TIMER_TICK_SHIFT	10
+#define TIMER_LVL_BITS		6
+#define TIMER_LVL_SIZE		(1 << TIMER_LVL_BITS)
+#define TIMER_LVL_MASK		(TIMER_LVL_SIZE - 1)
+#define TIMER_LEVELS		6
+#define TIMER_WHEEL_SIZE	(TIMER_LVL_SIZE * TIMER_LEVELS)
+#define TIMER_IDX_NONE		(-1)
+
 typedef void (*timer_func_t)(unsigned long);
 
 struct timer_list {
 	int cpu;
+	int idx;
 	struct list_head entry;
 	unsigned long expires;
 	timer_func_t function;
@@ -20,10 +36,20 @@ struct timer_list {
 };
 
 struct timers {
-	struct list_head active;
+	unsigned long clk;
+	unsigned long pending[TIMER_LEVELS];
+	struct list_head vectors[TIMER_WHEEL_SIZE];
+	struct list_head expired;
 	unsigned long running_expires;
 	struct timer_list *running_timer;
 	spinlock_t lock;
+
+#ifdef CONFIG_NO_HZ_IDLE
+	/* idle statistics of this pcpu */
+	unsigned long nr_idle_enter;
+	unsigned long nr_wakeup_avoided;
+	unsigned long nr_stale_tick;
+#endif
 };
 
 void init_timer(struct timer_list *timer);
@@ -33,4 +59,12 @@ int del_timer(struct timer_list *timer);
 int del_timer_sync(struct timer_list *timer);
 int mod_timer(struct timer_list *timer, unsigned long expires);
 
+#ifdef CONFIG_NO_HZ_IDLE
+void tick_nohz_idle_enter(void);
+void tick_nohz_stale_tick(void);
+#else
+static inline void tick_nohz_idle_enter(void) {}
+static inline void tick_nohz_stale_tick(void) {}
+#endif
+
 #endif
@@ -32,6 +32,7 @@
 #define HVC_VM_VIRTIO_MMIO_DEINIT	HVC_VM0_FN(12)
 #define HVC_VM_CREATE_RESOURCE		HVC_VM0_FN(13)
 #define HVC_CHANGE_LOG_LEVEL		HVC_VM0_FN(14)
+#define HVC_VM_SEND_MSI			HVC_VM0_FN(15)
 
 #define HVC_GET_VMID			HVC_MISC_FN(0)
 #define HVC_SCHED_OUT			HVC_MISC_FN(1)
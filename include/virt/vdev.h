@@ -38,6 +38,7 @@ void vdev_release(struct vdev *vdev);
 int iomem_vdev_init(struct vm *vm, struct vdev *vdev, uint32_t size);
 int host_vdev_init(struct vm *vm, struct vdev *vdev,
 		unsigned long base, uint32_t size);
+struct vdev *vdev_find(struct vm *vm, unsigned long address);
 int vdev_mmio_emulation(gp_regs *regs, int write,
 		unsigned long address, unsigned long *value);
 void vdev_set_name(struct vdev *vdev, char *name);
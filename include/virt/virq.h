@@ -47,6 +47,10 @@ struct irqtag;
 
 #define VM_VIRQ_NR(nr)		((nr) + VM_LOCAL_VIRQ_NR)
 
+/* the LPIs only exist when the vm has a virtual ITS */
+#define VM_LPI_VIRQ_BASE	(8192)
+#define VIRQ_LPI_OFFSET(virq)	((virq) - VM_LPI_VIRQ_BASE)
+
 #define MAX_HVM_VIRQ		(HVM_SPI_VIRQ_NR + VM_LOCAL_VIRQ_NR)
 #define MAX_GVM_VIRQ		(GVM_SPI_VIRQ_NR + VM_LOCAL_VIRQ_NR)
 
@@ -74,20 +78,51 @@ struct virq_desc {
 	uint16_t hno;
 	uint32_t flags;
 	struct list_head list;
+#ifdef CONFIG_VIRQ_DELIVERY_STAT
+	unsigned long send_ns;
+#endif
+};
+
+/*
+ * the pending virqs are queued by priority, each 8 levels of
+ * the 256 priorities share one bucket, which is the priority
+ * granularity of the GIC list registers. The bit of a bucket
+ * in pending_mask is set when the bucket is not empty, the
+ * lower the bucket the higher the priority
+ */
+#define VIRQ_PR_SHIFT		3
+#define VIRQ_NR_PR_BUCKETS	(256 >> VIRQ_PR_SHIFT)
+
+/*
+ * the delivery latency of the virqs of one vcpu, from the
+ * virq is sent until it is written to a list register, hist[n]
+ * counts the latency in [2^n, 2^(n+1)) ns
+ */
+#define VIRQ_STAT_NR_BUCKETS	32
+
+struct virq_delivery_stat {
+	unsigned long count;
+	unsigned long total_ns;
+	unsigned long max_ns;
+	unsigned long hist[VIRQ_STAT_NR_BUCKETS];
 };
 
 struct virq_struct {
 	uint32_t active_count;
 	uint32_t pending_hirq;
 	uint32_t pending_virq;
+	uint32_t pending_mask;
 	spinlock_t lock;
-	struct list_head pending_list;
+	struct list_head pending_list[VIRQ_NR_PR_BUCKETS];
 	struct list_head active_list;
 	struct virq_desc local_desc[VM_LOCAL_VIRQ_NR];
 #if defined(CONFIG_VIRQCHIP_VGICV2) || defined(CONFIG_VIRQCHIP_VGICV3)
 #define MAX_NR_LRS 64
 	struct ffs_table lrs_table;
 #endif
+#ifdef CONFIG_VIRQ_DELIVERY_STAT
+	struct virq_delivery_stat stat;
+#endif
 };
 
 static void inline virq_set_enable(struct virq_desc *d)
@@ -185,10 +220,66 @@ static void inline virq_clear_fiq(struct virq_desc *d)
 	d->flags &= ~VIRQS_FIQ;
 }
 
+static int inline virq_pr_bucket(struct virq_desc *d)
+{
+	return d->pr >> VIRQ_PR_SHIFT;
+}
+
+/*
+ * below helpers need to be called with virq_struct->lock
+ * held, a virq is on one of the pending buckets or on the
+ * active list when its list.next is not NULL
+ */
+static void inline virq_add_pending(struct virq_struct *vs,
+		struct virq_desc *d)
+{
+	int bucket = virq_pr_bucket(d);
+
+	list_add_tail(&vs->pending_list[bucket], &d->list);
+	vs->pending_mask |= (1U << bucket);
+}
+
+static void inline virq_del_pending(struct virq_struct *vs,
+		struct virq_desc *d)
+{
+	int bucket = virq_pr_bucket(d);
+
+	list_del(&d->list);
+	d->list.next = NULL;
+	if (is_list_empty(&vs->pending_list[bucket]))
+		vs->pending_mask &= ~(1U << bucket);
+}
+
+/*
+ * return the oldest pending virq of the highest priority, if
+ * the priority of a virq is changed when it is queued, the
+ * bit of its old bucket is cleared here when it is found empty
+ */
+static inline struct virq_desc *virq_first_pending(struct virq_struct *vs)
+{
+	int bucket;
+
+	while (vs->pending_mask) {
+		bucket = __ffs(vs->pending_mask);
+		if (!is_list_empty(&vs->pending_list[bucket]))
+			return list_first_entry(&vs->pending_list[bucket],
+					struct virq_desc, list);
+		vs->pending_mask &= ~(1U << bucket);
+	}
+
+	return NULL;
+}
+
+static int inline virq_has_pending(struct virq_struct *vs)
+{
+	return (vs->pending_mask != 0);
+}
+
 int virq_enable(struct vcpu *vcpu, uint32_t virq);
 int virq_disable(struct vcpu *vcpu, uint32_t virq);
 void vcpu_virq_struct_init(struct vcpu *vcpu);
 void vcpu_virq_struct_reset(struct vcpu *vcpu);
+void vcpu_virq_migrate(struct vcpu *vcpu, int cpu);
 
 void vm_virq_reset(struct vm *vm);
 void send_vsgi(struct vcpu *sender,
@@ -205,8 +296,18 @@ int virq_can_request(struct vcpu *vcpu, uint32_t virq);
 uint32_t get_pending_virq(struct vcpu *vcpu);
 int virq_set_fiq(struct vcpu *vcpu, uint32_t virq);
 
+#ifdef CONFIG_VIRQ_DELIVERY_STAT
+void virq_stat_send(struct virq_desc *d);
+void virq_stat_deliver(struct virq_struct *vs, struct virq_desc *d);
+#else
+static inline void virq_stat_send(struct virq_desc *d) { }
+static inline void virq_stat_deliver(struct virq_struct *vs,
+		struct virq_desc *d) { }
+#endif
+
 int send_virq_to_vcpu(struct vcpu *vcpu, uint32_t virq);
 int send_virq_to_vm(struct vm *vm, uint32_t virq);
+int send_msi_to_vm(struct vm *vm, uint32_t devid, uint32_t eventid);
 
 int vcpu_has_irq(struct vcpu *vcpu);
 
@@ -19,6 +19,7 @@ struct virq_chip {
 	int (*get_virq_state)(struct vcpu *vcpu, struct virq_desc *virq);
 	int (*update_virq)(struct vcpu *vcpu, struct virq_desc *virq, int action);
 	int (*vcpu_init)(struct vcpu *vcpu, void *pdata, unsigned long flags);
+	int (*send_msi)(void *pdata, uint32_t devid, uint32_t eventid);
 
 	void *inc_pdata;
 	unsigned long flags;
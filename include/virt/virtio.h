@@ -1,12 +1,15 @@
 #ifndef __MINOS_VIRTIO_H__
 #define __MINOS_VIRTIO_H__
 
+#include <minos/spinlock.h>
 #include <virt/vdev.h>
 
 struct vm;
 
 struct virtio_device {
 	struct vdev vdev;
+	spinlock_t notify_lock;
+	int notify_irq;		/* vm0 virq of the notify fast path */
 };
 
 int virtio_mmio_init(struct vm *vm, unsigned long gbase,
@@ -34,6 +34,7 @@
 
 struct os;
 struct vm;
+struct vdev;
 struct virq_struct;
 struct virq_chip;
 
@@ -60,6 +61,16 @@ struct vcpu {
 	struct vmcs *vmcs;
 	int vmcs_irq;
 	void **context;
+
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	int last_pcpu;
+#endif
+
+#ifdef CONFIG_VCPU_HALT_POLL
+	uint32_t halt_poll_ns;
+	unsigned long halt_poll_hit;
+	unsigned long halt_poll_miss;
+#endif
 } __align_cache_line;
 
 struct vm_iommu {
@@ -94,6 +105,7 @@ struct vm {
 	unsigned long time_offset;
 
 	struct list_head vdev_list;
+	struct vdev *last_vdev;
 
 	atomic_t vcpu_online_cnt;
 
@@ -101,6 +113,8 @@ struct vm {
 	int virq_same_page;
 	struct virq_desc *vspi_desc;
 	unsigned long *vspi_map;
+	uint32_t vlpi_nr;
+	struct virq_desc *vlpi_desc;
 	struct virq_chip *virq_chip;
 	uint32_t vtimer_virq;
 
@@ -140,6 +154,17 @@ static int inline vcpu_affinity(struct vcpu *vcpu)
 	return vcpu->task->affinity;
 }
 
+/*
+ * the vcpu of the guest vm can be moved to an idle pcpu
+ * by the load balance, but not when the vm is going to
+ * be stopped or reset, the vcpu need to stay on its pcpu
+ * to handle the power off call
+ */
+static int inline vcpu_can_migrate(struct vcpu *vcpu)
+{
+	return (vcpu->vm->state == VM_STAT_ONLINE);
+}
+
 static inline struct vm *vcpu_to_vm(struct vcpu *vcpu)
 {
 	return vcpu->vm;
@@ -3,19 +3,34 @@
 
 #include <minos/types.h>
 
+/*
+ * the traps of a vcpu are posted to a ring, host_index is
+ * increased by the hypervisor when a trap is posted, and
+ * guest_index is increased by the vm0 when a trap has
+ * been handled.
+ */
+#define VMCS_NR_TRAPS	16
+
+struct vmcs_trap {
+	volatile uint32_t type;
+	volatile uint32_t reason;
+	volatile int32_t  ret;
+	volatile uint32_t padding;
+	volatile unsigned long data;
+	volatile unsigned long result;
+};
+
 struct vmcs {
 	volatile uint32_t vcpu_id;
-	volatile uint32_t trap_type;
-	volatile uint32_t trap_reason;
-	volatile int32_t  trap_ret;
-	volatile unsigned long trap_data;
-	volatile unsigned long trap_result;
+	volatile uint32_t nr_traps;
 	volatile uint64_t host_index;
 	volatile uint64_t guest_index;
+	volatile uint64_t padding;
+	struct vmcs_trap traps[VMCS_NR_TRAPS];
 	volatile unsigned long data[0];
 } __align(1024);
 
-#define VMCS_DATA_SIZE	(1024 - 48)
+#define VMCS_DATA_SIZE	(1024 - 32 - VMCS_NR_TRAPS * 32)
 #define VMCS_SIZE(nr) 	PAGE_BALIGN(nr * sizeof(struct vmcs))
 
 enum vm_trap_type {
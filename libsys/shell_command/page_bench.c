@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2020 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/mm.h>
+#include <minos/shell_command.h>
+
+#define PAGE_BENCH_VMS		8
+#define PAGE_BENCH_CYCLES	1000
+#define PAGE_BENCH_ALLOCS	64
+
+struct bench_vm {
+	int nr;
+	void *allocs[PAGE_BENCH_ALLOCS];
+};
+
+static struct bench_vm bench_vms[PAGE_BENCH_VMS];
+static unsigned long bench_seed = 1;
+static unsigned long alloc_cnt, alloc_total, alloc_max, alloc_fail;
+static unsigned long free_cnt, free_total, free_max;
+
+static unsigned long bench_random(void)
+{
+	bench_seed = bench_seed * 6364136223846793005UL + 1442695040888963407UL;
+	return bench_seed >> 33;
+}
+
+static void bench_alloc(struct bench_vm *vm, int pages, int align, int io)
+{
+	unsigned long start, cost;
+	void *addr;
+
+	if (vm->nr >= PAGE_BENCH_ALLOCS)
+		return;
+
+	start = NOW();
+	if (io)
+		addr = __get_io_pages(pages, align);
+	else
+		addr = __get_free_pages(pages, align);
+	cost = NOW() - start;
+
+	if (!addr) {
+		alloc_fail++;
+		return;
+	}
+
+	alloc_cnt++;
+	alloc_total += cost;
+	alloc_max = MAX(alloc_max, cost);
+	vm->allocs[vm->nr++] = addr;
+}
+
+/*
+ * replay the page allocation of creating a vm, the pgd,
+ * the virq desc, the vcpu stacks, the vmcs, the virtio
+ * and vmbox iomem and some stage2 page table pages.
+ */
+static void bench_create_vm(struct bench_vm *vm)
+{
+	int i, vcpus = 1 + bench_random() % 4;
+
+	vm->nr = 0;
+	bench_alloc(vm, 2, 2, 0);
+	bench_alloc(vm, 1 + bench_random() % 2, 1, 0);
+
+	for (i = 0; i < vcpus; i++)
+		bench_alloc(vm, 2, 2, 0);
+
+	bench_alloc(vm, vcpus, 1, 1);
+
+	for (i = 0; i < (int)(bench_random() % 4); i++)
+		bench_alloc(vm, 1, 1, 1);
+
+	if (bench_random() % 2)
+		bench_alloc(vm, 8 << (bench_random() % 3), 1, 1);
+
+	for (i = 0; i < (int)(8 + bench_random() % 24); i++)
+		bench_alloc(vm, 1, 1, 0);
+}
+
+static void bench_destroy_vm(struct bench_vm *vm)
+{
+	unsigned long start, cost;
+	int i;
+
+	for (i = 0; i < vm->nr; i++) {
+		start = NOW();
+		free_pages(vm->allocs[i]);
+		cost = NOW() - start;
+
+		free_cnt++;
+		free_total += cost;
+		free_max = MAX(free_max, cost);
+	}
+
+	vm->nr = 0;
+}
+
+static void bench_pool_stat(char *name, int io)
+{
+	unsigned long free, largest;
+
+	get_page_pool_stat(io, &free, &largest);
+	printf("%4s %12lu %10lu %7d%%\n", name, free, largest,
+			free ? (int)(100 - largest * 100 / free) : 0);
+}
+
+/*
+ * pagebench [cycles] - keep some vms alive, and destroy
+ * a random one then create a new one in each cycle, show
+ * the latency of the page allocator and the fragmentation
+ * of the page pool when all the vms are destroyed.
+ */
+static int page_bench_cmd(int argc, char **argv)
+{
+	int i, cycles = PAGE_BENCH_CYCLES;
+	struct bench_vm *vm;
+
+	if (argc > 1)
+		cycles = atoi(argv[1]);
+	if (cycles <= 0)
+		return -EINVAL;
+
+	alloc_cnt = alloc_total = alloc_max = alloc_fail = 0;
+	free_cnt = free_total = free_max = 0;
+
+	for (i = 0; i < PAGE_BENCH_VMS; i++)
+		bench_create_vm(&bench_vms[i]);
+
+	for (i = 0; i < cycles; i++) {
+		vm = &bench_vms[bench_random() % PAGE_BENCH_VMS];
+		bench_destroy_vm(vm);
+		bench_create_vm(vm);
+	}
+
+	printf("      ALLOCS   AVG(ns)   MAX(ns)   FAIL\n");
+	printf("alloc %6lu %9lu %9lu %6lu\n", alloc_cnt,
+			alloc_cnt ? alloc_total / alloc_cnt : 0,
+			alloc_max, alloc_fail);
+
+	for (i = 0; i < PAGE_BENCH_VMS; i++)
+		bench_destroy_vm(&bench_vms[i]);
+
+	printf("free  %6lu %9lu %9lu\n", free_cnt,
+			free_cnt ? free_total / free_cnt : 0, free_max);
+
+	printf("POOL   FREE_PAGES    LARGEST    FRAG\n");
+	bench_pool_stat("page", 0);
+	bench_pool_stat("io", 1);
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(pagebench, "pagebench",
+		"replay vm create and destroy to measure page allocator",
+		page_bench_cmd, 0);
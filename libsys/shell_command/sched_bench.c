@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2020 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/task.h>
+#include <minos/sched.h>
+#include <minos/shell_command.h>
+#include <minos/sem.h>
+
+#define SCHED_BENCH_LOOPS	10000
+#define SCHED_BENCH_PRIO	8
+
+static atomic_t bench_done;
+static uint32_t bench_loops;
+static unsigned long bench_cost[NR_CPUS];
+static sem_t bench_ping[NR_CPUS];
+static sem_t bench_pong[NR_CPUS];
+static int bench_stop[NR_CPUS];
+
+/*
+ * the ping task and the pong task of a pair run on two
+ * different pcpus, each round trip wakes up the realtime
+ * task on the other pcpu twice, so the cost of a cross
+ * pcpu wakeup is half of the round trip
+ */
+static int sched_bench_ping(void *data)
+{
+	int i, id = (int)(unsigned long)data;
+	unsigned long start;
+
+	start = NOW();
+	for (i = 0; i < bench_loops; i++) {
+		sem_post(&bench_pong[id]);
+		sem_pend(&bench_ping[id], 0);
+	}
+
+	bench_cost[id] = (NOW() - start) / (bench_loops * 2);
+	atomic_inc(&bench_done);
+
+	return 0;
+}
+
+static int sched_bench_pong(void *data)
+{
+	int i, id = (int)(unsigned long)data;
+
+	for (i = 0; i < bench_loops; i++) {
+		sem_pend(&bench_pong[id], 0);
+		if (bench_stop[id])
+			break;
+		sem_post(&bench_ping[id]);
+	}
+
+	return 0;
+}
+
+static int sched_bench_run(int nr, uint8_t prio)
+{
+	int i;
+	char name[32];
+	struct task *ping, *pong;
+	unsigned long total = 0, max = 0;
+
+	atomic_set(&bench_done, 0);
+
+	for (i = 0; i < nr; i++) {
+		bench_cost[i] = 0;
+		bench_stop[i] = 0;
+		sem_init(&bench_ping[i], 0);
+		sem_init(&bench_pong[i], 0);
+
+		sprintf(name, "sched_pong@%d", i);
+		pong = create_task(name, sched_bench_pong,
+				(void *)(unsigned long)i, prio + i * 2 + 1,
+				i * 2 + 1, 4096, 0);
+		if (!pong) {
+			pr_err("create bench task with prio %d fail\n",
+					prio + i * 2 + 1);
+			break;
+		}
+
+		sprintf(name, "sched_ping@%d", i);
+		ping = create_task(name, sched_bench_ping,
+				(void *)(unsigned long)i, prio + i * 2,
+				i * 2, 4096, 0);
+		if (!ping) {
+			/* let the pong task exit */
+			pr_err("create bench task with prio %d fail\n",
+					prio + i * 2);
+			bench_stop[i] = 1;
+			sem_post(&bench_pong[i]);
+			break;
+		}
+	}
+
+	nr = i;
+	while (atomic_read(&bench_done) != nr)
+		msleep(10);
+
+	if (nr == 0)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		total += bench_cost[i];
+		max = MAX(max, bench_cost[i]);
+	}
+
+	printf("%5d %12lu %12lu\n", nr, total / nr, max);
+
+	return 0;
+}
+
+/*
+ * schedbench [loops] - measure the latency of waking up
+ * a realtime task on another pcpu, with 1 to all pairs
+ * of online pcpus doing the wakeups at the same time
+ */
+static int sched_bench_cmd(int argc, char **argv)
+{
+	int cpu, nr_cpus = 0, nr;
+	uint8_t prio = SCHED_BENCH_PRIO;
+	uint32_t loops = SCHED_BENCH_LOOPS;
+
+	if (argc > 1)
+		loops = atoi(argv[1]);
+	if (loops == 0)
+		return -EINVAL;
+
+	for_each_online_cpu(cpu)
+		nr_cpus++;
+
+	if (nr_cpus < 2) {
+		printf("need at least 2 online pcpus\n");
+		return -EINVAL;
+	}
+
+	printf("PAIRS AVG_LAT(ns) MAX_LAT(ns)\n");
+
+	/*
+	 * the pid of the realtime task is its prio, use
+	 * different prio for each round since the exited
+	 * tasks may not be released by the kworker yet
+	 */
+	for (nr = 1; nr <= nr_cpus / 2; nr++) {
+		if ((prio + nr * 2) > OS_LOWEST_REALTIME_PRIO)
+			break;
+
+		bench_loops = loops;
+		if (sched_bench_run(nr, prio))
+			break;
+
+		prio += nr * 2;
+	}
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(schedbench, "schedbench",
+		"cross pcpu realtime task wakeup latency benchmark",
+		sched_bench_cmd, 0);
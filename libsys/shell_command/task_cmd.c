@@ -15,6 +15,7 @@
  */
 
 #include <minos/task.h>
+#include <minos/sched.h>
 #include <minos/shell_command.h>
 
 static void dump_task_info(struct task *task)
@@ -30,3 +31,29 @@ static int ps_cmd(int argc, char **argv)
 	return 0;
 }
 DEFINE_SHELL_COMMAND(ps, "ps", "List all task information", ps_cmd, 0);
+
+static int pcpu_cmd(int argc, char **argv)
+{
+	int cpu;
+	struct pcpu *pcpu;
+
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	printf(" CPU TASKS READY MIGRATE      STEAL     STOLEN\n");
+#else
+	printf(" CPU TASKS READY MIGRATE\n");
+#endif
+
+	for_each_online_cpu(cpu) {
+		pcpu = get_per_cpu(pcpu, cpu);
+		printf("%4d %5d %5d %7d", cpu, pcpu->nr_pcpu_task,
+				pcpu->nr_ready, pcpu->nr_mig_ready);
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+		printf(" %10lu %10lu", pcpu->nr_steal, pcpu->nr_stolen);
+#endif
+		printf("\n");
+	}
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(pcpu, "pcpu", "List the sched information of pcpu",
+		pcpu_cmd, 0);
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2020 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/task.h>
+#include <minos/sched.h>
+#include <minos/timer.h>
+#include <minos/mm.h>
+#include <minos/shell_command.h>
+
+#define TIMER_BENCH_NR		10000
+#define TIMER_BENCH_TIMEOUT	5000
+
+struct timer_bench {
+	struct timer_list *timers;
+	unsigned long seed;
+	unsigned long arm;
+	unsigned long mod;
+	unsigned long del;
+	unsigned long max_lat;
+	uint32_t fired;
+};
+
+static atomic_t bench_done;
+static uint32_t bench_nr;
+static struct timer_bench timer_bench[NR_CPUS];
+
+static unsigned long bench_random(struct timer_bench *tb)
+{
+	tb->seed = tb->seed * 6364136223846793005UL + 1442695040888963407UL;
+	return tb->seed >> 33;
+}
+
+static void bench_timer_fn(unsigned long data)
+{
+	struct timer_bench *tb = &timer_bench[smp_processor_id()];
+	struct timer_list *timer = &tb->timers[data];
+	unsigned long now = NOW();
+	unsigned long lat = now > timer->expires ? now - timer->expires : 0;
+
+	tb->max_lat = MAX(tb->max_lat, lat);
+	tb->fired++;
+}
+
+/*
+ * arm, rearm and delete the timers with random expires
+ * from 10ms to 10s, then let all of them expire in 1ms
+ * to check the latency of the timer softirq
+ */
+static int timer_bench_task(void *data)
+{
+	int i, cpu = smp_processor_id();
+	struct timer_bench *tb = &timer_bench[cpu];
+	unsigned long start, now;
+	int timeout = TIMER_BENCH_TIMEOUT;
+
+	tb->timers = malloc(sizeof(struct timer_list) * bench_nr);
+	if (!tb->timers)
+		goto out;
+
+	for (i = 0; i < bench_nr; i++) {
+		init_timer_on_cpu(&tb->timers[i], cpu);
+		tb->timers[i].function = bench_timer_fn;
+		tb->timers[i].data = i;
+	}
+
+	now = NOW();
+	start = NOW();
+	for (i = 0; i < bench_nr; i++)
+		mod_timer(&tb->timers[i], now + MILLISECS(10) +
+				bench_random(tb) % SECONDS(10));
+	tb->arm = (NOW() - start) / bench_nr;
+
+	start = NOW();
+	for (i = 0; i < bench_nr; i++)
+		mod_timer(&tb->timers[i], now + MILLISECS(10) +
+				bench_random(tb) % SECONDS(10));
+	tb->mod = (NOW() - start) / bench_nr;
+
+	start = NOW();
+	for (i = 0; i < bench_nr; i++)
+		del_timer(&tb->timers[i]);
+	tb->del = (NOW() - start) / bench_nr;
+
+	now = NOW();
+	for (i = 0; i < bench_nr; i++)
+		mod_timer(&tb->timers[i], now + MILLISECS(1) +
+				bench_random(tb) % MILLISECS(1));
+
+	while ((tb->fired != bench_nr) && (timeout-- > 0))
+		msleep(1);
+
+	for (i = 0; i < bench_nr; i++)
+		del_timer_sync(&tb->timers[i]);
+	free(tb->timers);
+out:
+	atomic_inc(&bench_done);
+
+	return 0;
+}
+
+/*
+ * timerbench [nr] - arm nr timers on each online pcpu,
+ * default is 10000
+ */
+static int timer_bench_cmd(int argc, char **argv)
+{
+	int cpu, nr = 0;
+	char name[32];
+	struct task *task;
+	struct timer_bench *tb;
+
+	bench_nr = TIMER_BENCH_NR;
+	if (argc > 1)
+		bench_nr = atoi(argv[1]);
+	if (bench_nr == 0)
+		return -EINVAL;
+
+	atomic_set(&bench_done, 0);
+
+	for_each_online_cpu(cpu) {
+		tb = &timer_bench[cpu];
+		memset(tb, 0, sizeof(struct timer_bench));
+		tb->seed = cpu + 1;
+
+		sprintf(name, "timer_bench@%d", cpu);
+		task = create_task(name, timer_bench_task, NULL,
+				OS_PRIO_DEFAULT, cpu, 4096, 0);
+		if (!task) {
+			pr_err("create timer bench task on cpu%d fail\n", cpu);
+			continue;
+		}
+		nr++;
+	}
+
+	while (atomic_read(&bench_done) != nr)
+		msleep(10);
+
+	printf(" CPU  ARM(ns)  MOD(ns)  DEL(ns) FIRED MAX_LAT(ns)\n");
+	for_each_online_cpu(cpu) {
+		tb = &timer_bench[cpu];
+		printf("%4d %8lu %8lu %8lu %5d %11lu\n", cpu, tb->arm,
+				tb->mod, tb->del, tb->fired, tb->max_lat);
+	}
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(timerbench, "timerbench",
+		"arm timers on each pcpu to measure the timer cost",
+		timer_bench_cmd, 0);
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2020 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/timer.h>
+#include <minos/shell_command.h>
+
+DECLARE_PER_CPU(struct timers, timers);
+
+/*
+ * nohz [seconds] - sample the idle statistics of each
+ * pcpu for some seconds, default is 1 second
+ */
+static int nohz_cmd(int argc, char **argv)
+{
+	int cpu;
+	uint32_t sec = 1;
+	struct timers *timers;
+	unsigned long enter[NR_CPUS], avoided[NR_CPUS];
+
+	if (argc > 1)
+		sec = atoi(argv[1]);
+	if (sec == 0)
+		return -EINVAL;
+
+	for_each_online_cpu(cpu) {
+		timers = &get_per_cpu(timers, cpu);
+		enter[cpu] = timers->nr_idle_enter;
+		avoided[cpu] = timers->nr_wakeup_avoided;
+	}
+
+	msleep(sec * 1000);
+
+	printf(" CPU  WAKEUP/S AVOIDED/S STALE_TICK\n");
+	for_each_online_cpu(cpu) {
+		timers = &get_per_cpu(timers, cpu);
+		printf("%4d %9lu %9lu %10lu\n", cpu,
+			(timers->nr_idle_enter - enter[cpu]) / sec,
+			(timers->nr_wakeup_avoided - avoided[cpu]) / sec,
+			timers->nr_stale_tick);
+	}
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(nohz, "nohz", "Sample the idle wakeup of each pcpu",
+		nohz_cmd, 0);
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/shell_command.h>
+#include <virt/vm.h>
+#include <virt/vdev.h>
+
+#define VDEV_BENCH_MAX_VDEVS	64
+#define VDEV_BENCH_ROUNDS	100000
+
+static unsigned long bench_addr[VDEV_BENCH_MAX_VDEVS];
+
+/* the lookup before the list is sorted and cached, walk all */
+static struct vdev *bench_linear_find(struct vm *vm, unsigned long address)
+{
+	struct vdev *vdev, *found = NULL;
+
+	list_for_each_entry(vdev, &vm->vdev_list, list) {
+		if ((address >= vdev->gvm_paddr) &&
+				(address < vdev->gvm_paddr + vdev->mem_size))
+			found = vdev;
+	}
+
+	return found;
+}
+
+static unsigned long bench_lookup(struct vm *vm, int nr, int rounds,
+		int rotate, int linear, unsigned long *misses)
+{
+	unsigned long start, address;
+	struct vdev *vdev;
+	int i;
+
+	start = NOW();
+	for (i = 0; i < rounds; i++) {
+		address = bench_addr[rotate ? (i % nr) : (nr - 1)];
+		if (linear)
+			vdev = bench_linear_find(vm, address);
+		else
+			vdev = vdev_find(vm, address);
+		if (!vdev)
+			(*misses)++;
+	}
+
+	return (NOW() - start) / rounds;
+}
+
+/*
+ * vdevbench vmid [rounds] - look up the vdev of an address of
+ * each vdev of the vm, the same as a mmio trap does, show the
+ * cost when the traps hit the same vdev in a row and when they
+ * go to all the vdevs in turn, and the cost of the old lookup
+ * which walked the whole list. The vm should be idle, it shares
+ * the last hit vdev with the bench.
+ */
+static int vdev_bench_cmd(int argc, char **argv)
+{
+	int nr = 0, rounds = VDEV_BENCH_ROUNDS;
+	unsigned long same, rotate, lsame, lrotate, misses = 0;
+	struct vdev *vdev, *last;
+	struct vm *vm;
+
+	if (argc < 2) {
+		printf("vdevbench vmid [rounds]\n");
+		return -EINVAL;
+	}
+
+	vm = get_vm_by_id(atoi(argv[1]));
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (!vm || (rounds <= 0))
+		return -EINVAL;
+
+	/* the middle of each vdev, in the order of the guest address */
+	list_for_each_entry(vdev, &vm->vdev_list, list) {
+		if (nr >= VDEV_BENCH_MAX_VDEVS)
+			break;
+		bench_addr[nr++] = vdev->gvm_paddr + vdev->mem_size / 2;
+	}
+
+	if (nr == 0) {
+		printf("vm-%d has no vdev\n", vm->vmid);
+		return 0;
+	}
+
+	last = vm->last_vdev;
+	same = bench_lookup(vm, nr, rounds, 0, 0, &misses);
+	rotate = bench_lookup(vm, nr, rounds, 1, 0, &misses);
+	lsame = bench_lookup(vm, nr, rounds, 0, 1, &misses);
+	lrotate = bench_lookup(vm, nr, rounds, 1, 1, &misses);
+	vm->last_vdev = last;
+
+	printf("vm-%d vdevs %d rounds %d misses %lu\n",
+			vm->vmid, nr, rounds, misses);
+	printf("  %8s %12s %12s\n", "lookup", "same ns", "rotate ns");
+	printf("  %8s %12lu %12lu\n", "cached", same, rotate);
+	printf("  %8s %12lu %12lu\n", "linear", lsame, lrotate);
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(vdevbench, "vdevbench",
+		"measure the cost of finding the vdev of a mmio trap",
+		vdev_bench_cmd, 0);
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2020 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/shell_command.h>
+#include <virt/virq.h>
+
+#define VIRQ_BENCH_MAX_VIRQS	256
+#define VIRQ_BENCH_VIRQS	128
+#define VIRQ_BENCH_ROUNDS	1000
+#define VIRQ_BENCH_LRS		4
+
+static struct virq_struct bench_vs;
+static struct virq_desc bench_descs[VIRQ_BENCH_MAX_VIRQS];
+static unsigned long bench_seed = 1;
+
+static unsigned long bench_random(void)
+{
+	bench_seed = bench_seed * 6364136223846793005UL + 1442695040888963407UL;
+	return bench_seed >> 33;
+}
+
+/* the same as what __send_virq() does for a new virq */
+static void bench_inject(struct virq_desc *desc)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bench_vs.lock, flags);
+	if (!virq_is_pending(desc)) {
+		virq_set_pending(desc);
+		if (desc->list.next == NULL)
+			virq_add_pending(&bench_vs, desc);
+	}
+	spin_unlock_irqrestore(&bench_vs.lock, flags);
+}
+
+/*
+ * the same as the vgic does on one guest entry, fill the
+ * free list registers with the pending virqs, return how
+ * many virqs are filled, a virq which comes out before
+ * the one filled last time is counted as an inversion
+ */
+static int bench_fill_lrs(int *last_bucket, unsigned long *inversions)
+{
+	unsigned long flags;
+	struct virq_desc *desc;
+	int nr = 0, bucket;
+
+	spin_lock_irqsave(&bench_vs.lock, flags);
+	while ((nr < VIRQ_BENCH_LRS) &&
+			((desc = virq_first_pending(&bench_vs)) != NULL)) {
+		bucket = virq_pr_bucket(desc);
+		if (bucket < *last_bucket)
+			(*inversions)++;
+		*last_bucket = bucket;
+
+		virq_clear_pending(desc);
+		desc->state = VIRQ_STATE_ACTIVE;
+		virq_del_pending(&bench_vs, desc);
+		list_add_tail(&bench_vs.active_list, &desc->list);
+		nr++;
+	}
+	spin_unlock_irqrestore(&bench_vs.lock, flags);
+
+	return nr;
+}
+
+/* the guest has handled all the virqs in the list registers */
+static void bench_exit(void)
+{
+	unsigned long flags;
+	struct virq_desc *desc, *n;
+
+	spin_lock_irqsave(&bench_vs.lock, flags);
+	list_for_each_entry_safe(desc, n, &bench_vs.active_list, list) {
+		list_del(&desc->list);
+		desc->list.next = NULL;
+		desc->state = VIRQ_STATE_INACTIVE;
+	}
+	spin_unlock_irqrestore(&bench_vs.lock, flags);
+}
+
+/*
+ * virqbench [virqs] [rounds] - in each round a storm of virqs
+ * with random priorities is injected to a vcpu's virq queue,
+ * then the queue is drained through some list registers like
+ * the vgic does on each guest entry, the virqs must come out
+ * in priority order, show the cost of injecting and filling.
+ */
+static int virq_bench_cmd(int argc, char **argv)
+{
+	int i, r, nr, last_bucket;
+	int virqs = VIRQ_BENCH_VIRQS, rounds = VIRQ_BENCH_ROUNDS;
+	unsigned long start, inject_ns = 0, fill_ns = 0;
+	unsigned long nr_filled = 0, nr_entries = 0, inversions = 0;
+
+	if (argc > 1)
+		virqs = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if ((virqs <= 0) || (virqs > VIRQ_BENCH_MAX_VIRQS) || (rounds <= 0))
+		return -EINVAL;
+
+	spin_lock_init(&bench_vs.lock);
+	for (i = 0; i < VIRQ_NR_PR_BUCKETS; i++)
+		init_list(&bench_vs.pending_list[i]);
+	init_list(&bench_vs.active_list);
+	bench_vs.pending_mask = 0;
+
+	memset(bench_descs, 0, sizeof(bench_descs));
+	for (i = 0; i < virqs; i++)
+		bench_descs[i].vno = VM_LOCAL_VIRQ_NR + i;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < virqs; i++)
+			bench_descs[i].pr = bench_random() & 0xff;
+
+		start = NOW();
+		for (i = 0; i < virqs; i++)
+			bench_inject(&bench_descs[bench_random() % virqs]);
+		inject_ns += NOW() - start;
+
+		last_bucket = 0;
+		start = NOW();
+		for (;;) {
+			nr = bench_fill_lrs(&last_bucket, &inversions);
+			if (nr == 0)
+				break;
+			nr_filled += nr;
+			nr_entries++;
+			bench_exit();
+		}
+		fill_ns += NOW() - start;
+	}
+
+	printf("virqs %d rounds %d lrs %d\n", virqs, rounds, VIRQ_BENCH_LRS);
+	printf("  inject %lu ns/virq, fill+exit %lu ns/virq\n",
+			inject_ns / ((unsigned long)virqs * rounds),
+			nr_filled ? fill_ns / nr_filled : 0);
+	printf("  filled %lu virqs in %lu entries, priority inversions %lu\n",
+			nr_filled, nr_entries, inversions);
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(virqbench, "virqbench",
+		"inject virq storms to measure the pending virq queue",
+		virq_bench_cmd, 0);
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <minos/minos.h>
+#include <minos/shell_command.h>
+#include <minos/time.h>
+#include <virt/vm.h>
+#include <virt/virq.h>
+
+#define VIRQ_STORM_NR		16
+#define VIRQ_STORM_BURSTS	1000
+#define VIRQ_STORM_INTERVAL	1
+#define VIRQ_STORM_RESEND_US	5
+
+static void virq_storm_reset_stat(struct vm *vm)
+{
+	struct virq_struct *vs;
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < vm->vcpu_nr; i++) {
+		vs = vm->vcpus[i]->virq_struct;
+		spin_lock_irqsave(&vs->lock, flags);
+		memset(&vs->stat, 0, sizeof(struct virq_delivery_stat));
+		spin_unlock_irqrestore(&vs->lock, flags);
+	}
+}
+
+static void virq_storm_get_stat(struct vm *vm, struct virq_delivery_stat *stat)
+{
+	struct virq_struct *vs;
+	unsigned long flags;
+	int i, j;
+
+	memset(stat, 0, sizeof(struct virq_delivery_stat));
+
+	for (i = 0; i < vm->vcpu_nr; i++) {
+		vs = vm->vcpus[i]->virq_struct;
+		spin_lock_irqsave(&vs->lock, flags);
+		stat->count += vs->stat.count;
+		stat->total_ns += vs->stat.total_ns;
+		if (vs->stat.max_ns > stat->max_ns)
+			stat->max_ns = vs->stat.max_ns;
+		for (j = 0; j < VIRQ_STAT_NR_BUCKETS; j++)
+			stat->hist[j] += vs->stat.hist[j];
+		spin_unlock_irqrestore(&vs->lock, flags);
+	}
+}
+
+/* the upper bound of the bucket which reaches the permille of virqs */
+static unsigned long virq_storm_percentile(struct virq_delivery_stat *stat,
+		int permille)
+{
+	unsigned long target, sum = 0;
+	int i;
+
+	target = (stat->count * permille + 999) / 1000;
+
+	for (i = 0; i < VIRQ_STAT_NR_BUCKETS; i++) {
+		sum += stat->hist[i];
+		if (sum >= target)
+			return 1UL << (i + 1);
+	}
+
+	return stat->max_ns;
+}
+
+/*
+ * virqstorm vmid virq [nr] [bursts] [interval_ms] [resend] - send bursts
+ * of nr SPIs from virq to the vm, more than the list registers
+ * of a vcpu, and show the latency from a virq is sent until it
+ * is written to a list register. The guest need to have the
+ * handlers for these virqs.
+ *
+ * With resend, each burst is sent again after a few us, when
+ * most of the virqs are still in the list registers of the
+ * vcpu, so they are pending again when they are handled.
+ */
+static int virq_storm_cmd(int argc, char **argv)
+{
+	int i, b, nr = VIRQ_STORM_NR, bursts = VIRQ_STORM_BURSTS;
+	int interval = VIRQ_STORM_INTERVAL, resend = 0;
+	struct virq_delivery_stat stat;
+	unsigned long failed = 0;
+	uint32_t virq;
+	struct vm *vm;
+
+	if (argc < 3) {
+		printf("virqstorm vmid virq [nr] [bursts] [interval_ms] [resend]\n");
+		return -EINVAL;
+	}
+
+	vm = get_vm_by_id(atoi(argv[1]));
+	virq = atoi(argv[2]);
+	if (argc > 3)
+		nr = atoi(argv[3]);
+	if (argc > 4)
+		bursts = atoi(argv[4]);
+	if (argc > 5)
+		interval = atoi(argv[5]);
+	if (argc > 6)
+		resend = atoi(argv[6]);
+
+	if (!vm || (virq < VM_LOCAL_VIRQ_NR) || (nr <= 0) ||
+			(virq + nr > VM_VIRQ_NR(vm->vspi_nr)) ||
+			(bursts <= 0) || (interval < 0) || (resend < 0))
+		return -EINVAL;
+
+	virq_storm_reset_stat(vm);
+
+	for (b = 0; b < bursts; b++) {
+		for (i = 0; i < nr; i++) {
+			if (send_virq_to_vm(vm, virq + i))
+				failed++;
+		}
+
+		if (resend) {
+			udelay(VIRQ_STORM_RESEND_US);
+			for (i = 0; i < nr; i++) {
+				if (send_virq_to_vm(vm, virq + i))
+					failed++;
+			}
+		}
+
+		if (interval)
+			msleep(interval);
+	}
+
+	/* let the guest handle the last burst */
+	msleep(10);
+	virq_storm_get_stat(vm, &stat);
+
+	printf("vm-%d virq %d-%d bursts %d interval %dms resend %d failed %lu\n",
+			vm->vmid, virq, virq + nr - 1, bursts,
+			interval, resend, failed);
+	if (stat.count == 0)
+		return 0;
+
+	printf("  delivered %lu avg %lu ns max %lu ns\n", stat.count,
+			stat.total_ns / stat.count, stat.max_ns);
+	printf("  p50 < %lu ns p99 < %lu ns p99.9 < %lu ns\n",
+			virq_storm_percentile(&stat, 500),
+			virq_storm_percentile(&stat, 990),
+			virq_storm_percentile(&stat, 999));
+
+	for (i = 0; i < VIRQ_STAT_NR_BUCKETS; i++) {
+		if (stat.hist[i])
+			printf("  [%lu, %lu) ns: %lu\n", 1UL << i,
+					1UL << (i + 1), stat.hist[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHELL_COMMAND(virqstorm, "virqstorm",
+		"send bursts of virqs to a vm and show the delivery latency",
+		virq_storm_cmd, 0);
@@ -0,0 +1,297 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * fio style benchmark for the blockif io engines, it drives
+ * a image file through blockif the same way virtio-blk does,
+ * a batch of requests between blockif_plug and blockif_unplug,
+ * for example:
+ *
+ *   blkbench -e threads -r randread -b 4096 -q 32 -t 10 disk.img
+ *   blkbench -e io_uring -r randread -b 4096 -q 32 -t 10 disk.img
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <minos/block_if.h>
+
+/* the same as the ring size of virtio-blk */
+#define BENCH_MAX_DEPTH		64
+
+enum bench_rw {
+	BENCH_READ,
+	BENCH_WRITE,
+	BENCH_RANDREAD,
+	BENCH_RANDWRITE,
+};
+
+struct bench_io {
+	struct blockif_req req;
+	struct bench_io *next;
+	uint64_t start;
+	void *buf;
+	int err;
+};
+
+static struct blockif_ctxt *bc;
+static struct bench_io ios[BENCH_MAX_DEPTH];
+static struct bench_io *done_head;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static enum bench_rw rw = BENCH_RANDREAD;
+static size_t bs = 4096;
+static int depth = 32;
+static int seconds = 10;
+static off_t size;
+static off_t next_off;
+
+static uint64_t nr_ios, nr_errs, total_lat, max_lat;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_done(struct blockif_req *req, int err)
+{
+	struct bench_io *io = req->param;
+
+	io->err = err;
+
+	pthread_mutex_lock(&done_lock);
+	io->next = done_head;
+	done_head = io;
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_lock);
+}
+
+static off_t bench_next_offset(void)
+{
+	off_t off, nr_blocks = size / bs;
+
+	if ((rw == BENCH_RANDREAD) || (rw == BENCH_RANDWRITE))
+		return (off_t)(random() % nr_blocks) * bs;
+
+	off = next_off;
+	next_off += bs;
+	if (next_off + bs > size)
+		next_off = 0;
+
+	return off;
+}
+
+static void bench_submit(struct bench_io *io)
+{
+	struct blockif_req *req = &io->req;
+	int ret;
+
+	req->iov[0].iov_base = io->buf;
+	req->iov[0].iov_len = bs;
+	req->iovcnt = 1;
+	req->offset = bench_next_offset();
+	req->resid = bs;
+	io->start = now_ns();
+
+	if ((rw == BENCH_READ) || (rw == BENCH_RANDREAD))
+		ret = blockif_read(bc, req);
+	else
+		ret = blockif_write(bc, req);
+
+	if (ret) {
+		fprintf(stderr, "blkbench: submit failed %d\n", ret);
+		exit(1);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: blkbench [-e threads|io_uring] "
+		"[-r read|write|randread|randwrite] [-b bs] [-q depth] "
+		"[-t seconds] file\n");
+	exit(1);
+}
+
+static int parse_rw(const char *str)
+{
+	if (!strcmp(str, "read"))
+		rw = BENCH_READ;
+	else if (!strcmp(str, "write"))
+		rw = BENCH_WRITE;
+	else if (!strcmp(str, "randread"))
+		rw = BENCH_RANDREAD;
+	else if (!strcmp(str, "randwrite"))
+		rw = BENCH_RANDWRITE;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *engine = "threads";
+	const char *rw_name = "randread";
+	struct bench_io *io, *list;
+	uint64_t start, end, lat, batch;
+	char opts[512];
+	double secs;
+	int i, c, iodepth;
+
+	while ((c = getopt(argc, argv, "e:r:b:q:t:")) != -1) {
+		switch (c) {
+		case 'e':
+			engine = optarg;
+			break;
+		case 'r':
+			rw_name = optarg;
+			if (parse_rw(optarg))
+				usage();
+			break;
+		case 'b':
+			bs = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((optind >= argc) || (bs == 0) || (bs % 512) ||
+			(depth <= 0) || (depth > BENCH_MAX_DEPTH))
+		usage();
+
+	snprintf(opts, sizeof(opts), "%s,writeback,aio=%s",
+			argv[optind], engine);
+	bc = blockif_open(opts, "bench");
+	if (!bc) {
+		fprintf(stderr, "blkbench: open %s failed\n", argv[optind]);
+		return 1;
+	}
+
+	size = blockif_size(bc);
+	if (size < bs) {
+		fprintf(stderr, "blkbench: file is smaller than bs\n");
+		return 1;
+	}
+
+	if (depth > blockif_queuesz(bc))
+		depth = blockif_queuesz(bc);
+	iodepth = depth;
+
+	for (i = 0; i < depth; i++) {
+		io = &ios[i];
+		if (posix_memalign(&io->buf, 4096, bs)) {
+			fprintf(stderr, "blkbench: no memory\n");
+			return 1;
+		}
+		memset(io->buf, 0x5a, bs);
+		io->req.callback = bench_done;
+		io->req.param = io;
+	}
+
+	start = now_ns();
+	end = start + (uint64_t)seconds * 1000000000ull;
+	batch = 0;
+
+	blockif_plug(bc);
+	for (i = 0; i < depth; i++)
+		bench_submit(&ios[i]);
+	blockif_unplug(bc);
+
+	for (;;) {
+		pthread_mutex_lock(&done_lock);
+		while (!done_head)
+			pthread_cond_wait(&done_cond, &done_lock);
+		list = done_head;
+		done_head = NULL;
+		pthread_mutex_unlock(&done_lock);
+
+		/* account and resubmit all the completed ios as a batch */
+		blockif_plug(bc);
+		for (io = list; io; io = list) {
+			list = io->next;
+			lat = now_ns() - io->start;
+			total_lat += lat;
+			if (lat > max_lat)
+				max_lat = lat;
+			nr_ios++;
+			if (io->err)
+				nr_errs++;
+
+			if (now_ns() < end)
+				bench_submit(io);
+			else
+				depth--;
+		}
+		blockif_unplug(bc);
+		batch++;
+
+		if (depth == 0)
+			break;
+	}
+
+	secs = (double)(now_ns() - start) / 1000000000.0;
+
+	printf("%s: engine=%s bs=%zu iodepth=%d\n",
+			rw_name, engine, bs, iodepth);
+	printf("  IOPS=%.0f, BW=%.1fMiB/s, ios=%llu, errs=%llu\n",
+			nr_ios / secs, nr_ios * bs / secs / 1048576.0,
+			(unsigned long long)nr_ios,
+			(unsigned long long)nr_errs);
+	printf("  lat (usec): avg=%.2f, max=%.2f, ios/batch=%.2f\n",
+			nr_ios ? (double)total_lat / nr_ios / 1000.0 : 0,
+			(double)max_lat / 1000.0,
+			batch ? (double)nr_ios / batch : 0);
+
+	blockif_close(bc);
+
+	return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cpu cost of virtq_get_descs() per request, the rings and the
+ * buffers are built in host memory which stands for the guest
+ * memory, then the same requests are posted and fetched again
+ * and again. For example:
+ *
+ *   virtqbench -q 1024 -n 3 -r 10000            virtio-blk like chains
+ *   virtqbench -q 1024 -n 3 -s -c -r 1000       scattered, cold rings
+ *   virtqbench -q 256 -n 16 -i -r 10000         indirect tables
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <minos/vm.h>
+#include <minos/mevent.h>
+#include <minos/vdev.h>
+#include <minos/virtio.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MEM_START		0x40000000UL
+#define BENCH_MEM_SIZE		(64UL << 20)
+#define BENCH_DESC_OFF		0x0
+#define BENCH_AVAIL_OFF		0x10000
+#define BENCH_USED_OFF		0x20000
+#define BENCH_TABLE_OFF		0x100000	/* indirect tables */
+#define BENCH_BUF_OFF		0x800000
+#define BENCH_IOV_MAX		256
+
+/* what virtio.c needs from the rest of mvm */
+int debug_enable;
+int stdio_in_use;
+struct vm *mvm_vm;
+
+struct mevent *mevent_add(int fd, enum ev_type type,
+		void (*func)(int, enum ev_type, void *), void *param)
+{
+	return NULL;
+}
+
+int mevent_delete_close(struct mevent *evp)
+{
+	return 0;
+}
+
+void *vdev_map_iomem(unsigned long iomem, size_t size)
+{
+	return NULL;
+}
+
+void vdev_send_irq(struct vdev *vdev)
+{
+}
+
+int vdev_alloc_irq(struct vm *vm, int nr)
+{
+	return 0;
+}
+
+static struct vm vm;
+static struct virtio_device dev;
+static struct virt_queue vq;
+static char *mem;
+
+static int num = 256;
+static int chain = 3;
+static int indirect;
+static int scatter;
+static int cold;
+static long rounds = 10000;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t now_cycles(void)
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	return now_ns();
+#endif
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: virtqbench [-q ring size] [-n descs per "
+		"request] [-i] [-s] [-c] [-r rounds]\n"
+		"  -i  one indirect table per request\n"
+		"  -s  scatter the descriptors over the table\n"
+		"  -c  flush the rings from the cache before each round\n");
+	exit(1);
+}
+
+static void fill_desc(struct vring_desc *desc, int buf, int last,
+		uint16_t next)
+{
+	desc->addr = BENCH_MEM_START + BENCH_BUF_OFF + (uint64_t)buf * 4096;
+	desc->len = 4096;
+	desc->flags = last ? VRING_DESC_F_WRITE : VRING_DESC_F_NEXT;
+	desc->next = last ? 0 : next;
+}
+
+/* build the requests, return the head of each in heads[] */
+static int build_ring(uint16_t *heads)
+{
+	struct vring_desc *table;
+	uint16_t slots[VIRTQUEUE_MAX_SIZE];
+	int i, j, k, tmp, nreq;
+
+	for (i = 0; i < num; i++)
+		slots[i] = i;
+
+	/* like a ring after some time, the free list is out of order */
+	if (scatter) {
+		for (i = num - 1; i > 0; i--) {
+			k = random() % (i + 1);
+			tmp = slots[i];
+			slots[i] = slots[k];
+			slots[k] = tmp;
+		}
+	}
+
+	if (indirect) {
+		nreq = num;
+		for (i = 0; i < nreq; i++) {
+			table = (struct vring_desc *)(mem + BENCH_TABLE_OFF +
+					(size_t)i * chain * sizeof(*table));
+			for (j = 0; j < chain; j++)
+				fill_desc(&table[j], i * chain + j,
+						j == chain - 1, j + 1);
+
+			vq.desc[slots[i]].addr = BENCH_MEM_START +
+				((char *)table - mem);
+			vq.desc[slots[i]].len = chain * sizeof(*table);
+			vq.desc[slots[i]].flags = VRING_DESC_F_INDIRECT;
+			vq.desc[slots[i]].next = 0;
+			heads[i] = slots[i];
+		}
+		return nreq;
+	}
+
+	nreq = num / chain;
+	for (i = 0; i < nreq; i++) {
+		for (j = 0; j < chain; j++) {
+			k = i * chain + j;
+			fill_desc(&vq.desc[slots[k]], k, j == chain - 1,
+					slots[k + 1 < num ? k + 1 : 0]);
+		}
+		heads[i] = slots[i * chain];
+	}
+
+	return nreq;
+}
+
+static void flush_rings(int nreq)
+{
+#if defined(__x86_64__)
+	size_t i, len;
+
+	for (i = 0; i < num * sizeof(struct vring_desc); i += 64)
+		_mm_clflush((char *)vq.desc + i);
+	for (i = 0; i < 4 + num * sizeof(uint16_t); i += 64)
+		_mm_clflush((char *)vq.avail + i);
+	if (indirect) {
+		len = (size_t)nreq * chain * sizeof(struct vring_desc);
+		for (i = 0; i < len; i += 64)
+			_mm_clflush(mem + BENCH_TABLE_OFF + i);
+	}
+	_mm_mfence();
+#else
+	static char *junk;
+
+	if (!junk)
+		junk = malloc(BENCH_MEM_SIZE);
+	memset(junk, nreq, BENCH_MEM_SIZE);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	static struct iovec iov[BENCH_IOV_MAX];
+	uint16_t heads[VIRTQUEUE_MAX_SIZE];
+	uint64_t start, cycles = 0, nr = 0, ndesc = 0;
+	unsigned int in, out;
+	int c, i, nreq, idx;
+	double secs;
+
+	while ((c = getopt(argc, argv, "q:n:iscr:")) != -1) {
+		switch (c) {
+		case 'q':
+			num = atoi(optarg);
+			break;
+		case 'n':
+			chain = atoi(optarg);
+			break;
+		case 'i':
+			indirect = 1;
+			break;
+		case 's':
+			scatter = 1;
+			break;
+		case 'c':
+			cold = 1;
+			break;
+		case 'r':
+			rounds = atol(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((num < 2) || (num > VIRTQUEUE_MAX_SIZE) || (num & (num - 1)) ||
+			(chain < 1) || (chain > num) ||
+			(chain > BENCH_IOV_MAX) || (rounds <= 0))
+		usage();
+
+	mem = aligned_alloc(4096, BENCH_MEM_SIZE);
+	if (!mem) {
+		fprintf(stderr, "virtqbench: no memory\n");
+		return 1;
+	}
+	memset(mem, 0, BENCH_MEM_SIZE);
+
+	vm.mmap = mem;
+	vm.mem_start = BENCH_MEM_START;
+	vm.mem_size = BENCH_MEM_SIZE;
+	vm.map_size = BENCH_MEM_SIZE;
+	mvm_vm = &vm;
+
+	vq.dev = &dev;
+	vq.num = num;
+	vq.ready = 1;
+	vq.iovec = iov;
+	vq.iovec_size = BENCH_IOV_MAX;
+	vq.desc = (struct vring_desc *)(mem + BENCH_DESC_OFF);
+	vq.avail = (struct vring_avail *)(mem + BENCH_AVAIL_OFF);
+	vq.used = (struct vring_used *)(mem + BENCH_USED_OFF);
+
+	nreq = build_ring(heads);
+
+	start = now_ns();
+	while (rounds--) {
+		/* post all the requests again */
+		for (i = 0; i < nreq; i++)
+			vq.avail->ring[(uint16_t)(vq.avail->idx + i) &
+				(num - 1)] = heads[i];
+		vq.avail->idx += nreq;
+
+		if (cold)
+			flush_rings(nreq);
+
+		cycles -= now_cycles();
+		while ((idx = virtq_get_descs(&vq, iov, BENCH_IOV_MAX,
+						&in, &out)) != num) {
+			if (idx < 0) {
+				fprintf(stderr, "virtqbench: get descs "
+						"failed %d\n", idx);
+				return 1;
+			}
+			nr++;
+			ndesc += in + out;
+		}
+		cycles += now_cycles();
+	}
+	secs = (double)(now_ns() - start) / 1000000000.0;
+
+	printf("ring=%d descs/request=%d%s%s%s\n", num, chain,
+			indirect ? " indirect" : "",
+			scatter ? " scattered" : "",
+			cold ? " cold" : "");
+	printf("  requests=%llu iovs=%llu in %.2fs\n",
+			(unsigned long long)nr,
+			(unsigned long long)ndesc, secs);
+#if defined(__x86_64__)
+	printf("  cycles/request=%.1f (tsc)\n", (double)cycles / nr);
+#else
+	printf("  ns/request=%.1f\n", (double)cycles / nr);
+#endif
+
+	return 0;
+}
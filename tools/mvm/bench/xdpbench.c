@@ -0,0 +1,225 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * packet rate benchmark for the AF_XDP backend, it sends or
+ * receives frames through xdpif the same way virtio-net does,
+ * a batch of frames between each xdpif_flush. For example over
+ * a veth pair:
+ *
+ *   ip link add xb0 type veth peer name xb1
+ *   ip link set xb0 up; ip link set xb1 up
+ *   xdpbench -r -t 10 xb1 &
+ *   xdpbench -w -s 64 -t 10 xb0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+#include <minos/xdp_if.h>
+
+#define BENCH_BATCH		64
+
+static int mode = XDPIF_MODE_AUTO;
+static const char *mode_name = "auto";
+static int queue_id;
+static size_t size = 64;
+static int seconds = 10;
+static int batch = BENCH_BATCH;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: xdpbench -r|-w [-m auto|skb|drv|zc] "
+		"[-q queue] [-s size] [-b batch] [-t seconds] ifname\n");
+	exit(1);
+}
+
+static void bench_rx(struct xdpif_ctxt *xc)
+{
+	static uint8_t buf[XDPIF_MAX_FRAME];
+	struct iovec iov = { buf, sizeof(buf) };
+	uint64_t start, end, first = 0, last = 0;
+	uint64_t nr = 0, bytes = 0, polls = 0;
+	struct pollfd pfd;
+	ssize_t len;
+	double secs;
+
+	pfd.fd = xdpif_fd(xc);
+	pfd.events = POLLIN;
+
+	start = now_ns();
+	end = start + (uint64_t)seconds * 1000000000ull;
+
+	while (now_ns() < end) {
+		pfd.revents = 0;
+		polls++;
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		while ((len = xdpif_recv(xc, &iov, 1)) > 0) {
+			if (nr++ == 0)
+				first = now_ns();
+			bytes += len;
+		}
+		last = now_ns();
+	}
+
+	secs = (nr > 1) ? (double)(last - first) / 1000000000.0 : 0;
+
+	printf("rx: mode=%s queue=%d\n", mode_name, queue_id);
+	printf("  pps=%.0f, BW=%.1fMbit/s, frames=%llu, truncated=%llu\n",
+			secs ? nr / secs : 0,
+			secs ? bytes * 8 / secs / 1000000.0 : 0,
+			(unsigned long long)nr,
+			(unsigned long long)xdpif_get_stats(xc)->rx_truncated);
+	printf("  frames/poll=%.2f\n", polls ? (double)nr / polls : 0);
+}
+
+static void bench_tx(struct xdpif_ctxt *xc)
+{
+	static uint8_t frame[XDPIF_MAX_FRAME];
+	struct iovec iov = { frame, size };
+	struct xdpif_stats *stats = xdpif_get_stats(xc);
+	uint64_t start, end, flushes = 0;
+	double secs;
+	int i;
+
+	/* broadcast, local experimental ethertype */
+	memset(frame, 0xff, 6);
+	frame[6] = 0x02;
+	frame[11] = 0x01;
+	frame[12] = 0x88;
+	frame[13] = 0xb5;
+
+	start = now_ns();
+	end = start + (uint64_t)seconds * 1000000000ull;
+
+	while (now_ns() < end) {
+		for (i = 0; i < batch; i++)
+			xdpif_send(xc, &iov, 1);
+		xdpif_flush(xc);
+		flushes++;
+	}
+
+	secs = (double)(now_ns() - start) / 1000000000.0;
+
+	printf("tx: mode=%s queue=%d size=%zu batch=%d\n",
+			mode_name, queue_id, size, batch);
+	printf("  pps=%.0f, BW=%.1fMbit/s, frames=%llu, dropped=%llu\n",
+			stats->tx_frames / secs,
+			stats->tx_frames * size * 8 / secs / 1000000.0,
+			(unsigned long long)stats->tx_frames,
+			(unsigned long long)stats->tx_dropped);
+	printf("  frames/kick=%.2f, frames/flush=%.2f\n",
+			stats->tx_kicks ?
+			(double)stats->tx_frames / stats->tx_kicks : 0,
+			flushes ? (double)stats->tx_frames / flushes : 0);
+}
+
+int main(int argc, char **argv)
+{
+	struct xdpif_port *port;
+	struct xdpif_ctxt *xc;
+	int c, rx = -1;
+
+	while ((c = getopt(argc, argv, "rwm:q:s:b:t:")) != -1) {
+		switch (c) {
+		case 'r':
+			rx = 1;
+			break;
+		case 'w':
+			rx = 0;
+			break;
+		case 'm':
+			mode_name = optarg;
+			mode = xdpif_parse_mode(optarg);
+			if (mode < 0)
+				usage();
+			break;
+		case 'q':
+			queue_id = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((optind >= argc) || (rx < 0) || (size < 60) ||
+			(size > XDPIF_MAX_FRAME) || (batch <= 0))
+		usage();
+
+	port = xdpif_port_open(argv[optind], mode);
+	if (!port)
+		return 1;
+
+	xc = xdpif_open(port, queue_id);
+	if (!xc) {
+		xdpif_port_close(port);
+		return 1;
+	}
+
+	if (rx)
+		bench_rx(xc);
+	else
+		bench_tx(xc);
+
+	xdpif_close(xc);
+	xdpif_port_close(port);
+
+	return 0;
+}
@@ -30,6 +30,8 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/fs.h>
 #include <errno.h>
 #include <assert.h>
@@ -65,6 +67,21 @@
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 
+/*
+ * the io_uring engine, the queue depth is only limited by
+ * the size of the submission queue
+ */
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define BLOCKIF_URING
+#endif
+
+#define BLOCKIF_URING_DEPTH	256
+
+#ifndef RWF_SYNC
+#define RWF_SYNC	0x00000004
+#endif
+
 /*
  * Debug printf
  */
@@ -87,6 +104,32 @@ enum blockstat {
 	BST_DONE
 };
 
+enum blockengine {
+	BENG_THREAD,
+	BENG_URING
+};
+
+struct blockif_uring {
+	int			fd;
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring;
+	void			*cq_ring;
+	size_t			sq_ring_sz;
+	size_t			cq_ring_sz;
+	size_t			sqes_sz;
+	unsigned int		sq_entries;
+	unsigned int		to_submit;
+	pthread_t		tid;
+};
+
 struct blockif_elem {
 	TAILQ_ENTRY(blockif_elem) link;
 	struct blockif_req  *req;
@@ -115,11 +158,22 @@ struct blockif_ctxt {
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
 
+	/* io engine, plug count and the requests queued while plugged */
+	enum blockengine	engine;
+	int			plugged;
+	int			nr_plugged;
+	struct blockif_uring	ur;
+
 	/* Request elements and free/pending/busy queues */
 	TAILQ_HEAD(, blockif_elem) freeq;
 	TAILQ_HEAD(, blockif_elem) pendq;
 	TAILQ_HEAD(, blockif_elem) busyq;
-	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
+	struct blockif_elem	*reqs;
+	int			nr_reqs;
+
+	/* called after each pass of completions */
+	void			(*batch_done)(void *arg);
+	void			*batch_arg;
 
 	/* write cache enable */
 	uint8_t			wce;
@@ -367,6 +421,7 @@ blockif_thr(void *arg)
 	struct blockif_elem *be;
 	pthread_t t;
 	uint8_t *buf;
+	int nr_done;
 
 	bc = arg;
 	if (bc->isgeom)
@@ -377,12 +432,22 @@ blockif_thr(void *arg)
 
 	pthread_mutex_lock(&bc->mtx);
 	for (;;) {
+		nr_done = 0;
 		while (blockif_dequeue(bc, t, &be)) {
 			pthread_mutex_unlock(&bc->mtx);
 			blockif_proc(bc, be, buf);
 			pthread_mutex_lock(&bc->mtx);
 			blockif_complete(bc, be);
+			nr_done++;
+		}
+
+		/* no more work for this thread, end of the batch */
+		if (nr_done && bc->batch_done) {
+			pthread_mutex_unlock(&bc->mtx);
+			bc->batch_done(bc->batch_arg);
+			pthread_mutex_lock(&bc->mtx);
 		}
+
 		/* Check ctxt status here to see if exit requested */
 		if (bc->closing)
 			break;
@@ -396,6 +461,266 @@ blockif_thr(void *arg)
 	return NULL;
 }
 
+#ifdef BLOCKIF_URING
+static int
+blockif_uring_enter(struct blockif_uring *ur, unsigned int to_submit,
+		    unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, ur->fd, to_submit,
+		       min_complete, flags, NULL, 0);
+}
+
+/*
+ * Submit all the sqes queued since the last submission with
+ * one io_uring_enter(). Called with bc->mtx held. If the kernel
+ * can not take them now they stay in the sq ring, and the next
+ * submission or the completion thread will retry.
+ */
+static int
+blockif_uring_submit(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->ur;
+	int ret;
+
+	while (ur->to_submit) {
+		ret = blockif_uring_enter(ur, ur->to_submit, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		ur->to_submit -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Fill one sqe for the request, called with bc->mtx held. A
+ * NULL be queues a nop which is used to wake up the completion
+ * thread.
+ */
+static int
+blockif_uring_queue(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_uring *ur = &bc->ur;
+	struct blockif_req *br;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, index;
+
+	tail = *ur->sq_tail;
+	if (tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >=
+	    ur->sq_entries)
+		return EAGAIN;
+
+	index = tail & *ur->sq_mask;
+	sqe = &ur->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = bc->fd;
+	sqe->user_data = (uintptr_t)be;
+
+	if (be == NULL) {
+		sqe->opcode = IORING_OP_NOP;
+		goto out;
+	}
+
+	br = be->req;
+	switch (be->op) {
+	case BOP_READ:
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = (uintptr_t)br->iov;
+		sqe->len = br->iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		break;
+	case BOP_WRITE:
+		if (bc->rdonly)
+			return EROFS;
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = (uintptr_t)br->iov;
+		sqe->len = br->iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+
+		/* writethru, same as the fsync after each pwritev */
+		if (!bc->wce)
+			sqe->rw_flags = RWF_SYNC;
+		break;
+	case BOP_FLUSH:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	default:
+		return EOPNOTSUPP;
+	}
+
+out:
+	ur->sq_array[index] = index;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->to_submit++;
+
+	return 0;
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_ctxt *bc = arg;
+	struct blockif_uring *ur = &bc->ur;
+	struct blockif_elem *be;
+	struct blockif_req *br;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail, i;
+	int err;
+
+	for (;;) {
+		if (blockif_uring_enter(ur, 0, 1,
+		    IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			WPRINTF(("blockif: io_uring_enter failed %d\n",
+				 errno));
+
+		/* reap all the completions in one pass */
+		head = *ur->cq_head;
+		tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+		for (i = head; i != tail; i++) {
+			cqe = &ur->cqes[i & *ur->cq_mask];
+			be = (struct blockif_elem *)(uintptr_t)cqe->user_data;
+			if (be == NULL)
+				continue;
+
+			br = be->req;
+			if (cqe->res < 0)
+				err = -cqe->res;
+			else {
+				err = 0;
+				if (be->op != BOP_FLUSH)
+					br->resid -= cqe->res;
+			}
+
+			/*
+			 * release the element before the callback, the
+			 * caller may queue a new request from it
+			 */
+			be->status = BST_DONE;
+			pthread_mutex_lock(&bc->mtx);
+			blockif_complete(bc, be);
+			pthread_mutex_unlock(&bc->mtx);
+
+			(*br->callback)(br, err);
+		}
+		__atomic_store_n(ur->cq_head, tail, __ATOMIC_RELEASE);
+
+		if ((head != tail) && bc->batch_done)
+			bc->batch_done(bc->batch_arg);
+
+		pthread_mutex_lock(&bc->mtx);
+		if (bc->closing && TAILQ_EMPTY(&bc->busyq)) {
+			pthread_mutex_unlock(&bc->mtx);
+			break;
+		}
+
+		/* retry the sqes which the kernel did not take */
+		if (!bc->plugged)
+			blockif_uring_submit(bc);
+		pthread_mutex_unlock(&bc->mtx);
+	}
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static void
+blockif_uring_release(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->ur;
+
+	if (ur->sqes && ur->sqes != MAP_FAILED)
+		munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ring && ur->cq_ring != MAP_FAILED)
+		munmap(ur->cq_ring, ur->cq_ring_sz);
+	if (ur->sq_ring && ur->sq_ring != MAP_FAILED)
+		munmap(ur->sq_ring, ur->sq_ring_sz);
+	if (ur->fd >= 0)
+		close(ur->fd);
+
+	memset(ur, 0, sizeof(*ur));
+	ur->fd = -1;
+}
+
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->ur;
+	struct io_uring_params p;
+	void *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = syscall(__NR_io_uring_setup, BLOCKIF_URING_DEPTH, &p);
+	if (ur->fd < 0)
+		return -errno;
+
+	ur->sq_entries = p.sq_entries;
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_sz = p.cq_off.cqes +
+			 p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->fd,
+			   IORING_OFF_SQ_RING);
+	ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->fd,
+			   IORING_OFF_CQ_RING);
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sq_ring == MAP_FAILED || ur->cq_ring == MAP_FAILED ||
+	    ur->sqes == MAP_FAILED)
+		goto err;
+
+	sq = ur->sq_ring;
+	cq = ur->cq_ring;
+	ur->sq_head = sq + p.sq_off.head;
+	ur->sq_tail = sq + p.sq_off.tail;
+	ur->sq_mask = sq + p.sq_off.ring_mask;
+	ur->sq_array = sq + p.sq_off.array;
+	ur->cq_head = cq + p.cq_off.head;
+	ur->cq_tail = cq + p.cq_off.tail;
+	ur->cq_mask = cq + p.cq_off.ring_mask;
+	ur->cqes = cq + p.cq_off.cqes;
+
+	return 0;
+err:
+	blockif_uring_release(bc);
+	return -ENOMEM;
+}
+#else
+static int
+blockif_uring_submit(struct blockif_ctxt *bc)
+{
+	return ENOSYS;
+}
+
+static int
+blockif_uring_queue(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	return ENOSYS;
+}
+
+static void
+blockif_uring_release(struct blockif_ctxt *bc)
+{
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	return NULL;
+}
+
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	return -ENOSYS;
+}
+#endif
+
 static void
 blockif_sigcont_handler(int signal)
 {
@@ -477,18 +802,82 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+/*
+ * Set up the request elements and the io engine of the ctxt,
+ * the io_uring engine falls back to the thread pool if it can
+ * not be set up.
+ */
+static int
+blockif_start(struct blockif_ctxt *bc, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int i, err;
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+
+	if (bc->engine == BENG_URING) {
+		err = blockif_uring_init(bc);
+		if (err) {
+			fprintf(stderr, "blockif: io_uring not available %d, "
+				"fall back to threads\n", err);
+			bc->engine = BENG_THREAD;
+		}
+	}
+
+	/*
+	 * leave one sqe for the nop which wakes up the
+	 * completion thread when closing
+	 */
+	if (bc->engine == BENG_URING)
+		bc->nr_reqs = bc->ur.sq_entries - 1;
+	else
+		bc->nr_reqs = BLOCKIF_MAXREQ;
+
+	bc->reqs = calloc(bc->nr_reqs, sizeof(struct blockif_elem));
+	if (bc->reqs == NULL) {
+		perror("calloc");
+		if (bc->engine == BENG_URING)
+			blockif_uring_release(bc);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < bc->nr_reqs; i++) {
+		bc->reqs[i].status = BST_FREE;
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	if (bc->engine == BENG_URING) {
+		pthread_create(&bc->ur.tid, NULL, blockif_uring_thr, bc);
+		snprintf(tname, sizeof(tname), "blk-%s-uring", ident);
+		pthread_setname_np(bc->ur.tid, tname);
+		return 0;
+	}
+
+	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
+		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
+		snprintf(tname, sizeof(tname), "blk-%s-%d", ident, i);
+		pthread_setname_np(bc->btid[i], tname);
+	}
+
+	return 0;
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
+	int fd, sectsz;
 	int writeback, ro, candelete, geom, ssopt, pssopt;
+	enum blockengine engine;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -505,6 +894,9 @@ blockif_open(const char *optstr, const char *ident)
 	/* writethru is on by default */
 	writeback = 0;
 
+	/* the thread pool is the default io engine */
+	engine = BENG_THREAD;
+
 	/*
 	 * The first element in the optstring is always a pathname.
 	 * Optional elements follow
@@ -524,6 +916,10 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
+		else if (!strcmp(cp, "aio=threads"))
+			engine = BENG_THREAD;
+		else if (!strcmp(cp, "aio=io_uring"))
+			engine = BENG_URING;
 		else if (sscanf(cp, "sectorsize=%d/%d", &ssopt, &pssopt) == 2)
 			;
 		else if (sscanf(cp, "sectorsize=%d", &ssopt) == 1)
@@ -670,20 +1066,10 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		snprintf(tname, sizeof(tname), "blk-%s-%d", ident, i);
-		pthread_setname_np(bc->btid[i], tname);
+	bc->engine = engine;
+	if (blockif_start(bc, ident)) {
+		free(bc);
+		goto err;
 	}
 
 	return bc;
@@ -693,22 +1079,110 @@ err:
 	return NULL;
 }
 
+/*
+ * Queue the request to the io_uring sq, the sqe is submitted
+ * at once unless the ctxt is plugged. Called with bc->mtx held.
+ */
+static int
+blockif_uring_request(struct blockif_ctxt *bc, struct blockif_req *breq,
+		enum blockop op, struct blockif_elem **bep)
+{
+	struct blockif_elem *be;
+	int err;
+
+	be = TAILQ_FIRST(&bc->freeq);
+	assert(be != NULL);
+	assert(be->status == BST_FREE);
+	TAILQ_REMOVE(&bc->freeq, be, link);
+	be->req = breq;
+	be->op = op;
+	be->status = BST_BUSY;
+	TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+	*bep = be;
+
+	err = blockif_uring_queue(bc, be);
+	if (err)
+		return err;
+
+	if (!bc->plugged)
+		blockif_uring_submit(bc);
+
+	return 0;
+}
+
+/*
+ * Create another ctxt of the same backing file with its own
+ * request queue and io engine, used by the multi-queue device.
+ * The file description is shared by dup() so the sub file lock
+ * of the parent still covers it, only the parent releases it.
+ */
+struct blockif_ctxt *
+blockif_clone(struct blockif_ctxt *parent, const char *ident)
+{
+	struct blockif_ctxt *bc;
+
+	assert(parent->magic == BLOCKIF_SIG);
+
+	bc = calloc(1, sizeof(struct blockif_ctxt));
+	if (bc == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	bc->fd = dup(parent->fd);
+	if (bc->fd < 0) {
+		perror("dup");
+		free(bc);
+		return NULL;
+	}
+
+	bc->magic = BLOCKIF_SIG;
+	bc->isblk = parent->isblk;
+	bc->isgeom = parent->isgeom;
+	bc->candelete = parent->candelete;
+	bc->rdonly = parent->rdonly;
+	bc->size = parent->size;
+	bc->sub_file_assign = 0;
+	bc->sub_file_start_lba = parent->sub_file_start_lba;
+	bc->sectsz = parent->sectsz;
+	bc->psectsz = parent->psectsz;
+	bc->psectoff = parent->psectoff;
+	bc->wce = parent->wce;
+	bc->engine = parent->engine;
+
+	if (blockif_start(bc, ident)) {
+		close(bc->fd);
+		free(bc);
+		return NULL;
+	}
+
+	return bc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
+	struct blockif_elem *be = NULL;
 	int err;
 
 	err = 0;
 
 	pthread_mutex_lock(&bc->mtx);
 	if (!TAILQ_EMPTY(&bc->freeq)) {
-		/*
-		 * Enqueue and inform the block i/o thread
-		 * that there is work available
-		 */
-		if (blockif_enqueue(bc, breq, op))
-			pthread_cond_signal(&bc->cond);
+		if (bc->engine == BENG_URING) {
+			err = blockif_uring_request(bc, breq, op, &be);
+		} else if (blockif_enqueue(bc, breq, op)) {
+			/*
+			 * Enqueue and inform the block i/o thread
+			 * that there is work available, if plugged
+			 * the threads are woken up on unplug
+			 */
+			if (bc->plugged)
+				bc->nr_plugged++;
+			else
+				pthread_cond_signal(&bc->cond);
+		}
 	} else {
 		/*
 		 * Callers are not allowed to enqueue more than
@@ -720,9 +1194,76 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	}
 	pthread_mutex_unlock(&bc->mtx);
 
+	/*
+	 * the request can not be queued to the io_uring, complete
+	 * it here with the error like the i/o thread does
+	 */
+	if (err && be != NULL) {
+		be->status = BST_DONE;
+		(*breq->callback)(breq, err);
+		pthread_mutex_lock(&bc->mtx);
+		blockif_complete(bc, be);
+		pthread_mutex_unlock(&bc->mtx);
+		err = 0;
+	}
+
 	return err;
 }
 
+/*
+ * Plug the ctxt to batch the requests, they are queued but
+ * not kicked until the last blockif_unplug(), then the whole
+ * batch is submitted with one io_uring_enter() or one wakeup
+ * of the i/o threads.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	bc->plugged++;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	assert(bc->plugged > 0);
+	if (--bc->plugged == 0) {
+		if (bc->engine == BENG_URING)
+			blockif_uring_submit(bc);
+		else if (bc->nr_plugged == 1)
+			pthread_cond_signal(&bc->cond);
+		else if (bc->nr_plugged > 1)
+			pthread_cond_broadcast(&bc->cond);
+		bc->nr_plugged = 0;
+	}
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/*
+ * Set the hook which is called from the completion context after
+ * a pass of completions, the caller can batch the completions
+ * which are delivered by the callbacks of this pass. The callback
+ * of a request may also be called in the caller's context, the
+ * hook is not called for those.
+ */
+void
+blockif_set_batch_done(struct blockif_ctxt *bc,
+		       void (*batch_done)(void *arg), void *arg)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	bc->batch_done = batch_done;
+	bc->batch_arg = arg;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
 int
 blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -791,6 +1332,15 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		return -1;
 	}
 
+	/*
+	 * The request is owned by the kernel, it will complete
+	 * via the normal callback path.
+	 */
+	if (bc->engine == BENG_URING) {
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -838,14 +1388,25 @@ blockif_close(struct blockif_ctxt *bc)
 	sub_file_unlock(bc);
 
 	/*
-	 * Stop the block i/o thread
+	 * Stop the block i/o thread, the io_uring completion
+	 * thread is woken up by a nop
 	 */
 	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
+	if (bc->engine == BENG_URING) {
+		blockif_uring_queue(bc, NULL);
+		blockif_uring_submit(bc);
+	}
 	pthread_mutex_unlock(&bc->mtx);
-	pthread_cond_broadcast(&bc->cond);
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
-		pthread_join(bc->btid[i], &jval);
+
+	if (bc->engine == BENG_URING) {
+		pthread_join(bc->ur.tid, &jval);
+		blockif_uring_release(bc);
+	} else {
+		pthread_cond_broadcast(&bc->cond);
+		for (i = 0; i < BLOCKIF_NUMTHR; i++)
+			pthread_join(bc->btid[i], &jval);
+	}
 
 	/* XXX Cancel queued i/o's ??? */
 
@@ -854,6 +1415,7 @@ blockif_close(struct blockif_ctxt *bc)
 	 */
 	bc->magic = 0;
 	close(bc->fd);
+	free(bc->reqs);
 	free(bc);
 
 	return 0;
@@ -937,7 +1499,7 @@ int
 blockif_queuesz(struct blockif_ctxt *bc)
 {
 	assert(bc->magic == BLOCKIF_SIG);
-	return (BLOCKIF_MAXREQ - 1);
+	return (bc->nr_reqs - 1);
 }
 
 int
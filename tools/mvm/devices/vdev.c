@@ -115,6 +115,7 @@ void release_vdevs(struct vm *vm)
 {
 	struct vdev *vdev, *tmp;
 
+	vm->last_vdev = NULL;
 	list_for_each_entry_safe(vdev, tmp, &vm->vdev_list, list) {
 		pr_info("release vdev-%s\n", vdev->name);
 		vdev->ops->deinit(vdev);
@@ -240,6 +241,24 @@ void vdev_setup_env(struct vm *vm, void *data, int os_type)
 	}
 }
 
+/*
+ * keep the vdev list sorted by the guest iomem address, then
+ * vcpu_handle_mmio can stop at the first vdev above the address
+ */
+static void vdev_list_add(struct vm *vm, struct vdev *vdev)
+{
+	struct vdev *tmp;
+
+	list_for_each_entry(tmp, &vm->vdev_list, list) {
+		if (vdev->guest_iomem < tmp->guest_iomem) {
+			list_add_tail(&tmp->list, &vdev->list);
+			return;
+		}
+	}
+
+	list_add_tail(&vm->vdev_list, &vdev->list);
+}
+
 int create_vdev(struct vm *vm, char *name, char *args)
 {
 	int ret = 0;
@@ -269,7 +288,7 @@ int create_vdev(struct vm *vm, char *name, char *args)
 	if (ret)
 		goto out;
 
-	list_add_tail(&vm->vdev_list, &vdev->list);
+	vdev_list_add(vm, vdev);
 
 	return 0;
 out:
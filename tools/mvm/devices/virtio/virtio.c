@@ -31,7 +31,10 @@
  */
 
 
+#include <sys/eventfd.h>
+
 #include <minos/vm.h>
+#include <minos/mevent.h>
 #include <minos/virtio.h>
 #include <minos/io.h>
 #include <minos/barrier.h>
@@ -88,28 +91,78 @@ static int hv_create_virtio_device(struct vm *vm, uint64_t *gbase, void **hbase)
 	return 0;
 }
 
-static inline int next_desc(struct vring_desc *desc)
+/*
+ * the guest memory which the descriptors are translated with,
+ * loaded once for each request instead of for each descriptor,
+ * every buffer is checked to be inside the guest memory
+ */
+struct virtq_xlate {
+	unsigned long base;	/* hvm va of guest pa 0 */
+	uint64_t start;
+	uint64_t size;
+};
+
+/* how many requests ahead the descriptors are prefetched */
+#define VIRTQ_PREFETCH_AHEAD	4
+#define VIRTQ_PREFETCH_LINES	4
+
+static inline void virtq_xlate_init(struct virtq_xlate *x)
 {
-	return (!(desc->flags & VRING_DESC_F_NEXT)) ? -1 : desc->next;
+	x->base = (unsigned long)mvm_vm->mmap - mvm_vm->mem_start;
+	x->start = mvm_vm->mem_start;
+	x->size = mvm_vm->map_size;
 }
 
-static void translate_desc(struct vring_desc *desc, int index,
-		struct iovec *iov, int iov_size)
+static inline void *virtq_xlate(struct virtq_xlate *x,
+		uint64_t gpa, uint32_t len)
 {
-	if (index >= iov_size) {
-		pr_err("index %d out of iov range %d\n", index, iov_size);
-		return;
+	uint64_t offset = gpa - x->start;
+
+	if (unlikely((offset > x->size) || (len > x->size - offset)))
+		return NULL;
+
+	return (void *)(x->base + gpa);
+}
+
+static inline int virtq_add_iov(struct virtq_xlate *x, uint64_t addr,
+		uint32_t len, uint16_t flags, struct iovec *iov,
+		unsigned int *in, unsigned int *out)
+{
+	iov->iov_base = virtq_xlate(x, addr, len);
+	if (unlikely(!iov->iov_base)) {
+		pr_err("desc buffer 0x%"PRIx64" 0x%x out of guest memory\n",
+				addr, len);
+		return -EFAULT;
 	}
 
-	iov[index].iov_len = desc->len;
-	iov[index].iov_base = (void *)gpa_to_hvm_va(desc->addr);
+	iov->iov_len = len;
+	if (flags & VRING_DESC_F_WRITE)
+		*in += 1;
+	else
+		*out += 1;
+
+	return 0;
 }
 
-static int get_indirect_buf(struct vring_desc *desc, int index,
-		struct iovec *iov, int iov_size, unsigned int *in,
+static void virtq_prefetch_table(void *table, uint32_t len)
+{
+	uint32_t off;
+
+	for (off = 0; (off < len) &&
+			(off < VIRTQ_PREFETCH_LINES * 64); off += 64)
+		__builtin_prefetch((char *)table + off);
+}
+
+/*
+ * each descriptor is copied out of the table with one load of
+ * the whole 16 bytes, the first lines of the table are prefetched
+ * since the chain is walked in the order of the table mostly
+ */
+static int get_indirect_buf(struct virtq_xlate *x, struct vring_desc *desc,
+		int index, struct iovec *iov, int iov_size, unsigned int *in,
 		unsigned int *out)
 {
-	struct vring_desc *in_desc, *vd;
+	struct vring_desc *in_desc, vd;
 	unsigned int nr_in, old_index = index;
 	unsigned int next = 0;
 
@@ -119,31 +172,36 @@ static int get_indirect_buf(struct vring_desc *desc, int index,
 		return -EINVAL;
 	}
 
-	in_desc = (struct vring_desc *)gpa_to_hvm_va(desc->addr);
+	in_desc = virtq_xlate(x, desc->addr, desc->len);
+	if (!in_desc) {
+		pr_err("indirect desc out of guest memory\n");
+		return -EFAULT;
+	}
+
+	virtq_prefetch_table(in_desc, desc->len);
 
 	for (;;) {
-		vd = &in_desc[next];
-		if (vd->flags & VRING_DESC_F_INDIRECT) {
+		vd = in_desc[next];
+		if (vd.flags & VRING_DESC_F_INDIRECT) {
 			pr_err("invalid desc in indirect desc\n");
 			return -EINVAL;
 		}
 
-		translate_desc(vd, index, iov, iov_size);
-		if (desc->flags & VRING_DESC_F_WRITE)
-			*in += 1;
-		else
-			*out += 1;
-
-		index++;
 		if (index >= iov_size) {
 			pr_err("%d out of ivo size\n", index);
 			return -ENOMEM;
 		}
 
-		next = next_desc(vd);
-		if (next == -1)
+		if (virtq_add_iov(x, vd.addr, vd.len, vd.flags,
+					&iov[index], in, out))
+			return -EFAULT;
+		index++;
+
+		if (!(vd.flags & VRING_DESC_F_NEXT))
 			break;
-		else if (next >= nr_in) {
+
+		next = vd.next;
+		if (next >= nr_in) {
 			pr_err("out of indirect desc range\n");
 			return -EINVAL;
 		}
@@ -153,6 +211,52 @@ static int get_indirect_buf(struct vring_desc *desc, int index,
 	return (index - old_index);
 }
 
+/*
+ * the indirect table of packed virtqueue is a array of packed
+ * descriptors which are used in order, no NEXT flag in it
+ */
+static int get_packed_indirect_buf(struct virtq_xlate *x,
+		struct vring_packed_desc *desc, int index, struct iovec *iov,
+		int iov_size, unsigned int *in, unsigned int *out)
+{
+	struct vring_packed_desc *in_desc, vd;
+	unsigned int i, nr_in, old_index = index;
+
+	nr_in = desc->len / sizeof(struct vring_packed_desc);
+	if ((desc->len % sizeof(struct vring_packed_desc)) || nr_in == 0) {
+		pr_err("invalid indirect len 0x%x\n", desc->len);
+		return -EINVAL;
+	}
+
+	in_desc = virtq_xlate(x, desc->addr, desc->len);
+	if (!in_desc) {
+		pr_err("indirect desc out of guest memory\n");
+		return -EFAULT;
+	}
+
+	virtq_prefetch_table(in_desc, desc->len);
+
+	for (i = 0; i < nr_in; i++) {
+		vd = in_desc[i];
+		if (vd.flags & VRING_DESC_F_INDIRECT) {
+			pr_err("invalid desc in indirect desc\n");
+			return -EINVAL;
+		}
+
+		if (index >= iov_size) {
+			pr_err("%d out of ivo size\n", index);
+			return -ENOMEM;
+		}
+
+		if (virtq_add_iov(x, vd.addr, vd.len, vd.flags,
+					&iov[index], in, out))
+			return -EFAULT;
+		index++;
+	}
+
+	return (index - old_index);
+}
+
 static void virtq_update_used_flags(struct virt_queue *vq)
 {
 	vq->used->flags = vq->used_flags;
@@ -165,6 +269,22 @@ static void virtq_update_avail_event(struct virt_queue *vq, uint16_t event)
 	mb();
 }
 
+static int virtq_packed_enable_notify(struct virt_queue *vq)
+{
+	struct vring_packed_desc_event *event = vq->device_event;
+
+	if (virtq_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
+		event->off_wrap = vq->last_avail_idx |
+			(vq->avail_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR);
+		wmb();
+		event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+	} else
+		event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	mb();
+
+	return virtq_has_descs(vq);
+}
+
 int virtq_enable_notify(struct virt_queue *vq)
 {
 	uint16_t avail_idx;
@@ -173,6 +293,9 @@ int virtq_enable_notify(struct virt_queue *vq)
 		return 0;
 
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vq->packed)
+		return virtq_packed_enable_notify(vq);
+
 	if (!virtq_has_feature(vq, VIRTIO_RING_F_EVENT_IDX))
 		virtq_update_used_flags(vq);
 	else
@@ -189,38 +312,153 @@ void virtq_disable_notify(struct virt_queue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 
+	/*
+	 * with EVENT_IDX the guest stops kicking once it passed
+	 * the avail event, nothing need to be updated
+	 */
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
-	if (virtq_has_feature(vq, VIRTIO_RING_F_EVENT_IDX))
+	if (vq->packed) {
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+		mb();
+	} else if (!virtq_has_feature(vq, VIRTIO_RING_F_EVENT_IDX))
 		virtq_update_used_flags(vq);
 }
 
+/*
+ * the chain of a packed virtqueue is in the continuous slots of
+ * the descriptor ring, the buffer id is in the last descriptor of
+ * the chain. The number of the descriptors of each buffer is saved
+ * since the used descriptors need to skip over them.
+ */
+static int virtq_get_packed_descs(struct virt_queue *vq,
+		struct iovec *iov, unsigned int iov_size,
+		unsigned int *in_num, unsigned int *out_num)
+{
+	struct vring_packed_desc desc;
+	struct virtq_xlate x;
+	uint16_t idx = vq->last_avail_idx;
+	uint16_t id = 0, flags;
+	unsigned int ndescs = 0;
+	int iov_index = 0, ret;
+
+	if (!virtq_has_descs(vq))
+		return vq->num;
+
+	/* read the descriptors after the flags of the head */
+	rmb();
+
+	*in_num = *out_num = 0;
+	virtq_xlate_init(&x);
+
+	do {
+		if (ndescs >= vq->num) {
+			pr_err("packed desc chain out of range %d\n", ndescs);
+			return -EINVAL;
+		}
+
+		desc = vq->desc_packed[idx];
+		flags = desc.flags;
+		id = desc.id;
+
+		if (flags & VRING_DESC_F_INDIRECT) {
+			ret = get_packed_indirect_buf(&x, &desc, iov_index,
+					iov, iov_size, in_num, out_num);
+			if (ret < 0) {
+				pr_err("failed to get indirect buf\n");
+				return ret;
+			}
+			iov_index += ret;
+		} else {
+			if (iov_index >= iov_size) {
+				pr_err("iov count out of iov range %d\n",
+						iov_size);
+				return -ENOMEM;
+			}
+
+			if (virtq_add_iov(&x, desc.addr, desc.len, flags,
+						&iov[iov_index], in_num, out_num))
+				return -EFAULT;
+			iov_index++;
+		}
+
+		ndescs++;
+		if (++idx >= vq->num)
+			idx = 0;
+	} while (flags & VRING_DESC_F_NEXT);
+
+	if (id >= vq->num) {
+		pr_err("packed buffer id out of range %d\n", id);
+		return -EINVAL;
+	}
+
+	vq->last_avail_idx += ndescs;
+	if (vq->last_avail_idx >= vq->num) {
+		vq->last_avail_idx -= vq->num;
+		vq->avail_wrap_counter ^= 1;
+	}
+
+	vq->desc_ndescs[id] = ndescs;
+	vq->avail_hist[vq->avail_hist_idx++ &
+		(VIRTQUEUE_MAX_SIZE - 1)] = ndescs;
+
+	return id;
+}
+
+/*
+ * prefetch the descriptor of the request which will be fetched
+ * some requests later, a prefetch never faults, so the entry of
+ * the avail ring does not need to be published already
+ */
+static inline void virtq_prefetch_head(struct virt_queue *vq, uint16_t idx)
+{
+	uint16_t head = vq->avail->ring[idx & (vq->num - 1)];
+
+	__builtin_prefetch(&vq->desc[head & (vq->num - 1)]);
+}
+
 int virtq_get_descs(struct virt_queue *vq,
 		struct iovec *iov, unsigned int iov_size,
 		unsigned int *in_num, unsigned int *out_num)
 {
-	struct vring_desc *desc;
+	struct vring_desc desc;
+	struct virtq_xlate x;
 	unsigned int i, head;
-	uint32_t last_avail_idx;
-	uint16_t avail_idx;
+	uint16_t last_avail_idx;
 	uint32_t count;
 	int iov_index = 0, ret;
 
-	last_avail_idx = vq->last_avail_idx;
-	avail_idx = vq->avail->idx;
-	vq->avail_idx = avail_idx;
-	mb();
+	if (vq->packed)
+		return virtq_get_packed_descs(vq, iov, iov_size,
+				in_num, out_num);
 
-	/* to avoid uint16_t overflow */
-	count = (uint16_t)((uint32_t)avail_idx - last_avail_idx);
-	if (count == 0)
-		return vq->num;
+	/*
+	 * the avail index is only read again when all the requests
+	 * seen last time are fetched, the descriptors of the first
+	 * ones of a new batch are prefetched together
+	 */
+	last_avail_idx = vq->last_avail_idx;
+	if (vq->avail_idx == last_avail_idx) {
+		vq->avail_idx = vq->avail->idx;
+		mb();
+
+		/* to avoid uint16_t overflow */
+		count = (uint16_t)(vq->avail_idx - last_avail_idx);
+		if (count == 0)
+			return vq->num;
+
+		if (count > vq->num) {
+			pr_err("avail ring out of range %d %d\n",
+					vq->avail_idx, last_avail_idx);
+			return -EINVAL;
+		}
 
-	if (count > vq->num) {
-		pr_err("avail ring out of range %d %d\n",
-				avail_idx, last_avail_idx);
-		return -EINVAL;
+		for (i = 1; (i < count) && (i < VIRTQ_PREFETCH_AHEAD); i++)
+			virtq_prefetch_head(vq, last_avail_idx + i);
 	}
 
+	if ((uint16_t)(vq->avail_idx - last_avail_idx) > VIRTQ_PREFETCH_AHEAD)
+		virtq_prefetch_head(vq, last_avail_idx + VIRTQ_PREFETCH_AHEAD);
+
 	head = vq->avail->ring[last_avail_idx & (vq->num - 1)];
 	if (head >= vq->num) {
 		pr_err("avail ring idx out of range\n");
@@ -228,23 +466,22 @@ int virtq_get_descs(struct virt_queue *vq,
 	}
 
 	*in_num = *out_num = 0;
+	virtq_xlate_init(&x);
 	i = head;
 
-	do {
-		if (iov_index >= iov_size) {
-			pr_err("iov count out of iov range %d\n", iov_size);
-			return -ENOMEM;
-		}
-
+	for (;;) {
 		if (i >= vq->num) {
 			pr_err("desc index %d > %d head = %d\n",
 					i, vq->num, head);
 			return -EINVAL;
 		}
 
-		desc = &vq->desc[i];
-		if (desc->flags & VRING_DESC_F_INDIRECT) {
-			ret = get_indirect_buf(desc, iov_index, iov,
+		desc = vq->desc[i];
+		if (desc.flags & VRING_DESC_F_NEXT)
+			__builtin_prefetch(&vq->desc[desc.next]);
+
+		if (desc.flags & VRING_DESC_F_INDIRECT) {
+			ret = get_indirect_buf(&x, &desc, iov_index, iov,
 					iov_size, in_num, out_num);
 			if (ret < 0) {
 				pr_err("failed to get indirect buf\n");
@@ -252,16 +489,24 @@ int virtq_get_descs(struct virt_queue *vq,
 			}
 
 			iov_index += ret;
-			continue;
+		} else {
+			if (iov_index >= iov_size) {
+				pr_err("iov count out of iov range %d\n",
+						iov_size);
+				return -ENOMEM;
+			}
+
+			if (virtq_add_iov(&x, desc.addr, desc.len, desc.flags,
+						&iov[iov_index], in_num,
+						out_num))
+				return -EFAULT;
+			iov_index++;
 		}
 
-		translate_desc(desc, iov_index, iov, iov_size);
-		if (desc->flags & VRING_DESC_F_WRITE)
-			*in_num += 1;
-		else
-			*out_num += 1;
-		iov_index++;
-	} while ((i = next_desc(desc)) != -1);
+		if (!(desc.flags & VRING_DESC_F_NEXT))
+			break;
+		i = desc.next;
+	}
 
 	vq->last_avail_idx++;
 
@@ -270,10 +515,98 @@ int virtq_get_descs(struct virt_queue *vq,
 
 void virtq_discard_desc(struct virt_queue *vq, int n)
 {
+	uint16_t ndescs;
+
+	/* rewind over the chains of the last n buffers */
+	if (vq->packed) {
+		while (n-- > 0) {
+			ndescs = vq->avail_hist[--vq->avail_hist_idx &
+				(VIRTQUEUE_MAX_SIZE - 1)];
+			if (vq->last_avail_idx < ndescs) {
+				vq->last_avail_idx += vq->num;
+				vq->avail_wrap_counter ^= 1;
+			}
+			vq->last_avail_idx -= ndescs;
+		}
+		return;
+	}
+
 	vq->last_avail_idx -= n;
 	wmb();
 }
 
+static inline uint16_t virtq_packed_used_flags(struct virt_queue *vq,
+		uint16_t wrap)
+{
+	return wrap ? (VRING_PACKED_DESC_F_AVAIL |
+			VRING_PACKED_DESC_F_USED) : 0;
+}
+
+/*
+ * write the id and len of all the used buffers first, then the
+ * flags, the flags of the first one at last so the driver sees
+ * the whole batch at once.
+ */
+static int virtq_add_used_packed(struct virt_queue *vq,
+			struct vring_used_elem *heads,
+			unsigned int count)
+{
+	struct vring_packed_desc *desc;
+	uint16_t idx, wrap, old;
+	unsigned int i;
+
+	if (count == 0)
+		return 0;
+
+	idx = vq->last_used_idx;
+	for (i = 0; i < count; i++) {
+		if (heads[i].id >= vq->num) {
+			pr_err("used buffer id out of range %d\n", heads[i].id);
+			return -EINVAL;
+		}
+
+		desc = &vq->desc_packed[idx];
+		desc->id = heads[i].id;
+		desc->len = heads[i].len;
+
+		idx += vq->desc_ndescs[heads[i].id];
+		if (idx >= vq->num)
+			idx -= vq->num;
+	}
+
+	wmb();
+
+	idx = vq->last_used_idx;
+	wrap = vq->used_wrap_counter;
+	for (i = 0; i < count; i++) {
+		if (i != 0)
+			vq->desc_packed[idx].flags =
+				virtq_packed_used_flags(vq, wrap);
+
+		idx += vq->desc_ndescs[heads[i].id];
+		if (idx >= vq->num) {
+			idx -= vq->num;
+			wrap ^= 1;
+		}
+	}
+
+	wmb();
+	vq->desc_packed[vq->last_used_idx].flags =
+		virtq_packed_used_flags(vq, vq->used_wrap_counter);
+
+	old = vq->last_used_idx;
+	vq->last_used_idx = idx;
+
+	/* the event index can not be compared across the wrap */
+	if ((wrap != vq->used_wrap_counter) ||
+			((uint16_t)(idx - vq->signalled_used) <
+			 (uint16_t)(idx - old)))
+		vq->signalled_used_valid = 0;
+	vq->used_wrap_counter = wrap;
+
+	return 0;
+}
+
 static int __virtq_add_used_n(struct virt_queue *vq,
 			struct vring_used_elem *heads,
 			unsigned int count)
@@ -308,6 +641,9 @@ int virtq_add_used_n(struct virt_queue *vq,
 {
 	int start, n, r;
 
+	if (vq->packed)
+		return virtq_add_used_packed(vq, heads, count);
+
 	start = vq->last_used_idx & (vq->num - 1);
 	n = vq->num - start;
 	if (n < count) {
@@ -336,16 +672,50 @@ int virtq_add_used(struct virt_queue *vq,
 	return virtq_add_used_n(vq, &heads, 1);
 }
 
+static int virtq_packed_need_notify(struct virt_queue *vq)
+{
+	struct vring_packed_desc_event *event = vq->driver_event;
+	uint16_t old, new, off_wrap, event_idx, flags;
+	int notify;
+
+	flags = event->flags;
+	if (!virtq_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ||
+			(flags != VRING_PACKED_EVENT_FLAG_DESC))
+		return (flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+
+	old = vq->signalled_used;
+	notify = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_valid = 1;
+
+	if (!notify)
+		return 1;
+
+	off_wrap = event->off_wrap;
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+			vq->used_wrap_counter)
+		event_idx -= vq->num;
+
+	return virtq_need_event(event_idx, new, old);
+}
+
 static int virtq_need_notify(struct virt_queue *vq)
 {
 	uint16_t old, new;
 	uint16_t event, flags;
 	int notify;
 
+	/* the used ring must be visible before reading the event */
+	mb();
+
 	if (virtq_has_feature(vq, VIRTIO_F_NOTIFY_ON_EMPTY) &&
-			(vq->avail_idx == vq->last_avail_idx))
+			!virtq_has_descs(vq))
 		return 1;
 
+	if (vq->packed)
+		return virtq_packed_need_notify(vq);
+
 	if (!virtq_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		flags = vq->avail->flags;;
 		return (!(flags & VRING_AVAIL_F_NO_INTERRUPT));
@@ -364,10 +734,14 @@ static int virtq_need_notify(struct virt_queue *vq)
 	return virtq_need_event(event, new, old);
 }
 
-void virtq_notify(struct virt_queue *vq)
+int virtq_notify(struct virt_queue *vq)
 {
-	if (virtq_need_notify(vq))
-		virtio_send_irq(vq->dev, VIRTIO_MMIO_INT_VRING);
+	if (!virtq_need_notify(vq))
+		return 0;
+
+	virtio_send_irq(vq->dev, VIRTIO_MMIO_INT_VRING);
+
+	return 1;
 }
 
 void virtq_add_used_and_signal(struct virt_queue *vq,
@@ -385,6 +759,20 @@ void virtq_add_used_and_signal_n(struct virt_queue *vq,
 	virtq_notify(vq);
 }
 
+static inline void virtq_lock(struct virt_queue *vq)
+{
+	if (pthread_mutex_trylock(&vq->lock)) {
+		pthread_mutex_lock(&vq->lock);
+		vq->nr_lock_contended++;
+	}
+	vq->nr_lock++;
+}
+
+static inline void virtq_unlock(struct virt_queue *vq)
+{
+	pthread_mutex_unlock(&vq->lock);
+}
+
 static int __virtio_vdev_init(struct vdev *vdev,
 		uint64_t gbase, void *hbase, int type, int rs)
 {
@@ -392,6 +780,7 @@ static int __virtio_vdev_init(struct vdev *vdev,
 		return -EINVAL;
 
 	vdev->dev_type = VDEV_TYPE_VIRTIO;
+	vdev->flags |= VDEV_FLAGS_OWN_LOCK;
 	vdev->iomem = hbase;
 	vdev->guest_iomem = gbase;
 	vdev->gvm_irq = vdev_alloc_irq(vdev->vm, 1);
@@ -427,6 +816,10 @@ static void inline virtq_reset(struct virt_queue *vq)
 	vq->used_flags = 0;
 	vq->signalled_used = 0;
 	vq->signalled_used_valid = 0;
+	vq->packed = 0;
+	vq->avail_wrap_counter = 1;
+	vq->used_wrap_counter = 1;
+	vq->avail_hist_idx = 0;
 }
 
 int virtio_device_reset(struct virtio_device *dev)
@@ -434,27 +827,123 @@ int virtio_device_reset(struct virtio_device *dev)
 	int i;
 
 	for (i = 0; i < dev->nr_vq; i++) {
+		virtq_lock(&dev->vqs[i]);
 		if (dev->ops && dev->ops->vq_reset)
 			dev->ops->vq_reset(&dev->vqs[i]);
 
 		virtq_reset(&dev->vqs[i]);
+		virtq_unlock(&dev->vqs[i]);
 	}
 
 	return 0;
 }
 
+static int virtio_queue_event(struct virtio_device *dev, uint32_t arg);
+
+/*
+ * the queue notify fast path, the hypervisor completes the
+ * QUEUE_NOTIFY write of the guest by itself and kicks the
+ * notify irq, ack the notify count first then scan all the
+ * queues whose notify sequence has been changed
+ */
+static void virtio_notify_event(int fd, enum ev_type t, void *arg)
+{
+	struct virtio_device *dev = arg;
+	void *iomem = dev->vdev->iomem;
+	struct virt_queue *vq;
+	uint32_t count, seq;
+	eventfd_t value;
+	int i;
+
+	eventfd_read(fd, &value);
+
+	do {
+		count = ioread32(iomem + VIRTIO_MMIO_NOTIFY_COUNT);
+		iowrite32(iomem + VIRTIO_MMIO_NOTIFY_ACK, count);
+		mb();
+
+		for (i = 0; i < dev->nr_vq; i++) {
+			vq = &dev->vqs[i];
+			seq = ioread32(iomem + VIRTIO_MMIO_NOTIFY_SEQ(i));
+			if (seq == vq->notify_seq)
+				continue;
+
+			vq->notify_seq = seq;
+			virtio_queue_event(dev, i);
+		}
+
+		mb();
+	} while (ioread32(iomem + VIRTIO_MMIO_NOTIFY_COUNT) != count);
+}
+
+static void virtio_notify_init(struct virtio_device *dev)
+{
+	void *iomem = dev->vdev->iomem;
+	int irq, ret;
+	int arg[2];
+
+	dev->notify_fd = -1;
+
+	irq = ioread32(iomem + VIRTIO_MMIO_NOTIFY_IRQ);
+	if (!irq || (dev->nr_vq > VIRTIO_MMIO_NR_NOTIFY_QUEUES))
+		return;
+
+	dev->notify_fd = eventfd(0, EFD_NONBLOCK);
+	if (dev->notify_fd < 0)
+		return;
+
+	arg[0] = dev->notify_fd;
+	arg[1] = irq;
+	ret = ioctl(dev->vdev->vm->vm_fd, IOCTL_REGISTER_VCPU, arg);
+	if (ret)
+		goto out;
+
+	dev->notify_evt = mevent_add(dev->notify_fd, EVF_READ,
+			virtio_notify_event, dev);
+	if (!dev->notify_evt)
+		goto out;
+
+	/* from now on the QUEUE_NOTIFY will not trap to mvm */
+	iowrite32(iomem + VIRTIO_MMIO_DEV_FLAGS,
+			ioread32(iomem + VIRTIO_MMIO_DEV_FLAGS) |
+			VIRTIO_DEV_F_NOTIFY_FAST);
+	pr_debug("%s notify fast path irq-%d\n", dev->vdev->name, irq);
+
+	return;
+out:
+	pr_warn("%s notify fast path disabled\n", dev->vdev->name);
+	close(dev->notify_fd);
+	dev->notify_fd = -1;
+}
+
 void virtio_device_deinit(struct virtio_device *virt_dev)
 {
 	int i;
 	struct virt_queue *vq;
 
+	if (virt_dev->notify_evt) {
+		iowrite32(virt_dev->vdev->iomem + VIRTIO_MMIO_DEV_FLAGS, 0);
+		mevent_delete_close(virt_dev->notify_evt);
+		virt_dev->notify_evt = NULL;
+		virt_dev->notify_fd = -1;
+	}
+
 	for (i = 0; i < virt_dev->nr_vq; i++) {
 		vq = &virt_dev->vqs[i];
+		if (vq->nr_lock)
+			pr_info("%s: vq-%d locked %llu contended %llu\n",
+				virt_dev->vdev->name, i,
+				(unsigned long long)vq->nr_lock,
+				(unsigned long long)vq->nr_lock_contended);
+
 		if (virt_dev->ops && virt_dev->ops->vq_deinit)
 			virt_dev->ops->vq_deinit(vq);
 
 		if (vq->iovec)
 			free(vq->iovec);
+		if (vq->desc_ndescs)
+			free(vq->desc_ndescs);
+		pthread_mutex_destroy(&vq->lock);
 	}
 
 	if (virt_dev->vqs)
@@ -493,6 +982,7 @@ int virtio_device_init(struct virtio_device *virt_dev, struct vdev *vdev,
 
 	vdev->iomem_size = VIRTIO_DEVICE_IOMEM_SIZE;
 	virt_dev->vdev = vdev;
+	pthread_mutex_init(&virt_dev->irq_lock, NULL);
 	virt_dev->config = vdev->iomem + VIRTIO_MMIO_CONFIG;
 
 	/* alloc memory for virtio queue */
@@ -504,6 +994,8 @@ int virtio_device_init(struct virtio_device *virt_dev, struct vdev *vdev,
 
 	virt_dev->nr_vq = queue_nr;
 	memset(virt_dev->vqs, 0, sizeof(struct virt_queue) * queue_nr);
+	for (i = 0; i < queue_nr; i++)
+		pthread_mutex_init(&virt_dev->vqs[i].lock, NULL);
 
 	if (iov_size > VIRTQUEUE_MAX_SIZE)
 		iov_size = VIRTQUEUE_MAX_SIZE;
@@ -520,6 +1012,8 @@ int virtio_device_init(struct virtio_device *virt_dev, struct vdev *vdev,
 		vq->iovec_size = iov_size;
 	}
 
+	virtio_notify_init(virt_dev);
+
 	return 0;
 
 release_virtio_dev:
@@ -563,29 +1057,28 @@ static int virtio_status_event(struct virtio_device *dev, uint32_t arg)
 static int virtio_queue_event(struct virtio_device *dev, uint32_t arg)
 {
 	struct virt_queue *queue;
+	int ret = 0;
 
-	if (arg > dev->nr_vq) {
+	if (arg >= dev->nr_vq) {
 		pr_err("receive unvaild virt queue event %d\n", arg);
 		return -EINVAL;
 	}
 
 	queue = &dev->vqs[arg];
-	if (!queue->callback) {
-		pr_warn("no callback for the queue %d\n", arg);
-		return -ENOENT;
-	}
+	virtq_lock(queue);
 
 	if (!queue->ready) {
-		pr_warn("virt queue is not ready %d\n", queue->vq_index);
-		return -EPERM;
-	}
-
-	if (queue->callback)
+		pr_warn("virt queue is not ready %d\n", arg);
+		ret = -EPERM;
+	} else if (!queue->callback) {
+		pr_warn("no callback for the queue %d\n", arg);
+		ret = -ENOENT;
+	} else
 		queue->callback(queue);
-	else
-		pr_err("no callback for this virt queue\n");
 
-	return 0;
+	virtq_unlock(queue);
+
+	return ret;
 }
 
 static int virtio_buffer_event(struct virtio_device *dev, uint32_t arg)
@@ -601,6 +1094,8 @@ static int virtio_buffer_event(struct virtio_device *dev, uint32_t arg)
 	}
 
 	vq = &dev->vqs[arg];
+	virtq_lock(vq);
+
 	vq->vq_index = arg;
 	vq->dev = dev;
 	vq->num = ioread32(iomem + VIRTIO_MMIO_QUEUE_NUM);
@@ -630,13 +1125,35 @@ static int virtio_buffer_event(struct virtio_device *dev, uint32_t arg)
 	vq->last_avail_idx = 0;
 	vq->avail_idx = 0;
 	vq->last_used_idx = 0;
+	vq->used_flags = 0;
 	vq->signalled_used = 0;
 	vq->signalled_used_valid = 0;
+	vq->avail_wrap_counter = 1;
+	vq->used_wrap_counter = 1;
+	vq->avail_hist_idx = 0;
+
+	/*
+	 * the number of descriptors of each packed buffer, and of
+	 * the latest buffers which virtq_discard_desc() rewinds
+	 */
+	vq->packed = virtq_has_feature(vq, VIRTIO_F_RING_PACKED);
+	if (vq->packed && !vq->desc_ndescs) {
+		vq->desc_ndescs = calloc(VIRTQUEUE_MAX_SIZE * 2,
+				sizeof(uint16_t));
+		if (!vq->desc_ndescs) {
+			virtq_unlock(vq);
+			return -ENOMEM;
+		}
+		vq->avail_hist = vq->desc_ndescs + VIRTQUEUE_MAX_SIZE;
+	}
+
 	vq->ready = 1;
 
 	if (dev->ops && dev->ops->vq_init)
 		dev->ops->vq_init(vq);
 
+	virtq_unlock(vq);
+
 	return 0;
 }
 
@@ -655,14 +1172,24 @@ static int virtio_mmio_write(struct virtio_device *dev,
 	unsigned long offset;
 	uint32_t arg = (uint32_t)(*value);
 
+	/*
+	 * the guest reads the registers directly, only these writes
+	 * trap. The status and the queue setup of the device are
+	 * serialized by vdev->lock, the queue notify only takes the
+	 * lock of the queue.
+	 */
 	offset = addr - dev->vdev->guest_iomem;
 	switch (offset) {
 	case VIRTIO_MMIO_STATUS:
+		pthread_mutex_lock(&dev->vdev->lock);
 		ret = virtio_status_event(dev, arg);
+		pthread_mutex_unlock(&dev->vdev->lock);
 		break;
 
 	case VIRTIO_MMIO_QUEUE_READY:
+		pthread_mutex_lock(&dev->vdev->lock);
 		ret = virtio_buffer_event(dev, arg);
+		pthread_mutex_unlock(&dev->vdev->lock);
 		break;
 
 	case VIRTIO_MMIO_QUEUE_NOTIFY:
@@ -34,14 +34,19 @@
 #include <strings.h>
 #include <assert.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include <minos/vm.h>
 #include <minos/virtio.h>
 #include <minos/block_if.h>
 #include <minos/compiler.h>
+#include <minos/mevent.h>
 
 #define VIRTIO_BLK_RINGSZ	64
 #define VIRTIO_BLK_IOVSZ	64
+#define VIRTIO_BLK_MAX_QUEUES	8
 
 #define VIRTIO_BLK_S_OK		0
 #define VIRTIO_BLK_S_IOERR	1
@@ -54,6 +59,7 @@
 #define	VIRTIO_BLK_F_BLK_SIZE	(6)	/* cfg block size valid */
 #define	VIRTIO_BLK_F_FLUSH	(9)	/* Cache flush support */
 #define	VIRTIO_BLK_F_TOPOLOGY	(10)	/* Optimal I/O alignment */
+#define	VIRTIO_BLK_F_MQ		(12)	/* Multiple request queues */
 
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(11)
@@ -78,6 +84,8 @@ struct virtio_blk_config {
 		uint32_t opt_io_size;
 	} topology;
 	uint8_t	writeback;
+	uint8_t unused0;
+	uint16_t num_queues;
 } __attribute__((packed));
 
 /*
@@ -97,21 +105,48 @@ struct virtio_blk_hdr {
 
 struct virtio_blk_ioreq {
 	struct blockif_req req;
-	struct virtio_blk *blk;
+	struct virtio_blk_queue *queue;
 	uint8_t *status;
 	uint16_t idx;
 };
 
+/*
+ * Per-queue struct, each request queue has its own blockif
+ * ctxt, and its own lock for the used ring. The completions
+ * are gathered in used[] and put to the used ring in one go,
+ * see virtio_blk_flush_used()
+ */
+struct virtio_blk_queue {
+	struct virtio_blk *blk;
+	struct blockif_ctxt *bc;
+	pthread_mutex_t mtx;
+	int index;
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+
+	struct vring_used_elem used[VIRTIO_BLK_RINGSZ];
+	int nr_used;
+	int inflight;
+	uint64_t used_stamp;
+	int timer_fd;
+	int timer_armed;
+	struct mevent *timer_evt;
+
+	uint64_t nr_ios;
+	uint64_t nr_irqs;
+	uint64_t nr_batches;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_device virtio_dev;
-	pthread_mutex_t mtx;
 	struct virtio_blk_config *cfg;
-	struct blockif_ctxt *bc;
+	int nr_queues;
+	int coalesce_count;
+	int coalesce_usecs;
+	struct virtio_blk_queue queues[VIRTIO_BLK_MAX_QUEUES];
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
 };
 
@@ -121,14 +156,104 @@ struct virtio_blk {
 
 #define DBG(...)
 
+static uint64_t virtio_blk_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void
-virtio_blk_done(struct blockif_req *br, int err)
+virtio_blk_set_timer(struct virtio_blk_queue *queue, uint64_t usecs)
+{
+	struct itimerspec its = {
+		.it_value.tv_sec = usecs / 1000000,
+		.it_value.tv_nsec = (usecs % 1000000) * 1000,
+	};
+
+	if (timerfd_settime(queue->timer_fd, 0, &its, NULL))
+		pr_warn("virtio_blk: set coalesce timer failed %d\n", errno);
+	queue->timer_armed = !!usecs;
+}
+
+/*
+ * put all the gathered completions to the used ring and
+ * signal the guest once, called with queue->mtx held
+ */
+static void
+virtio_blk_flush_used(struct virtio_blk_queue *queue)
 {
-	struct virtio_blk_ioreq *io = br->param;
-	struct virtio_blk *blk = io->blk;
 	struct virt_queue *vq;
 
-	vq = &blk->virtio_dev.vqs[0];
+	if (queue->nr_used == 0)
+		return;
+
+	vq = &queue->blk->virtio_dev.vqs[queue->index];
+	virtq_add_used_n(vq, queue->used, queue->nr_used);
+	queue->nr_used = 0;
+	queue->nr_batches++;
+
+	if (virtq_notify(vq))
+		queue->nr_irqs++;
+
+	if (queue->timer_armed)
+		virtio_blk_set_timer(queue, 0);
+}
+
+/*
+ * called at the end of a pass of completions. The completions
+ * are held back until coalesce_usecs passed since the first of
+ * them, unless there is no other request which can complete
+ * in the window.
+ */
+static void
+virtio_blk_complete_batch(void *arg)
+{
+	struct virtio_blk_queue *queue = arg;
+	uint64_t elapsed;
+	int usecs = queue->blk->coalesce_usecs;
+
+	pthread_mutex_lock(&queue->mtx);
+	if (queue->nr_used == 0)
+		goto out;
+
+	if (usecs && __atomic_load_n(&queue->inflight, __ATOMIC_RELAXED)) {
+		elapsed = virtio_blk_now_us() - queue->used_stamp;
+		if (elapsed < usecs) {
+			if (!queue->timer_armed)
+				virtio_blk_set_timer(queue, usecs - elapsed);
+			goto out;
+		}
+	}
+
+	virtio_blk_flush_used(queue);
+out:
+	pthread_mutex_unlock(&queue->mtx);
+}
+
+static void
+virtio_blk_timer_event(int fd, enum ev_type t, void *arg)
+{
+	struct virtio_blk_queue *queue = arg;
+	uint64_t expired;
+
+	if (read(fd, &expired, sizeof(expired)) != sizeof(expired))
+		return;
+
+	pthread_mutex_lock(&queue->mtx);
+	queue->timer_armed = 0;
+	virtio_blk_flush_used(queue);
+	pthread_mutex_unlock(&queue->mtx);
+}
+
+static void
+virtio_blk_done(struct blockif_req *br, int err)
+{
+	struct virtio_blk_ioreq *io = br->param;
+	struct virtio_blk_queue *queue = io->queue;
+	struct vring_used_elem *used;
 
 	/* convert errno into a virtio block error return */
 	if (err == EOPNOTSUPP || err == ENOSYS)
@@ -140,17 +265,30 @@ virtio_blk_done(struct blockif_req *br, int err)
 
 	/*
 	 * Return the descriptor back to the host.
-	 * We wrote 1 byte (our status) to host.
+	 * We wrote 1 byte (our status) to host. The used ring
+	 * is updated at the end of this batch of completions,
+	 * or when coalesce_count completions are gathered.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	virtq_add_used_and_signal(vq, io->idx, 1);
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&queue->mtx);
+	used = &queue->used[queue->nr_used++];
+	used->id = io->idx;
+	used->len = 1;
+	if (queue->nr_used == 1 && queue->blk->coalesce_usecs)
+		queue->used_stamp = virtio_blk_now_us();
+
+	queue->nr_ios++;
+	__atomic_sub_fetch(&queue->inflight, 1, __ATOMIC_RELAXED);
+
+	if (queue->nr_used >= queue->blk->coalesce_count)
+		virtio_blk_flush_used(queue);
+	pthread_mutex_unlock(&queue->mtx);
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk,
+virtio_blk_proc(struct virtio_blk_queue *queue,
 		struct virt_queue *vq, uint16_t idx, int n)
 {
+	struct virtio_blk *blk = queue->blk;
 	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
 	int i;
@@ -172,7 +310,7 @@ virtio_blk_proc(struct virtio_blk *blk,
 		return;
 	}
 
-	io = &blk->ios[idx];
+	io = &queue->ios[idx];
 	if (iov[0].iov_len != sizeof(struct virtio_blk_hdr)) {
 		pr_err("wrong size of virtio_blk_hdr %zu %zu\n",
 				iov[0].iov_len, sizeof(struct virtio_blk_hdr));
@@ -210,16 +348,18 @@ virtio_blk_proc(struct virtio_blk *blk,
 		 writeop ? "write" : "read/ident", iolen, i - 1,
 		 io->req.offset);
 
+	__atomic_add_fetch(&queue->inflight, 1, __ATOMIC_RELAXED);
+
 	switch (type) {
 	case VBH_OP_READ:
-		err = blockif_read(blk->bc, &io->req);
+		err = blockif_read(queue->bc, &io->req);
 		break;
 	case VBH_OP_WRITE:
-		err = blockif_write(blk->bc, &io->req);
+		err = blockif_write(queue->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		err = blockif_flush(queue->bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
@@ -242,15 +382,23 @@ virtio_blk_notify(struct virt_queue *vq)
 	int idx;
 	unsigned int in, out;
 	struct virtio_blk *blk;
+	struct virtio_blk_queue *queue;
 
 	blk = virtio_dev_to_blk(vq->dev);
+	queue = &blk->queues[vq->vq_index];
 	virtq_disable_notify(vq);
 
-	while (virtq_has_descs(vq)) {
+	/*
+	 * submit all the requests of this pass to the block
+	 * backend as one batch
+	 */
+	blockif_plug(queue->bc);
+
+	for (;;) {
 		idx = virtq_get_descs(vq, vq->iovec,
 				vq->iovec_size, &in, &out);
 		if (idx < 0)
-			return;
+			break;
 
 		if (idx == vq->num) {
 			if (virtq_enable_notify(vq)) {
@@ -262,19 +410,26 @@ virtio_blk_notify(struct virt_queue *vq)
 
 		if (in) {
 			pr_err("unexpected description from guest");
-			return;
+			break;
 		}
 
-		virtio_blk_proc(blk, vq, idx, out);
+		virtio_blk_proc(queue, vq, idx, out);
 	}
+
+	blockif_unplug(queue->bc);
+
+	/* the requests which completed in this context */
+	virtio_blk_complete_batch(queue);
 }
 
 static int vblk_init_vq(struct virt_queue *vq)
 {
-	if (vq->vq_index == 0)
+	struct virtio_blk *blk = virtio_dev_to_blk(vq->dev);
+
+	if (vq->vq_index < blk->nr_queues)
 		vq->callback = virtio_blk_notify;
 	else
-		pr_err("virtio block only have one vq");
+		pr_err("virtio block only have %d vqs\n", blk->nr_queues);
 
 	return 0;
 }
@@ -283,15 +438,152 @@ static struct virtio_ops vblk_ops = {
 	.vq_init = vblk_init_vq,
 };
 
+/*
+ * pick the virtio-blk options out of the option string, the
+ * others are passed to blockif. num_queues=N sets the number
+ * of the request queues, default is one queue for each vcpu.
+ * coalesce_count=N and coalesce_usecs=U bound how many
+ * completions and how long one interrupt may cover, default
+ * is one interrupt for each pass of completions.
+ */
+static char *
+virtio_blk_parse_opts(struct virtio_blk *blk, struct vm *vm, char *opts)
+{
+	char *nopt, *xopts, *cp, *bopts;
+	int nr_queues = vm->nr_vcpus;
+	int count = VIRTIO_BLK_RINGSZ, usecs = 0;
+
+	nopt = xopts = strdup(opts);
+	bopts = calloc(1, strlen(opts) + 1);
+	if (!nopt || !bopts) {
+		free(nopt);
+		free(bopts);
+		return NULL;
+	}
+
+	while ((cp = strsep(&xopts, ",")) != NULL) {
+		if (sscanf(cp, "num_queues=%d", &nr_queues) == 1)
+			continue;
+		if (sscanf(cp, "coalesce_count=%d", &count) == 1)
+			continue;
+		if (sscanf(cp, "coalesce_usecs=%d", &usecs) == 1)
+			continue;
+
+		if (bopts[0])
+			strcat(bopts, ",");
+		strcat(bopts, cp);
+	}
+	free(nopt);
+
+	if (nr_queues < 1)
+		nr_queues = 1;
+	if (nr_queues > VIRTIO_BLK_MAX_QUEUES)
+		nr_queues = VIRTIO_BLK_MAX_QUEUES;
+	blk->nr_queues = nr_queues;
+
+	if (count < 1 || count > VIRTIO_BLK_RINGSZ)
+		count = VIRTIO_BLK_RINGSZ;
+	blk->coalesce_count = count;
+	blk->coalesce_usecs = usecs > 0 ? usecs : 0;
+
+	return bopts;
+}
+
+static int
+virtio_blk_init_queue(struct virtio_blk *blk, int index,
+		struct blockif_ctxt *bctxt)
+{
+	struct virtio_blk_queue *queue = &blk->queues[index];
+	pthread_mutexattr_t attr;
+	char bident[16];
+	int i, rc;
+
+	/* the first queue uses the ctxt which opened the image */
+	if (index == 0) {
+		queue->bc = bctxt;
+	} else {
+		snprintf(bident, sizeof(bident), "%d:%d", 0, index);
+		queue->bc = blockif_clone(bctxt, bident);
+		if (!queue->bc)
+			return -ENOMEM;
+	}
+
+	queue->blk = blk;
+	queue->index = index;
+	queue->timer_fd = -1;
+	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
+		struct virtio_blk_ioreq *io = &queue->ios[i];
+
+		io->req.callback = virtio_blk_done;
+		io->req.param = io;
+		io->queue = queue;
+		io->idx = i;
+	}
+
+	/* init mutex attribute properly to avoid deadlock */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		pr_notice("mutexattr init failed with erro %d!\n", rc);
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		pr_notice("virtio_blk: mutexattr_settype failed with "
+					"error %d!\n", rc);
+
+	rc = pthread_mutex_init(&queue->mtx, &attr);
+	if (rc)
+		pr_notice("virtio_blk: pthread_mutex_init failed with "
+					"error %d!\n", rc);
+
+	blockif_set_batch_done(queue->bc, virtio_blk_complete_batch, queue);
+
+	/* the timer which flushes the completions held back */
+	if (blk->coalesce_usecs) {
+		queue->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				TFD_NONBLOCK | TFD_CLOEXEC);
+		if (queue->timer_fd < 0)
+			return -errno;
+
+		queue->timer_evt = mevent_add(queue->timer_fd, EVF_READ,
+				virtio_blk_timer_event, queue);
+		if (!queue->timer_evt) {
+			close(queue->timer_fd);
+			queue->timer_fd = -1;
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void
+virtio_blk_close_queues(struct virtio_blk *blk)
+{
+	int i;
+
+	/* close the clones first, the first ctxt owns the file lock */
+	for (i = blk->nr_queues - 1; i >= 0; i--) {
+		if (blk->queues[i].bc) {
+			blockif_close(blk->queues[i].bc);
+			blk->queues[i].bc = NULL;
+		}
+
+		if (blk->queues[i].timer_evt) {
+			mevent_delete_close(blk->queues[i].timer_evt);
+			blk->queues[i].timer_evt = NULL;
+			blk->queues[i].timer_fd = -1;
+		}
+	}
+}
+
 static int
 virtio_blk_init(struct vdev *vdev, char *opts)
 {
 	char bident[16];
+	char *bopts;
 	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk;
 	off_t size;
 	int i, sectsz, sts, sto;
-	pthread_mutexattr_t attr;
 	int rc;
 
 	if (opts == NULL || opts[0] == 0) {
@@ -301,13 +593,27 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 
 	pr_info("virtio block image path: %s\n", opts);
 
+	blk = calloc(1, sizeof(struct virtio_blk));
+	if (!blk) {
+		pr_warn("virtio_blk: calloc returns NULL\n");
+		return -1;
+	}
+
+	bopts = virtio_blk_parse_opts(blk, vdev->vm, opts);
+	if (!bopts) {
+		free(blk);
+		return -1;
+	}
+
 	/*
 	 * The supplied backing file has to exist
 	 */
 	snprintf(bident, sizeof(bident), "%d:%d", 0, 0);
-	bctxt = blockif_open(opts, bident);
+	bctxt = blockif_open(bopts, bident);
+	free(bopts);
 	if (bctxt == NULL) {
 		perror("Could not open backing file");
+		free(blk);
 		return -1;
 	}
 
@@ -315,52 +621,30 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 	sectsz = blockif_sectsz(bctxt);
 	blockif_psectsz(bctxt, &sts, &sto);
 
-	blk = calloc(1, sizeof(struct virtio_blk));
-	if (!blk) {
-		pr_warn("virtio_blk: calloc returns NULL\n");
-		return -1;
+	for (i = 0; i < blk->nr_queues; i++) {
+		rc = virtio_blk_init_queue(blk, i, bctxt);
+		if (rc) {
+			pr_err("failed to init virtio blk queue %d\n", i);
+			virtio_blk_close_queues(blk);
+			free(blk);
+			return rc;
+		}
 	}
 
-	/* virtio blk only has 1 virt queue */
 	rc = virtio_device_init(&blk->virtio_dev, vdev,
-			VIRTIO_TYPE_BLOCK, 1, VIRTIO_BLK_RINGSZ,
-			VIRTIO_BLK_IOVSZ);
+			VIRTIO_TYPE_BLOCK, blk->nr_queues,
+			VIRTIO_BLK_RINGSZ, VIRTIO_BLK_IOVSZ);
 	if (rc) {
 		pr_err("failed to init virtio blk device\n");
+		virtio_blk_close_queues(blk);
 		free(blk);
-		blockif_close(bctxt);
 		return rc;
 	}
 
-	blk->bc = bctxt;
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
-
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
-	}
-
 	vdev_set_pdata(vdev, blk);
 	blk->virtio_dev.ops = &vblk_ops;
 	blk->cfg = (struct virtio_blk_config *)blk->virtio_dev.config;
 
-
-	/* init mutex attribute properly to avoid deadlock */
-	rc = pthread_mutexattr_init(&attr);
-	if (rc)
-		pr_notice("mutexattr init failed with erro %d!\n", rc);
-	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	if (rc)
-		pr_notice("virtio_blk: mutexattr_settype failed with "
-					"error %d!\n", rc);
-
-	rc = pthread_mutex_init(&blk->mtx, &attr);
-	if (rc)
-		pr_notice("virtio_blk: pthread_mutex_init failed with "
-					"error %d!\n", rc);
-
 	sprintf(blk->ident, "Minos--%02X%02X-%02X%02X-%02X%02X",
 			0, 1, 2, 3, 4, 5);
 
@@ -378,7 +662,8 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 	    (sto != 0) ? ((sts - sto) / sectsz) : 0;
 	blk->cfg->topology.min_io_size = 0;
 	blk->cfg->topology.opt_io_size = 0;
-	blk->cfg->writeback = blockif_get_wce(blk->bc);
+	blk->cfg->writeback = blockif_get_wce(bctxt);
+	blk->cfg->num_queues = blk->nr_queues;
 	blk->original_wce = blk->cfg->writeback; /* save for reset */
 
 	/* set the feature of the virtio block */
@@ -387,34 +672,61 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 		virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_CONFIG_WCE);
 	}
 
+	/* the guest maps the request queues to its cpus */
+	if (blk->nr_queues > 1)
+		virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_MQ);
+
 	virtio_set_feature(&blk->virtio_dev, VIRTIO_F_VERSION_1);
 	virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_SEG_MAX);
 	virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_BLK_SIZE);
 	virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_TOPOLOGY);
 	virtio_set_feature(&blk->virtio_dev,
 			VIRTIO_RING_F_INDIRECT_DESC);
+	virtio_set_feature(&blk->virtio_dev, VIRTIO_RING_F_EVENT_IDX);
+	virtio_set_feature(&blk->virtio_dev, VIRTIO_F_RING_PACKED);
 	return 0;
 }
 
+static void
+virtio_blk_dump_stats(struct virtio_blk *blk)
+{
+	struct virtio_blk_queue *queue;
+	int i;
+
+	for (i = 0; i < blk->nr_queues; i++) {
+		queue = &blk->queues[i];
+		pr_info("virtio_blk: queue %d ios %llu batches %llu "
+			"irqs %llu irqs/io %.3f\n", i,
+			(unsigned long long)queue->nr_ios,
+			(unsigned long long)queue->nr_batches,
+			(unsigned long long)queue->nr_irqs,
+			queue->nr_ios ?
+			(double)queue->nr_irqs / queue->nr_ios : 0.0);
+	}
+}
+
 static void
 virtio_blk_deinit(struct vdev *vdev)
 {
-	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk;
+	int i;
 
 	blk = (struct virtio_blk *)vdev_get_pdata(vdev);
 	if (!blk)
 		return;
 
 	pr_notice("virtio_blk: deinit\n");
-	bctxt = blk->bc;
-	if (blockif_flush_all(bctxt)) {
-		pr_warn("vrito_blk:"
-			"Failed to flush before close\n");
-		blockif_close(bctxt);
-		virtio_device_deinit(&blk->virtio_dev);
-		free(blk);
+	for (i = 0; i < blk->nr_queues; i++) {
+		if (blockif_flush_all(blk->queues[i].bc))
+			pr_warn("vrito_blk:"
+				"Failed to flush queue %d before close\n", i);
 	}
+
+	virtio_blk_dump_stats(blk);
+
+	virtio_blk_close_queues(blk);
+	virtio_device_deinit(&blk->virtio_dev);
+	free(blk);
 }
 
 static int virtio_blk_event(struct vdev *vdev, int read,
@@ -436,6 +748,7 @@ static int virtio_blk_event(struct vdev *vdev, int read,
 static int virtio_blk_reset(struct vdev *vdev)
 {
 	struct virtio_blk *blk;
+	int i;
 
 	blk = (struct virtio_blk *)vdev_get_pdata(vdev);
 	if (!blk)
@@ -443,7 +756,16 @@ static int virtio_blk_reset(struct vdev *vdev)
 
 	pr_notice("virtio_blk: device reset requested !\n");
 	virtio_device_reset(&blk->virtio_dev);
-	blockif_set_wce(blk->bc, blk->original_wce);
+	for (i = 0; i < blk->nr_queues; i++) {
+		/* drop the completions of the old rings */
+		pthread_mutex_lock(&blk->queues[i].mtx);
+		blk->queues[i].nr_used = 0;
+		if (blk->queues[i].timer_armed)
+			virtio_blk_set_timer(&blk->queues[i], 0);
+		pthread_mutex_unlock(&blk->queues[i].mtx);
+
+		blockif_set_wce(blk->queues[i].bc, blk->original_wce);
+	}
 
 	return 0;
 }
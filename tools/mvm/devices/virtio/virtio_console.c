@@ -807,6 +807,8 @@ virtio_console_init(struct vdev *vdev, char *opts)
 	virtio_set_feature(&console->virtio_dev, VIRTIO_F_VERSION_1);
 	virtio_set_feature(&console->virtio_dev, VIRTIO_CONSOLE_F_MULTIPORT);
 	virtio_set_feature(&console->virtio_dev, VIRTIO_CONSOLE_F_EMERG_WRITE);
+	virtio_set_feature(&console->virtio_dev, VIRTIO_RING_F_EVENT_IDX);
+	virtio_set_feature(&console->virtio_dev, VIRTIO_F_RING_PACKED);
 
 	console->config = (struct virtio_console_config *)
 			console->virtio_dev.config;
@@ -38,17 +38,35 @@
 #include <unistd.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <linux/if_tun.h>
 
 #include <minos/vm.h>
 #include <minos/mevent.h>
 #include <minos/virtio.h>
 #include <minos/netmap_user.h>
+#include <minos/xdp_if.h>
 #include <minos/barrier.h>
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
 
+/*
+ * The rx path publishes the used buffers and interrupts the
+ * guest once for up to VIRTIO_NET_RX_BATCH frames
+ */
+#define VIRTIO_NET_RX_BATCH	64
+#define VIRTIO_NET_RX_USED	VIRTIO_NET_RINGSZ
+
+/*
+ * The largest frame from the backend, a ethernet frame with a
+ * vlan tag, or a GSO frame when the guest can receive TSO/UFO.
+ */
+#define VIRTIO_NET_MAX_FRAME	(ETHER_MAX_LEN + 4)
+#define VIRTIO_NET_MAX_GSO	(65535 + ETHER_HDR_LEN + 4)
+
 /*
  * Host capabilities.  Note that we only offer a few of these.
  */
@@ -70,6 +88,7 @@
 #define	VIRTIO_NET_F_CTRL_RX		(18) /* control channel RX mode support */
 #define	VIRTIO_NET_F_CTRL_VLAN		(19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUN	(21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ			(22) /* multiple queue pairs */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
@@ -84,16 +103,33 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions. Queue pair N uses the rx queue 2N and the
+ * tx queue 2N + 1, the control queue follows the last pair and
+ * only exists when there is more than one queue pair.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_QUEUE_PAIRS	8
+
+/*
+ * Control queue commands, only the number of the queue
+ * pairs can be set.
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK			0
+#define VIRTIO_NET_ERR			1
+
+#define VIRTIO_NET_CTRL_MQ		4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
 
 /*
  * Fixed network header size
@@ -108,38 +144,79 @@ struct virtio_net_rxhdr {
 	uint16_t	vrh_bufs;
 } __attribute__((packed));
 
+struct virtio_net;
+
+/*
+ * Per-queue-pair struct, each pair has its own tap queue and
+ * a rx thread and a tx thread, which can be pinned to a host
+ * cpu
+ */
+struct virtio_net_queue {
+	struct virtio_net *net;
+	int		index;
+	int		tapfd;
+	struct xdpif_ctxt *xdp;		/* AF_XDP socket of the queue */
+	int		cpu;		/* host cpu of the threads, -1 any */
+
+	int		rx_ready;
+	int		rx_refill;	/* waiting for the guest to refill */
+	int		rx_evfd;	/* wake up the rx thread */
+	pthread_t	rx_tid;
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+
+	/* used buffers of the rx batch not yet in the used ring */
+	struct vring_used_elem rx_used[VIRTIO_NET_RX_USED];
+	int		rx_nr_used;
+
+	uint64_t	rx_packets;
+	uint64_t	rx_syscalls;	/* polls and reads of the backend */
+	uint64_t	rx_irqs;
+	uint64_t	rx_drops;
+
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_device virtio_dev;
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
 
-	int		tapfd;
 	struct nm_desc	*nmd;
+	struct xdpif_port *xdp_port;
 
-	int		rx_ready;
+	/* the backend reads and writes the virtio net header */
+	int		be_vnet_hdr;
+	int		be_offload;	/* tap can send offload frames */
 
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the rx and tx threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config *config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	uint32_t	rx_maxlen;	/* the largest frame with header */
+
+	int		nr_queue_pairs;
+	volatile int	curr_queue_pairs;
+	struct virtio_net_queue queues[VIRTIO_NET_MAX_QUEUE_PAIRS];
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
-			     int iovcnt, int len);
+	void (*virtio_net_rx)(struct virtio_net_queue *queue);
+	void (*virtio_net_tx)(struct virtio_net_queue *queue,
+			struct iovec *iov, int iovcnt, int len);
+
+	/* read one frame, and send the queued tx frames if needed */
+	ssize_t (*virtio_net_recv)(struct virtio_net_queue *queue,
+			struct iovec *iov, int iovcnt);
+	void (*virtio_net_tx_flush)(struct virtio_net_queue *queue);
 };
 
 #define virtio_dev_to_net(dev) \
@@ -164,61 +241,111 @@ ether_aton(const char *a, struct ether_addr *e)
 	return e;
 }
 
+static inline struct virtio_net_queue *
+virtio_net_vq_to_queue(struct virtio_net *net, struct virt_queue *vq)
+{
+	return &net->queues[vq->vq_index / 2];
+}
+
+static inline struct virt_queue *
+virtio_net_rxq(struct virtio_net_queue *queue)
+{
+	return &queue->net->virtio_dev.vqs[queue->index * 2 + VIRTIO_NET_RXQ];
+}
+
+static inline struct virt_queue *
+virtio_net_txq(struct virtio_net_queue *queue)
+{
+	return &queue->net->virtio_dev.vqs[queue->index * 2 + VIRTIO_NET_TXQ];
+}
+
 /*
- * If the transmit thread is active then stall until it is done.
+ * If the transmit threads are active then stall until they are done.
  */
 static void
 virtio_net_txwait(struct virtio_net *net)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
-		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+	struct virtio_net_queue *queue;
+	int i;
+
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
+		pthread_mutex_lock(&queue->tx_mtx);
+		while (queue->tx_in_progress) {
+			pthread_mutex_unlock(&queue->tx_mtx);
+			usleep(10000);
+			pthread_mutex_lock(&queue->tx_mtx);
+		}
+		pthread_mutex_unlock(&queue->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
 }
 
 /*
- * If the receive thread is active then stall until it is done.
+ * If the receive threads are active then stall until they are done.
  */
 static void
 virtio_net_rxwait(struct virtio_net *net)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
-		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+	struct virtio_net_queue *queue;
+	int i;
+
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
+		pthread_mutex_lock(&queue->rx_mtx);
+		while (queue->rx_in_progress) {
+			pthread_mutex_unlock(&queue->rx_mtx);
+			usleep(10000);
+			pthread_mutex_lock(&queue->rx_mtx);
+		}
+		pthread_mutex_unlock(&queue->rx_mtx);
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+}
+
+static void
+virtio_net_rx_kick(struct virtio_net_queue *queue)
+{
+	uint64_t val = 1;
+	ssize_t ret;
+
+	ret = write(queue->rx_evfd, &val, sizeof(val));
+	(void)ret; /*avoid compiler warning*/
 }
 
 /*
- * Send signal to tx I/O thread and wait till it exits
+ * Send signal to the rx and tx threads and wait till they exit
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_queues_stop(struct virtio_net *net)
 {
+	struct virtio_net_queue *queue;
 	void *jval;
+	int i;
 
 	net->closing = 1;
 
-	pthread_cond_broadcast(&net->tx_cond);
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
 
-	pthread_join(net->tx_tid, &jval);
+		pthread_mutex_lock(&queue->tx_mtx);
+		pthread_cond_broadcast(&queue->tx_cond);
+		pthread_mutex_unlock(&queue->tx_mtx);
+		pthread_join(queue->tx_tid, &jval);
+
+		virtio_net_rx_kick(queue);
+		pthread_join(queue->rx_tid, &jval);
+	}
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
-static void virtio_net_tap_tx(struct virtio_net *net,
+static void virtio_net_tap_tx(struct virtio_net_queue *queue,
 		struct iovec *iov, int iovcnt, int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (queue->tapfd == -1)
 		return;
 
 	/*
@@ -231,12 +358,13 @@ static void virtio_net_tap_tx(struct virtio_net *net,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(queue->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
 /*
- *  Called when there is read activity on the tap file descriptor.
+ *  Called when there is read activity on the tap file descriptor
+ * or the AF_XDP socket.
  * Each buffer posted by the guest is assumed to be able to contain
  * an entire ethernet frame + rx header.
  *  MP note: the dummybuf is only used for discarding frames, so there
@@ -265,32 +393,157 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+static inline uint32_t
+iov_size(struct iovec *iov, int niov)
+{
+	uint32_t size = 0;
+	int i;
+
+	for (i = 0; i < niov; i++)
+		size += iov[i].iov_len;
+
+	return size;
+}
+
+/*
+ * Get the rx buffers for one frame from the guest. With mergeable
+ * rx buffers a frame can span several chains, gather the chains
+ * until there is room for a frame of rx_maxlen bytes, which is a
+ * 64K GSO frame when the guest takes TSO. Return the number of the
+ * buffers, their ids and sizes are in used[] and buflen[], 0 if the
+ * ring is empty, or -EAGAIN if the ring runs dry before there is
+ * room for the frame, then the rx waits for the guest to refill.
+ */
+static int
+virtio_net_get_rxbufs(struct virtio_net_queue *queue, struct virt_queue *vq,
+		struct vring_used_elem *used, uint32_t *buflen, int *niov)
+{
+	struct virtio_net *net = queue->net;
+	unsigned int in, out;
+	uint32_t total;
+	int idx, nbufs;
+
+again:
+	total = 0;
+	nbufs = 0;
+	*niov = 0;
+	do {
+		idx = virtq_get_descs(vq, vq->iovec + *niov,
+				vq->iovec_size - *niov, &in, &out);
+		if (idx < 0) {
+			virtq_discard_desc(vq, nbufs);
+			return idx;
+		}
+
+		/*
+		 * The ring runs dry before there is room for a frame
+		 * of rx_maxlen bytes, the frame may be truncated in
+		 * these buffers, give them back and wait for the
+		 * guest to refill the ring. The notify is enabled
+		 * before the buffers are given back, so a buffer
+		 * added after them is either seen here or kicks
+		 * the queue.
+		 */
+		if (idx == vq->num) {
+			if (!net->rx_merge || (total >= net->rx_maxlen) ||
+					(nbufs == 0))
+				break;
+
+			queue->rx_refill = 1;
+			mb();
+			virtq_enable_notify(vq);
+			if (virtq_has_descs(vq)) {
+				queue->rx_refill = 0;
+				virtq_disable_notify(vq);
+				virtq_discard_desc(vq, nbufs);
+				goto again;
+			}
+
+			virtq_discard_desc(vq, nbufs);
+			return -EAGAIN;
+		}
+
+		used[nbufs].id = idx;
+		used[nbufs].len = 0;
+		buflen[nbufs] = iov_size(vq->iovec + *niov, in);
+		total += buflen[nbufs];
+		*niov += in;
+		nbufs++;
+	} while (net->rx_merge && (total < net->rx_maxlen) &&
+			(*niov < vq->iovec_size) &&
+			(nbufs < VIRTIO_NET_MAXSEGS));
+
+	return nbufs;
+}
+
+/*
+ * Publish the used buffers of the frames received so far with
+ * one update of the used ring
+ */
+static inline void
+virtio_net_rx_publish(struct virtio_net_queue *queue, struct virt_queue *vq)
+{
+	if (queue->rx_nr_used == 0)
+		return;
+
+	virtq_add_used_n(vq, queue->rx_used, queue->rx_nr_used);
+	queue->rx_nr_used = 0;
+}
+
+static inline void
+virtio_net_rx_notify(struct virtio_net_queue *queue, struct virt_queue *vq)
+{
+	if (virtq_notify(vq))
+		queue->rx_irqs++;
+}
+
+static ssize_t
+virtio_net_tap_recv(struct virtio_net_queue *queue,
+		struct iovec *iov, int iovcnt)
+{
+	queue->rx_syscalls++;
+
+	return readv(queue->tapfd, iov, iovcnt);
+}
+
+/* Drop a frame of the backend */
+static inline void
+virtio_net_rx_drop(struct virtio_net_queue *queue)
+{
+	struct iovec iov = {
+		.iov_base = dummybuf,
+		.iov_len = sizeof(dummybuf),
+	};
+
+	if (queue->net->virtio_net_recv(queue, &iov, 1) > 0)
+		queue->rx_drops++;
+}
+
+/*
+ * The rx path of the tap and the AF_XDP backend, frames are read
+ * one by one with virtio_net_recv()
+ */
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_be_rx(struct virtio_net_queue *queue)
 {
+	struct virtio_net *net = queue->net;
+	struct vring_used_elem *used;
+	uint32_t buflen[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *vrx;
 	struct virt_queue *vq;
-	void *vrx;
-	int len;
-	uint16_t idx;
-	ssize_t ret;
-	unsigned int in, out;
 	struct iovec *iov, *riov;
+	int nbufs, niov, riovcnt, i, frames = 0;
+	ssize_t len;
 
 	/*
-	 * Should never be called without a valid tap fd
-	 */
-	assert(net->tapfd != -1);
-
-	/*
-	 * But, will be called when the rx ring hasn't yet
+	 * Will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!queue->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
+		virtio_net_rx_drop(queue);
 
 		return;
 	}
@@ -298,33 +551,42 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->virtio_dev.vqs[VIRTIO_NET_RXQ];
+	vq = virtio_net_rxq(queue);
 	if (!virtq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
+		virtio_net_rx_drop(queue);
 
-		virtq_notify(vq);
+		virtio_net_rx_notify(queue, vq);
 		return;
 	}
 
 	iov = vq->iovec;
 	virtq_disable_notify(vq);
 
-	do {
+	for (;;) {
 		/*
-		 * Get descriptor chain.
+		 * The frames are read into the buffers one by one,
+		 * but the used buffers are only published and the
+		 * guest interrupted once for a batch of frames.
 		 */
-		idx = virtq_get_descs(vq, vq->iovec,
-				VIRTIO_NET_MAXSEGS, &in, &out);
+		if ((frames == VIRTIO_NET_RX_BATCH) || (queue->rx_nr_used >
+				VIRTIO_NET_RX_USED - VIRTIO_NET_MAXSEGS)) {
+			virtio_net_rx_publish(queue, vq);
+			virtio_net_rx_notify(queue, vq);
+			frames = 0;
+		}
 
-		if (idx < 0)
-			return;
+		used = queue->rx_used + queue->rx_nr_used;
+		nbufs = virtio_net_get_rxbufs(queue, vq, used, buflen, &niov);
+		if (nbufs < 0)
+			break;
 
-		if (idx == vq->num) {
+		if (nbufs == 0) {
+			/* let the guest refill with what it got so far */
+			virtio_net_rx_publish(queue, vq);
 			if (virtq_enable_notify(vq)) {
 				virtq_disable_notify(vq);
 				continue;
@@ -333,46 +595,58 @@ virtio_net_tap_rx(struct virtio_net *net)
 		}
 
 		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
+		 * The tap device writes the virtio net header itself
+		 * when it has IFF_VNET_HDR, including the offload
+		 * fields of the GSO frame. Otherwise read the frame
+		 * after the header and fill a empty header.
 		 */
 		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, (int *)&in, net->rx_vhdrlen);
-
-		len = readv(net->tapfd, riov, in);
-
-		if (len < 0 && errno == EWOULDBLOCK) {
+		riovcnt = niov;
+		if (net->be_vnet_hdr)
+			riov = iov;
+		else
+			riov = rx_iov_trim(iov, &riovcnt, net->rx_vhdrlen);
+
+		len = net->virtio_net_recv(queue, riov, riovcnt);
+		if (len <= 0) {
 			/*
 			 * No more packets, but still some avail ring
 			 * entries.  Interrupt if needed/appropriate.
 			 */
-			virtq_discard_desc(vq, 1);
+			virtq_discard_desc(vq, nbufs);
 			virtq_enable_notify(vq);
-			virtq_notify(vq);
-			return;
+			break;
 		}
 
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
-		memset(vrx, 0, net->rx_vhdrlen);
-
-		if (net->rx_merge) {
-			struct virtio_net_rxhdr *vrxh;
+		if (!net->be_vnet_hdr) {
+			memset(vrx, 0, net->rx_vhdrlen);
+			len += net->rx_vhdrlen;
+		}
 
-			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
+		/* the frame fills the buffers in order */
+		for (i = 0; (i < nbufs) && (len > 0); i++) {
+			used[i].len = (len < buflen[i]) ? len : buflen[i];
+			len -= used[i].len;
 		}
 
+		if (i < nbufs)
+			virtq_discard_desc(vq, nbufs - i);
+
 		/*
-		 * Release this chain and handle more chains.
+		 * The number of buffers is only valid when merged rx
+		 * bufs were negotiated, which is 1 otherwise.
 		 */
-		virtq_add_used(vq, idx, len + net->rx_vhdrlen);
-	} while (virtq_has_descs(vq));
+		if (net->rx_vhdrlen == sizeof(struct virtio_net_rxhdr))
+			vrx->vrh_bufs = i;
+
+		queue->rx_nr_used += i;
+		queue->rx_packets++;
+		frames++;
+	}
 
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
-	virtq_notify(vq);
+	virtio_net_rx_publish(queue, vq);
+	virtio_net_rx_notify(queue, vq);
 }
 
 static inline int
@@ -462,10 +736,11 @@ virtio_net_netmap_readv(struct nm_desc *nmd, struct iovec *iov, int iovcnt)
  * Called to send a buffer chain out to the vale port
  */
 static void
-virtio_net_netmap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
-		    int len)
+virtio_net_netmap_tx(struct virtio_net_queue *queue, struct iovec *iov,
+		    int iovcnt, int len)
 {
 	static char pad[60]; /* all zero bytes */
+	struct virtio_net *net = queue->net;
 
 	if (net->nmd == NULL)
 		return;
@@ -484,8 +759,9 @@ virtio_net_netmap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 }
 
 static void
-virtio_net_netmap_rx(struct virtio_net *net)
+virtio_net_netmap_rx(struct virtio_net_queue *queue)
 {
+	struct virtio_net *net = queue->net;
 	struct virt_queue *vq;
 	void *vrx;
 	int len;
@@ -502,7 +778,7 @@ virtio_net_netmap_rx(struct virtio_net *net)
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!queue->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
@@ -513,7 +789,7 @@ virtio_net_netmap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->virtio_dev.vqs[VIRTIO_NET_RXQ];
+	vq = virtio_net_rxq(queue);
 	if (!virtq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
@@ -585,38 +861,148 @@ virtio_net_netmap_rx(struct virtio_net *net)
 	virtq_notify(vq);
 }
 
+/*
+ * Called to queue a buffer chain to the AF_XDP socket, the frames
+ * are sent when the tx thread has processed the tx ring
+ */
+static void
+virtio_net_xdp_tx(struct virtio_net_queue *queue, struct iovec *iov,
+		int iovcnt, int len)
+{
+	static char pad[60]; /* all zero bytes */
+
+	if (queue->xdp == NULL)
+		return;
+
+	/*
+	 * If the length is < 60, pad out to that and add the
+	 * extra zero'd segment to the iov. It is guaranteed that
+	 * there is always an extra iov available by the caller.
+	 */
+	if (len < 60) {
+		iov[iovcnt].iov_base = pad;
+		iov[iovcnt].iov_len = 60 - len;
+		iovcnt++;
+	}
+	(void) xdpif_send(queue->xdp, iov, iovcnt);
+}
+
 static void
-virtio_net_rx_callback(int fd, enum ev_type type, void *param)
+virtio_net_xdp_tx_flush(struct virtio_net_queue *queue)
+{
+	if (queue->xdp)
+		xdpif_flush(queue->xdp);
+}
+
+static ssize_t
+virtio_net_xdp_recv(struct virtio_net_queue *queue,
+		struct iovec *iov, int iovcnt)
 {
-	struct virtio_net *net = param;
+	return xdpif_recv(queue->xdp, iov, iovcnt);
+}
+
+static int
+virtio_net_queue_fd(struct virtio_net_queue *queue)
+{
+	struct virtio_net *net = queue->net;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	if (net->nmd)
+		return net->nmd->fd;
+	if (queue->xdp)
+		return xdpif_fd(queue->xdp);
+
+	return queue->tapfd;
+}
+
+/*
+ * Thread which receives the frames of a queue pair from the
+ * backend, it sleeps in poll() on the backend fd and the eventfd
+ * which wakes it up when the queue is attached or detached, or
+ * when the device is closing
+ */
+static void *
+virtio_net_rx_thread(void *param)
+{
+	struct virtio_net_queue *queue = param;
+	struct virtio_net *net = queue->net;
+	struct pollfd pfd[2];
+	uint64_t val;
+	ssize_t ret;
+	int nfds;
+
+	pfd[0].fd = queue->rx_evfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = virtio_net_queue_fd(queue);
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		/*
+		 * a detached tap queue always polls as error, and
+		 * the backend is not polled when the rx is waiting
+		 * for the guest to refill the ring
+		 */
+		nfds = ((queue->index < net->curr_queue_pairs) &&
+				!queue->rx_refill) ? 2 : 1;
+		pfd[0].revents = pfd[1].revents = 0;
+
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("vtnet rx thread poll failed %d\n", errno);
+			break;
+		}
+
+		if (net->closing)
+			break;
+
+		if (pfd[0].revents & POLLIN) {
+			ret = read(queue->rx_evfd, &val, sizeof(val));
+			(void)ret; /*avoid compiler warning*/
+		}
+
+		if (!(pfd[1].revents & POLLIN))
+			continue;
+
+		queue->rx_syscalls++;
+		pthread_mutex_lock(&queue->rx_mtx);
+		queue->rx_in_progress = 1;
+		net->virtio_net_rx(queue);
+		queue->rx_in_progress = 0;
+		pthread_mutex_unlock(&queue->rx_mtx);
+	}
+
+	pr_warn("vtnet rx thread closing...\n");
+	return NULL;
 }
 
 static void
 virtio_net_ping_rxq(struct virt_queue *vq)
 {
 	struct virtio_net *net = virtio_dev_to_net(vq->dev);
+	struct virtio_net_queue *queue = virtio_net_vq_to_queue(net, vq);
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	if (queue->rx_ready == 0) {
+		queue->rx_ready = 1;
+		virtq_disable_notify(vq);
+	}
+
+	/* the guest refilled the ring, poll the backend again */
+	if (queue->rx_refill) {
+		queue->rx_refill = 0;
+		virtio_net_rx_kick(queue);
 	}
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virt_queue *vq)
+virtio_net_proctx(struct virtio_net_queue *queue, struct virt_queue *vq)
 {
+	struct virtio_net *net = queue->net;
 	int i;
 	int plen, tlen;
-	uint16_t idx;
+	int idx;
 	unsigned int in, out;
 
 	/*
@@ -631,17 +1017,21 @@ virtio_net_proctx(struct virtio_net *net, struct virt_queue *vq)
 	if (idx == vq->num)
 		return;
 
-	plen = 0;
-	vq->iovec[0].iov_len -= net->rx_vhdrlen;
-	vq->iovec[0].iov_base += net->rx_vhdrlen;
+	/*
+	 * the tap device with IFF_VNET_HDR takes the header and
+	 * does the checksum and segmentation which the guest left
+	 */
+	if (!net->be_vnet_hdr) {
+		vq->iovec[0].iov_len -= net->rx_vhdrlen;
+		vq->iovec[0].iov_base += net->rx_vhdrlen;
+	}
 
-	tlen = vq->iovec[0].iov_len;
-	for (i = 1; i < out; i++) {
-		plen += vq->iovec[i].iov_len;
+	tlen = 0;
+	for (i = 0; i < out; i++)
 		tlen += vq->iovec[i].iov_len;
-	}
+	plen = net->be_vnet_hdr ? tlen - net->rx_vhdrlen : tlen;
 
-	net->virtio_net_tx(net, &vq->iovec[0], out, plen);
+	net->virtio_net_tx(queue, &vq->iovec[0], out, plen);
 
 	/* chain is processed, release it and set tlen */
 	virtq_add_used(vq, idx, tlen);
@@ -651,6 +1041,7 @@ static void
 virtio_net_ping_txq(struct virt_queue *vq)
 {
 	struct virtio_net *net = virtio_dev_to_net(vq->dev);
+	struct virtio_net_queue *queue = virtio_net_vq_to_queue(net, vq);
 
 	/*
 	 * Any ring entries to process?
@@ -659,35 +1050,38 @@ virtio_net_ping_txq(struct virt_queue *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&queue->tx_mtx);
+	virtq_disable_notify(vq);
+	if (queue->tx_in_progress == 0)
+		pthread_cond_signal(&queue->tx_cond);
+	pthread_mutex_unlock(&queue->tx_mtx);
 }
 
 /*
- * Thread which will handle processing of TX desc
+ * Thread which will handle processing of TX desc of a queue pair
  */
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_queue *queue = param;
+	struct virtio_net *net = queue->net;
 	struct virt_queue *vq;
 	int error;
 
-	vq = &net->virtio_dev.vqs[VIRTIO_NET_TXQ];
+	vq = virtio_net_txq(queue);
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
-	error = pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
-	assert(error == 0);
+	pthread_mutex_lock(&queue->tx_mtx);
+	if (!net->closing) {
+		error = pthread_cond_wait(&queue->tx_cond, &queue->tx_mtx);
+		assert(error == 0);
+	}
 	if (net->closing) {
 		pr_warn("vtnet tx thread closing...\n");
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&queue->tx_mtx);
 		return NULL;
 	}
 
@@ -700,19 +1094,20 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && virtq_has_descs(vq))
 				break;
 
-			net->tx_in_progress = 0;
-			error = pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			queue->tx_in_progress = 0;
+			error = pthread_cond_wait(&queue->tx_cond,
+					&queue->tx_mtx);
 			assert(error == 0);
 			if (net->closing) {
 				pr_warn("vtnet tx thread closing...\n");
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&queue->tx_mtx);
 				return NULL;
 			}
 		}
 
 		virtq_disable_notify(vq);
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		queue->tx_in_progress = 1;
+		pthread_mutex_unlock(&queue->tx_mtx);
 
 		do {
 			/*
@@ -720,27 +1115,124 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(queue, vq);
 		} while (virtq_has_descs(vq));
 
+		if (net->virtio_net_tx_flush)
+			net->virtio_net_tx_flush(queue);
+
 		/*
 		 * Generate an interrupt if needed.
 		 */
 		virtq_enable_notify(vq);
 		virtq_notify(vq);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&queue->tx_mtx);
 	}
 }
 
-#ifdef notyet
+/*
+ * Attach the tap queues or the AF_XDP sockets of the pairs in
+ * use and detach the others, so the backend only sends frames
+ * to the queues which the guest uses
+ */
 static int
-virtio_net_ping_ctlq(struct virt_queue *vq)
+virtio_net_set_queue_pairs(struct virtio_net *net, int pairs)
 {
-	pr_notice("vtnet: control qnotify!\n\r");
+	struct virtio_net_queue *queue;
+	struct ifreq ifr;
+	int i;
+
+	if ((pairs < 1) || (pairs > net->nr_queue_pairs))
+		return -EINVAL;
+
+	for (i = 1; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
+		if (queue->xdp)
+			xdpif_enable(queue->xdp, i < pairs);
+		if (queue->tapfd < 0)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = (i < pairs) ?
+			IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(queue->tapfd, TUNSETQUEUE, &ifr) < 0 &&
+				errno != EINVAL)
+			pr_warn("vtnet: set tap queue %d failed %d\n",
+					i, errno);
+	}
+
+	net->curr_queue_pairs = pairs;
+	for (i = 1; i < net->nr_queue_pairs; i++)
+		virtio_net_rx_kick(&net->queues[i]);
+
 	return 0;
 }
-#endif
+
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, uint8_t cmd,
+		struct iovec *iov, int niov)
+{
+	uint16_t pairs;
+
+	if ((cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) || (niov < 1) ||
+			(iov[0].iov_len < sizeof(pairs)))
+		return VIRTIO_NET_ERR;
+
+	pairs = *(uint16_t *)iov[0].iov_base;
+	if (virtio_net_set_queue_pairs(net, pairs))
+		return VIRTIO_NET_ERR;
+
+	pr_notice("vtnet: %d queue pairs in use\n", pairs);
+
+	return VIRTIO_NET_OK;
+}
+
+static void
+virtio_net_ping_ctlq(struct virt_queue *vq)
+{
+	struct virtio_net *net = virtio_dev_to_net(vq->dev);
+	struct virtio_net_ctrl_hdr *hdr;
+	struct iovec *iov = vq->iovec;
+	unsigned int in, out;
+	uint8_t *ack;
+	int idx;
+
+	virtq_disable_notify(vq);
+
+	for (;;) {
+		idx = virtq_get_descs(vq, iov, vq->iovec_size, &in, &out);
+		if (idx < 0)
+			break;
+
+		if (idx == vq->num) {
+			if (virtq_enable_notify(vq)) {
+				virtq_disable_notify(vq);
+				continue;
+			}
+			break;
+		}
+
+		/* header, command data, then the ack byte */
+		if ((out < 1) || (in < 1) ||
+				(iov[0].iov_len < sizeof(*hdr))) {
+			pr_err("vtnet: invalid control command\n");
+			virtq_add_used_and_signal(vq, idx, 0);
+			continue;
+		}
+
+		hdr = iov[0].iov_base;
+		ack = iov[out + in - 1].iov_base;
+
+		if (hdr->class == VIRTIO_NET_CTRL_MQ)
+			*ack = virtio_net_ctrl_mq(net, hdr->cmd,
+					&iov[1], out - 1);
+		else
+			*ack = VIRTIO_NET_ERR;
+
+		virtq_add_used_and_signal(vq, idx, 1);
+	}
+}
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -768,10 +1260,11 @@ virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, int *vnet_hdr, int *mq)
 {
 	int tunfd, rc;
 	struct ifreq ifr;
+	unsigned int features = 0;
 
 #define PATH_NET_TUN "/dev/net/tun"
 	tunfd = open(PATH_NET_TUN, O_RDWR);
@@ -780,13 +1273,40 @@ virtio_net_tap_open(char *devname)
 		return -1;
 	}
 
+	/*
+	 * pass the virtio net header through if the tap supports,
+	 * and open one queue of the tap for each queue pair
+	 */
+	if (!ioctl(tunfd, TUNGETFEATURES, &features)) {
+		*vnet_hdr = !!(features & IFF_VNET_HDR);
+		if (!(features & IFF_MULTI_QUEUE))
+			*mq = 0;
+	} else
+		*mq = 0;
+
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (*vnet_hdr)
+		ifr.ifr_flags |= IFF_VNET_HDR;
+	if (*mq)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
 
 	if (*devname)
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
 
 	rc = ioctl(tunfd, TUNSETIFF, (void *)&ifr);
+
+	/*
+	 * a tap which is created as single queue can not be
+	 * attached with IFF_MULTI_QUEUE, use it with one queue
+	 */
+	if ((rc < 0) && (errno == EINVAL) && *mq) {
+		pr_notice("tap device %s is single queue\n", devname);
+		*mq = 0;
+		ifr.ifr_flags &= ~IFF_MULTI_QUEUE;
+		rc = ioctl(tunfd, TUNSETIFF, (void *)&ifr);
+	}
+
 	if (rc < 0) {
 		pr_warn("open of tap device %s failed\n", devname);
 		close(tunfd);
@@ -798,36 +1318,65 @@ virtio_net_tap_open(char *devname)
 }
 
 static void
-virtio_net_tap_setup(struct virtio_net *net, char *devname)
+virtio_net_tap_setup(struct virtio_net *net, char *devname, int pairs)
 {
-	net->virtio_net_rx = virtio_net_tap_rx;
+	int hdrlen = sizeof(struct virtio_net_rxhdr);
+	int i, fd, mq, opt = 1;
+
+	net->virtio_net_rx = virtio_net_be_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
+	net->virtio_net_recv = virtio_net_tap_recv;
+
+	/*
+	 * open the tap device once for each queue pair, the first
+	 * open tells whether the tap can do multi queue, if not
+	 * the device falls back to one queue pair
+	 */
+	mq = (pairs > 1);
+	for (i = 0; i < pairs; i++) {
+		fd = virtio_net_tap_open(devname, &net->be_vnet_hdr, &mq);
+		if (fd == -1)
+			break;
+
+		/* set non-blocking, the rx thread polls the fd */
+		if (ioctl(fd, FIONBIO, &opt) < 0) {
+			pr_warn("tap device O_NONBLOCK failed\n");
+			close(fd);
+			break;
+		}
+
+		net->queues[i].tapfd = fd;
+		if (!mq) {
+			i++;
+			break;
+		}
+	}
 
-	net->tapfd = virtio_net_tap_open(devname);
-	if (net->tapfd == -1) {
+	if (i == 0) {
 		pr_warn("open of tap device %s failed\n", devname);
 		return;
 	}
-	pr_notice("open of tap device %s success!\n", devname);
+
+	net->nr_queue_pairs = i;
+	pr_notice("open of tap device %s success, %d queues\n", devname, i);
 
 	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
+	 * the header is the full one until the features are
+	 * negotiated, and check whether the tap can send the
+	 * offload frames, they are off until the guest acks.
+	 * Both are the settings of the whole tap device.
 	 */
-	int opt = 1;
-
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		pr_warn("tap device O_NONBLOCK failed\n");
-		close(net->tapfd);
-		net->tapfd = -1;
-	}
+	if (net->be_vnet_hdr) {
+		fd = net->queues[0].tapfd;
+		if (ioctl(fd, TUNSETVNETHDRSZ, &hdrlen) < 0) {
+			pr_warn("tap device set vnet header size failed\n");
+			net->be_vnet_hdr = 0;
+			return;
+		}
 
-	net->mevp = mevent_add(net->tapfd, EVF_READ,
-			       virtio_net_rx_callback, net);
-	if (net->mevp == NULL) {
-		pr_warn("Could not register event\n");
-		close(net->tapfd);
-		net->tapfd = -1;
+		net->be_offload = !ioctl(fd, TUNSETOFFLOAD,
+			TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN);
+		ioctl(fd, TUNSETOFFLOAD, 0);
 	}
 }
 
@@ -837,21 +1386,121 @@ virtio_net_netmap_setup(struct virtio_net *net, char *ifname)
 	net->virtio_net_rx = virtio_net_netmap_rx;
 	net->virtio_net_tx = virtio_net_netmap_tx;
 
+	/* the netmap port only has one queue pair */
+	net->nr_queue_pairs = 1;
+
 	net->nmd = nm_open(ifname, NULL, 0, 0);
-	if (net->nmd == NULL) {
+	if (net->nmd == NULL)
 		pr_warn("open of netmap device %s failed\n", ifname);
+}
+
+/*
+ * AF_XDP socket for each queue pair on the host interface, the
+ * frames are copied between the guest buffers and the UMEM. No
+ * virtio net header goes to the backend, so no offload.
+ */
+static void
+virtio_net_xdp_setup(struct virtio_net *net, char *ifname, int pairs,
+		int mode)
+{
+	struct xdpif_ctxt *xdp;
+	int i;
+
+	net->virtio_net_rx = virtio_net_be_rx;
+	net->virtio_net_tx = virtio_net_xdp_tx;
+	net->virtio_net_recv = virtio_net_xdp_recv;
+	net->virtio_net_tx_flush = virtio_net_xdp_tx_flush;
+
+	net->xdp_port = xdpif_port_open(ifname, mode);
+	if (net->xdp_port == NULL) {
+		pr_warn("open of xdp port %s failed\n", ifname);
+		return;
+	}
+
+	/* stop at the first queue which the interface does not have */
+	for (i = 0; i < pairs; i++) {
+		xdp = xdpif_open(net->xdp_port, i);
+		if (xdp == NULL)
+			break;
+		net->queues[i].xdp = xdp;
+	}
+
+	if (i == 0) {
+		pr_warn("open of xdp socket on %s failed\n", ifname);
+		xdpif_port_close(net->xdp_port);
+		net->xdp_port = NULL;
 		return;
 	}
 
-	net->mevp = mevent_add(net->nmd->fd, EVF_READ,
-			       virtio_net_rx_callback, net);
-	if (net->mevp == NULL) {
-		pr_warn("Could not register event\n");
+	net->nr_queue_pairs = i;
+	pr_notice("open of xdp port %s success, %d queues\n", ifname, i);
+}
+
+static void
+virtio_net_backend_close(struct virtio_net *net)
+{
+	int i;
+
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		if (net->queues[i].tapfd >= 0) {
+			close(net->queues[i].tapfd);
+			net->queues[i].tapfd = -1;
+		}
+		if (net->queues[i].xdp) {
+			xdpif_close(net->queues[i].xdp);
+			net->queues[i].xdp = NULL;
+		}
+	}
+
+	if (net->xdp_port) {
+		xdpif_port_close(net->xdp_port);
+		net->xdp_port = NULL;
+	}
+
+	if (net->nmd) {
 		nm_close(net->nmd);
 		net->nmd = NULL;
 	}
 }
 
+/*
+ * tell the tap device the header size and which offload
+ * frames the guest can receive
+ */
+static void virtio_net_tap_set_offload(struct virtio_net *net)
+{
+	uint64_t features = net->features;
+	unsigned int offload = 0;
+	int hdrlen = net->rx_vhdrlen;
+	int tapfd = net->queues[0].tapfd;
+
+	/* the first tap queue is always attached */
+	if ((tapfd < 0) || !net->be_vnet_hdr)
+		return;
+
+	if (ioctl(tapfd, TUNSETVNETHDRSZ, &hdrlen) < 0)
+		pr_warn("tap device set vnet header size failed\n");
+
+	if (net->be_offload &&
+			(features & (1UL << VIRTIO_NET_F_GUEST_CSUM))) {
+		offload |= TUN_F_CSUM;
+		if (features & (1UL << VIRTIO_NET_F_GUEST_TSO4))
+			offload |= TUN_F_TSO4;
+		if (features & (1UL << VIRTIO_NET_F_GUEST_TSO6))
+			offload |= TUN_F_TSO6;
+		if (features & (1UL << VIRTIO_NET_F_GUEST_ECN))
+			offload |= TUN_F_TSO_ECN;
+	}
+
+	if (ioctl(tapfd, TUNSETOFFLOAD, offload) < 0)
+		pr_warn("tap device set offload 0x%x failed\n", offload);
+
+	if (offload & (TUN_F_TSO4 | TUN_F_TSO6))
+		net->rx_maxlen = VIRTIO_NET_MAX_GSO + net->rx_vhdrlen;
+	else
+		net->rx_maxlen = VIRTIO_NET_MAX_FRAME + net->rx_vhdrlen;
+}
+
 static void virtio_net_neg_features(struct virtio_device *dev)
 {
 	struct virtio_net *net;
@@ -861,23 +1510,34 @@ static void virtio_net_neg_features(struct virtio_device *dev)
 
 	if (!(net->features & (1 << VIRTIO_NET_F_MRG_RXBUF))) {
 		net->rx_merge = 0;
-		/* non-merge rx header is 2 bytes shorter */
-		net->rx_vhdrlen -= 2;
+		/*
+		 * non-merge rx header is 2 bytes shorter, but
+		 * a version 1 device always has the full one
+		 */
+		if (!(net->features & (1UL << VIRTIO_F_VERSION_1)))
+			net->rx_vhdrlen -= 2;
 	}
+
+	virtio_net_tap_set_offload(net);
+
+	/* the guest enables more pairs by the control queue */
+	virtio_net_set_queue_pairs(net, 1);
 }
 
 static int vnet_init_vq(struct virt_queue *vq)
 {
-	if (vq->vq_index == VIRTIO_NET_RXQ)
-		vq->callback = virtio_net_ping_rxq;
-	else if (vq->vq_index == VIRTIO_NET_TXQ)
-		vq->callback = virtio_net_ping_txq;
-#ifdef notyet
-	else if (vq->vq_index == VIRTIO_NET_CTLQ)
+	struct virtio_net *net = virtio_dev_to_net(vq->dev);
+	int ctlq = net->nr_queue_pairs * 2;
+
+	/* rx0, tx0, rx1, tx1 ... and the control queue at last */
+	if ((net->nr_queue_pairs > 1) && (vq->vq_index == ctlq))
 		vq->callback = virtio_net_ping_ctlq;
-#endif
-	else
+	else if (vq->vq_index >= ctlq)
 		pr_err("unsupported vq index %d\n", vq->vq_index);
+	else if ((vq->vq_index % 2) == VIRTIO_NET_RXQ)
+		vq->callback = virtio_net_ping_rxq;
+	else
+		vq->callback = virtio_net_ping_txq;
 
 	return 0;
 }
@@ -887,15 +1547,54 @@ static struct virtio_ops vnet_ops = {
 	.neg_features = virtio_net_neg_features,
 };
 
+/*
+ * cpus=a:b:c, the host cpus which the threads of each queue
+ * pair run on, the list is reused if there are more pairs
+ */
+static int
+virtio_net_parse_cpus(char *str, int *cpus)
+{
+	char *cpu;
+	int nr = 0;
+
+	while ((cpu = strsep(&str, ":")) != NULL) {
+		if (nr == VIRTIO_NET_MAX_QUEUE_PAIRS)
+			break;
+		if (*cpu == 0)
+			continue;
+		cpus[nr++] = atoi(cpu);
+	}
+
+	return nr;
+}
+
+static void
+virtio_net_set_affinity(pthread_t tid, int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(tid, sizeof(set), &set))
+		pr_warn("vtnet: bind thread to cpu %d failed\n", cpu);
+}
+
 static int virtio_net_init(struct vdev *vdev, char *opts)
 {
 	char tname[MAXCOMLEN + 1];
 	struct virtio_net *net;
+	struct virtio_net_queue *queue;
+	uint8_t mac[ETHER_ADDR_LEN];
+	int cpus[VIRTIO_NET_MAX_QUEUE_PAIRS];
 	char *devname;
-	char *vtopts;
-	int mac_provided;
+	char *vtopts, *cp;
+	int mac_provided, nr_cpus = 0;
+	int pairs, nr_vqs, xdp_mode = XDPIF_MODE_AUTO;
 	pthread_mutexattr_t attr;
-	int rc;
+	int rc, i;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -903,12 +1602,87 @@ static int virtio_net_init(struct vdev *vdev, char *opts)
 		return -1;
 	}
 
+	/* one queue pair for each vcpu by default */
+	pairs = vdev->vm->nr_vcpus;
+
+	for (i = 0; i < VIRTIO_NET_MAX_QUEUE_PAIRS; i++) {
+		net->queues[i].net = net;
+		net->queues[i].index = i;
+		net->queues[i].tapfd = -1;
+		net->queues[i].rx_evfd = -1;
+		net->queues[i].cpu = -1;
+	}
+
+	/*
+	 * Attempt to open the tap device and read the MAC address
+	 * and the queue options if specified, the backend decides
+	 * how many queue pairs the device has
+	 */
+	mac_provided = 0;
+	net->nmd = NULL;
+	net->nr_queue_pairs = 1;
+	net->virtio_net_rx = virtio_net_be_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+	net->virtio_net_recv = virtio_net_tap_recv;
+	if ((opts != NULL) && (opts[0] != 0)) {
+		devname = vtopts = strdup(opts);
+		if (!devname) {
+			pr_warn("virtio_net: strdup returns NULL\n");
+			free(net);
+			return -ENOMEM;
+		}
+
+		(void) strsep(&vtopts, ",");
+
+		while ((cp = strsep(&vtopts, ",")) != NULL) {
+			if (!strncmp(cp, "mac=", 4)) {
+				if (virtio_net_parsemac(cp, mac)) {
+					free(devname);
+					free(net);
+					return -EINVAL;
+				}
+				mac_provided = 1;
+			} else if (!strncmp(cp, "queues=", 7)) {
+				pairs = atoi(cp + 7);
+			} else if (!strncmp(cp, "cpus=", 5)) {
+				nr_cpus = virtio_net_parse_cpus(cp + 5, cpus);
+			} else if (!strncmp(cp, "xdpmode=", 8)) {
+				xdp_mode = xdpif_parse_mode(cp + 8);
+				if (xdp_mode < 0) {
+					pr_warn("vtnet: invalid %s\n", cp);
+					xdp_mode = XDPIF_MODE_AUTO;
+				}
+			} else
+				pr_warn("vtnet: unknown option %s\n", cp);
+		}
+
+		if (pairs < 1)
+			pairs = 1;
+		if (pairs > VIRTIO_NET_MAX_QUEUE_PAIRS)
+			pairs = VIRTIO_NET_MAX_QUEUE_PAIRS;
+
+		if (strncmp(devname, "vale", 4) == 0)
+			virtio_net_netmap_setup(net, devname);
+		if (strncmp(devname, "tap", 3) == 0 ||
+		    strncmp(devname, "vmnet", 5) == 0)
+			virtio_net_tap_setup(net, devname, pairs);
+		if (strncmp(devname, "xdp:", 4) == 0)
+			virtio_net_xdp_setup(net, devname + 4, pairs,
+					xdp_mode);
+
+		free(devname);
+	}
+
+	/* rx and tx of each pair, and the control queue for mq */
+	nr_vqs = net->nr_queue_pairs * 2 + (net->nr_queue_pairs > 1);
 	rc = virtio_device_init(&net->virtio_dev, vdev,
-			VIRTIO_TYPE_NET, VIRTIO_NET_MAXQ - 1,
+			VIRTIO_TYPE_NET, nr_vqs,
 			VIRTIO_NET_RINGSZ, VIRTIO_NET_MAXSEGS);
 	if (rc) {
 		pr_err("failed to init virtio net device\n");
+		virtio_net_backend_close(net);
 		free(net);
+		return rc;
 	}
 
 	vdev_set_pdata(vdev, net);
@@ -936,48 +1710,41 @@ static int virtio_net_init(struct vdev *vdev, char *opts)
 	virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_STATUS);
 	virtio_set_feature(&net->virtio_dev, VIRTIO_F_NOTIFY_ON_EMPTY);
 	virtio_set_feature(&net->virtio_dev, VIRTIO_RING_F_INDIRECT_DESC);
+	virtio_set_feature(&net->virtio_dev, VIRTIO_RING_F_EVENT_IDX);
+	virtio_set_feature(&net->virtio_dev, VIRTIO_F_RING_PACKED);
+
+	if (net->nr_queue_pairs > 1) {
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_CTRL_VQ);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_MQ);
+	}
+	net->config->max_virtqueue_pairs = net->nr_queue_pairs;
 
 	/*
-	 * Attempt to open the tap device and read the MAC address
-	 * if specified
+	 * checksum and segmentation offload, the tap device does
+	 * the work which the guest left in the header. The guest
+	 * side ones need the tap can send such frames.
 	 */
-	mac_provided = 0;
-	net->tapfd = -1;
-	net->nmd = NULL;
-	if ((opts != NULL) && (opts[0] != 0)) {
-		int err;
-
-		devname = vtopts = strdup(opts);
-		if (!devname) {
-			pr_warn("virtio_net: strdup returns NULL\n");
-			goto error;
-		}
-
-		(void) strsep(&vtopts, ",");
-
-		if (vtopts != NULL) {
-			err = virtio_net_parsemac(vtopts, net->config->mac);
-			if (err != 0) {
-				free(devname);
-				goto error;
-			}
-			mac_provided = 1;
-		}
-
-		if (strncmp(devname, "vale", 4) == 0)
-			virtio_net_netmap_setup(net, devname);
-		if (strncmp(devname, "tap", 3) == 0 ||
-		    strncmp(devname, "vmnet", 5) == 0)
-			virtio_net_tap_setup(net, devname);
+	if (net->be_vnet_hdr) {
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_CSUM);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_HOST_TSO4);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_HOST_TSO6);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_HOST_ECN);
+	}
 
-		free(devname);
+	if (net->be_offload) {
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_GUEST_CSUM);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_GUEST_TSO4);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_GUEST_TSO6);
+		virtio_set_feature(&net->virtio_dev, VIRTIO_NET_F_GUEST_ECN);
 	}
 
 	/*
 	 * The default MAC address is the standard NetApp OUI of 00-a0-98,
 	 * followed by an MD5 of the PCI slot/func number and dev name
 	 */
-	if (!mac_provided) {
+	if (mac_provided) {
+		memcpy(net->config->mac, mac, ETHER_ADDR_LEN);
+	} else {
 		net->config->mac[0] = 0x00;
 		net->config->mac[1] = 0x11;
 		net->config->mac[2] = 0x22;
@@ -986,44 +1753,104 @@ static int virtio_net_init(struct vdev *vdev, char *opts)
 		net->config->mac[5] = 0x55;
 	}
 
-	/* Link is up if we managed to open tap device or vale port. */
-	net->config->status = (opts == NULL || net->tapfd >= 0 ||
-			      net->nmd != NULL);
+	/*
+	 * Link is up if we managed to open tap device, vale port
+	 * or xdp socket.
+	 */
+	net->config->status = (opts == NULL || net->queues[0].tapfd >= 0 ||
+			      net->nmd != NULL || net->queues[0].xdp != NULL);
 
 	net->resetting = 0;
 	net->closing = 0;
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
+	net->rx_maxlen = VIRTIO_NET_MAX_FRAME + net->rx_vhdrlen;
+
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
+		if (nr_cpus)
+			queue->cpu = cpus[i % nr_cpus];
+
+		queue->rx_in_progress = 0;
+		pthread_mutex_init(&queue->rx_mtx, NULL);
+		queue->tx_in_progress = 0;
+		pthread_mutex_init(&queue->tx_mtx, NULL);
+		pthread_cond_init(&queue->tx_cond, NULL);
+
+		queue->rx_evfd = eventfd(0, EFD_NONBLOCK);
+		if (queue->rx_evfd < 0) {
+			pr_err("vtnet: create eventfd failed\n");
+			goto error;
+		}
+	}
+
+	/* only the first pair is in use until the guest sets more */
+	virtio_net_set_queue_pairs(net, 1);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Spawn the rx and tx processing threads of each queue
+	 * pair, they run on the host cpu of the pair if set
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", 0x0, 0x1);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
+
+		pthread_create(&queue->rx_tid, NULL, virtio_net_rx_thread,
+			       (void *)queue);
+		snprintf(tname, sizeof(tname), "vtnet-%u:%u rx",
+				(uint8_t)vdev->id, (uint8_t)i);
+		pthread_setname_np(queue->rx_tid, tname);
+		virtio_net_set_affinity(queue->rx_tid, queue->cpu);
+
+		pthread_create(&queue->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)queue);
+		snprintf(tname, sizeof(tname), "vtnet-%u:%u tx",
+				(uint8_t)vdev->id, (uint8_t)i);
+		pthread_setname_np(queue->tx_tid, tname);
+		virtio_net_set_affinity(queue->tx_tid, queue->cpu);
+	}
 
 	return 0;
 
 error:
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		if (net->queues[i].rx_evfd >= 0)
+			close(net->queues[i].rx_evfd);
+	}
+	virtio_net_backend_close(net);
 	virtio_device_deinit(&net->virtio_dev);
 	free(net);
 
 	return -EFAULT;
 }
 
+static void
+virtio_net_dump_stats(struct virtio_net *net)
+{
+	struct virtio_net_queue *queue;
+	int i;
+
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		queue = &net->queues[i];
+		pr_info("vtnet: queue %d rx packets %llu syscalls %llu "
+			"irqs %llu drops %llu pkts/syscall %.2f "
+			"pkts/irq %.2f\n", i,
+			(unsigned long long)queue->rx_packets,
+			(unsigned long long)queue->rx_syscalls,
+			(unsigned long long)queue->rx_irqs,
+			(unsigned long long)queue->rx_drops,
+			queue->rx_syscalls ?
+			(double)queue->rx_packets / queue->rx_syscalls : 0.0,
+			queue->rx_irqs ?
+			(double)queue->rx_packets / queue->rx_irqs : 0.0);
+	}
+}
+
 static void
 virtio_net_deinit(struct vdev *vdev)
 {
 	struct virtio_net *net;
+	int i;
 
 	net = (struct virtio_net *)vdev_get_pdata(vdev);
 	if (!net) {
@@ -1031,16 +1858,15 @@ virtio_net_deinit(struct vdev *vdev)
 		return;
 	}
 
-	virtio_net_tx_stop(net);
+	virtio_net_queues_stop(net);
+	virtio_net_dump_stats(net);
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
-	} else
-		fprintf(stderr, "net->tapfd is -1!\n");
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		close(net->queues[i].rx_evfd);
+		net->queues[i].rx_evfd = -1;
+	}
 
-	if (net->mevp != NULL)
-		mevent_delete(net->mevp);
+	virtio_net_backend_close(net);
 
 	virtio_device_deinit(&net->virtio_dev);
 	free(net);
@@ -1064,6 +1890,7 @@ static int virtio_net_event(struct vdev *vdev, int read,
 static int virtio_net_reset(struct vdev *vdev)
 {
 	struct virtio_net *net;
+	int i;
 
 	net = (struct virtio_net *)vdev_get_pdata(vdev);
 	if (!net)
@@ -1080,9 +1907,15 @@ static int virtio_net_reset(struct vdev *vdev)
 	virtio_net_txwait(net);
 	virtio_net_rxwait(net);
 
-	net->rx_ready = 0;
+	for (i = 0; i < net->nr_queue_pairs; i++) {
+		net->queues[i].rx_ready = 0;
+		net->queues[i].rx_refill = 0;
+	}
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	net->features = 0;
+	virtio_net_tap_set_offload(net);
+	virtio_net_set_queue_pairs(net, 1);
 
 	virtio_device_reset(&net->virtio_dev);
 
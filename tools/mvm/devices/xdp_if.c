@@ -0,0 +1,677 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * AF_XDP backend, a XDP program on the host interface redirects
+ * the frames of each rx queue to the AF_XDP socket bound to that
+ * queue through a xsk map, frames of a queue without a socket go
+ * to the host stack. Each socket has its own UMEM, the first half
+ * of the UMEM frames are for rx and stay in the fill ring, the
+ * other half are for tx.
+ *
+ * The raw uapi headers and syscalls are used, so there is no
+ * libbpf or libxdp dependency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include <minos/xdp_if.h>
+
+#ifndef AF_XDP
+#define AF_XDP			44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP			283
+#endif
+
+#define XDPIF_FRAME_SIZE	2048
+#define XDPIF_NUM_FRAMES	2048	/* half for rx, half for tx */
+#define XDPIF_RING_SIZE		(XDPIF_NUM_FRAMES / 2)
+#define XDPIF_RX_BATCH		16	/* rx frames given back at once */
+#define XDPIF_MAP_SIZE		64	/* the queues of the interface */
+#define XDPIF_TX_KICKS		64
+
+struct xdpif_ring {
+	uint32_t	cached_prod;
+	uint32_t	cached_cons;
+	uint32_t	mask;
+	uint32_t	*producer;
+	uint32_t	*consumer;
+	uint32_t	*flags;
+	void		*ring;
+	void		*map;
+	size_t		map_len;
+};
+
+struct xdpif_port {
+	int		ifindex;
+	int		mode;
+	int		map_fd;
+	int		prog_fd;
+	int		link_fd;
+};
+
+struct xdpif_ctxt {
+	struct xdpif_port *port;
+	int		fd;
+	int		queue_id;
+	int		zc;		/* the driver uses the UMEM directly */
+
+	void		*umem;
+	size_t		umem_len;
+
+	struct xdpif_ring rx;
+	struct xdpif_ring tx;
+	struct xdpif_ring fill;
+	struct xdpif_ring comp;
+
+	int		rx_pending;	/* rx frames not given back yet */
+	int		tx_pending;	/* tx descs not published yet */
+
+	uint64_t	tx_free[XDPIF_NUM_FRAMES / 2];
+	int		nr_tx_free;
+
+	struct xdpif_stats stats;
+};
+
+static int
+xdpif_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * The XDP program, in C it is:
+ *
+ *   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ */
+static int
+xdpif_load_prog(int map_fd)
+{
+	struct bpf_insn insns[] = {
+		{
+			.code = BPF_LDX | BPF_MEM | BPF_W,
+			.dst_reg = BPF_REG_2,
+			.src_reg = BPF_REG_1,
+			.off = offsetof(struct xdp_md, rx_queue_index),
+		},
+		{
+			.code = BPF_LD | BPF_DW | BPF_IMM,
+			.dst_reg = BPF_REG_1,
+			.src_reg = BPF_PSEUDO_MAP_FD,
+			.imm = map_fd,
+		},
+		{ 0 },
+		{
+			.code = BPF_ALU64 | BPF_MOV | BPF_K,
+			.dst_reg = BPF_REG_3,
+			.imm = XDP_PASS,
+		},
+		{
+			.code = BPF_JMP | BPF_CALL,
+			.imm = BPF_FUNC_redirect_map,
+		},
+		{
+			.code = BPF_JMP | BPF_EXIT,
+		},
+	};
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+	attr.license = (uintptr_t)"Dual BSD/GPL";
+	strncpy(attr.prog_name, "mvm_xdp", sizeof(attr.prog_name) - 1);
+
+	return xdpif_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int
+xdpif_attach(struct xdpif_port *port, int mode)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = port->prog_fd;
+	attr.link_create.target_ifindex = port->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = (mode == XDPIF_MODE_SKB) ?
+		XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+
+	port->link_fd = xdpif_bpf(BPF_LINK_CREATE, &attr);
+	if (port->link_fd < 0)
+		return -errno;
+
+	port->mode = mode;
+	return 0;
+}
+
+int
+xdpif_parse_mode(const char *str)
+{
+	if (!strcmp(str, "auto"))
+		return XDPIF_MODE_AUTO;
+	if (!strcmp(str, "skb"))
+		return XDPIF_MODE_SKB;
+	if (!strcmp(str, "drv"))
+		return XDPIF_MODE_DRV;
+	if (!strcmp(str, "zc"))
+		return XDPIF_MODE_ZC;
+
+	return -EINVAL;
+}
+
+struct xdpif_port *
+xdpif_port_open(const char *ifname, int mode)
+{
+	struct xdpif_port *port;
+	union bpf_attr attr;
+	int err;
+
+	port = calloc(1, sizeof(*port));
+	if (!port)
+		return NULL;
+
+	port->map_fd = port->prog_fd = port->link_fd = -1;
+
+	port->ifindex = if_nametoindex(ifname);
+	if (port->ifindex == 0) {
+		fprintf(stderr, "xdpif: no interface %s\n", ifname);
+		goto error;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = XDPIF_MAP_SIZE;
+	strncpy(attr.map_name, "mvm_xsks", sizeof(attr.map_name) - 1);
+	port->map_fd = xdpif_bpf(BPF_MAP_CREATE, &attr);
+	if (port->map_fd < 0) {
+		fprintf(stderr, "xdpif: create xsk map failed %d\n", errno);
+		goto error;
+	}
+
+	port->prog_fd = xdpif_load_prog(port->map_fd);
+	if (port->prog_fd < 0) {
+		fprintf(stderr, "xdpif: load xdp program failed %d\n", errno);
+		goto error;
+	}
+
+	/* native XDP if the driver has it, otherwise the generic one */
+	if (mode == XDPIF_MODE_AUTO) {
+		err = xdpif_attach(port, XDPIF_MODE_DRV);
+		if (err)
+			err = xdpif_attach(port, XDPIF_MODE_SKB);
+	} else
+		err = xdpif_attach(port, mode);
+	if (err) {
+		fprintf(stderr, "xdpif: attach xdp to %s failed %d\n",
+				ifname, err);
+		goto error;
+	}
+
+	return port;
+
+error:
+	xdpif_port_close(port);
+	return NULL;
+}
+
+void
+xdpif_port_close(struct xdpif_port *port)
+{
+	/* closing the link detaches the program */
+	if (port->link_fd >= 0)
+		close(port->link_fd);
+	if (port->prog_fd >= 0)
+		close(port->prog_fd);
+	if (port->map_fd >= 0)
+		close(port->map_fd);
+	free(port);
+}
+
+static int
+xdpif_map_ring(struct xdpif_ctxt *xc, struct xdpif_ring *r,
+		struct xdp_ring_offset *off, off_t pgoff, size_t esize)
+{
+	char *map;
+
+	r->map_len = off->desc + XDPIF_RING_SIZE * esize;
+	map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, xc->fd, pgoff);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	r->map = map;
+	r->producer = (uint32_t *)(map + off->producer);
+	r->consumer = (uint32_t *)(map + off->consumer);
+	r->flags = (uint32_t *)(map + off->flags);
+	r->ring = map + off->desc;
+	r->mask = XDPIF_RING_SIZE - 1;
+	r->cached_prod = *r->producer;
+	r->cached_cons = *r->consumer;
+
+	return 0;
+}
+
+static void
+xdpif_unmap_ring(struct xdpif_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->map_len);
+	r->map = NULL;
+}
+
+/*
+ * Entries the kernel produced to a rx or completion ring, the
+ * producer is only read again when the cached ones are used up
+ */
+static inline uint32_t
+xdpif_cons_avail(struct xdpif_ring *r)
+{
+	uint32_t n = r->cached_prod - r->cached_cons;
+
+	if (n == 0) {
+		r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+		n = r->cached_prod - r->cached_cons;
+	}
+
+	return n;
+}
+
+static inline void
+xdpif_cons_release(struct xdpif_ring *r)
+{
+	__atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static inline void
+xdpif_prod_submit(struct xdpif_ring *r)
+{
+	__atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+static int
+xdpif_setup_rings(struct xdpif_ctxt *xc)
+{
+	struct xdp_mmap_offsets off;
+	struct xdp_umem_reg reg;
+	socklen_t optlen;
+	int size = XDPIF_RING_SIZE;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uintptr_t)xc->umem;
+	reg.len = xc->umem_len;
+	reg.chunk_size = XDPIF_FRAME_SIZE;
+	if (setsockopt(xc->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+		return -errno;
+
+	if (setsockopt(xc->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+				&size, sizeof(size)) ||
+	    setsockopt(xc->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+				&size, sizeof(size)) ||
+	    setsockopt(xc->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) ||
+	    setsockopt(xc->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)))
+		return -errno;
+
+	optlen = sizeof(off);
+	if (getsockopt(xc->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+		return -errno;
+
+	if (xdpif_map_ring(xc, &xc->rx, &off.rx, XDP_PGOFF_RX_RING,
+				sizeof(struct xdp_desc)) ||
+	    xdpif_map_ring(xc, &xc->tx, &off.tx, XDP_PGOFF_TX_RING,
+				sizeof(struct xdp_desc)) ||
+	    xdpif_map_ring(xc, &xc->fill, &off.fr,
+				XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+	    xdpif_map_ring(xc, &xc->comp, &off.cr,
+				XDP_UMEM_PGOFF_COMPLETION_RING,
+				sizeof(uint64_t)))
+		return -ENOMEM;
+
+	return 0;
+}
+
+struct xdpif_ctxt *
+xdpif_open(struct xdpif_port *port, int queue_id)
+{
+	struct sockaddr_xdp sxdp;
+	struct xdp_options opts;
+	struct xdpif_ctxt *xc;
+	socklen_t optlen;
+	int i, err;
+
+	if (queue_id >= XDPIF_MAP_SIZE)
+		return NULL;
+
+	xc = calloc(1, sizeof(*xc));
+	if (!xc)
+		return NULL;
+
+	xc->port = port;
+	xc->queue_id = queue_id;
+
+	xc->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xc->fd < 0) {
+		fprintf(stderr, "xdpif: create xdp socket failed %d\n", errno);
+		free(xc);
+		return NULL;
+	}
+
+	xc->umem_len = (size_t)XDPIF_NUM_FRAMES * XDPIF_FRAME_SIZE;
+	xc->umem = mmap(NULL, xc->umem_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (xc->umem == MAP_FAILED) {
+		xc->umem = NULL;
+		goto error;
+	}
+
+	err = xdpif_setup_rings(xc);
+	if (err) {
+		fprintf(stderr, "xdpif: setup rings failed %d\n", err);
+		goto error;
+	}
+
+	/* all the rx frames go to the fill ring */
+	for (i = 0; i < XDPIF_NUM_FRAMES / 2; i++)
+		((uint64_t *)xc->fill.ring)[xc->fill.cached_prod++ &
+			xc->fill.mask] = (uint64_t)i * XDPIF_FRAME_SIZE;
+	xdpif_prod_submit(&xc->fill);
+
+	for (i = XDPIF_NUM_FRAMES / 2; i < XDPIF_NUM_FRAMES; i++)
+		xc->tx_free[xc->nr_tx_free++] = (uint64_t)i * XDPIF_FRAME_SIZE;
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = port->ifindex;
+	sxdp.sxdp_queue_id = queue_id;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	if (port->mode == XDPIF_MODE_SKB)
+		sxdp.sxdp_flags |= XDP_COPY;
+	else if (port->mode == XDPIF_MODE_ZC)
+		sxdp.sxdp_flags |= XDP_ZEROCOPY;
+
+	if (bind(xc->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		fprintf(stderr, "xdpif: bind queue %d failed %d\n",
+				queue_id, errno);
+		goto error;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	optlen = sizeof(opts);
+	if (!getsockopt(xc->fd, SOL_XDP, XDP_OPTIONS, &opts, &optlen))
+		xc->zc = !!(opts.flags & XDP_OPTIONS_ZEROCOPY);
+
+	if (xdpif_enable(xc, 1))
+		goto error;
+
+	return xc;
+
+error:
+	xdpif_close(xc);
+	return NULL;
+}
+
+void
+xdpif_close(struct xdpif_ctxt *xc)
+{
+	xdpif_enable(xc, 0);
+
+	xdpif_unmap_ring(&xc->rx);
+	xdpif_unmap_ring(&xc->tx);
+	xdpif_unmap_ring(&xc->fill);
+	xdpif_unmap_ring(&xc->comp);
+	close(xc->fd);
+
+	if (xc->umem)
+		munmap(xc->umem, xc->umem_len);
+	free(xc);
+}
+
+int
+xdpif_fd(struct xdpif_ctxt *xc)
+{
+	return xc->fd;
+}
+
+struct xdpif_stats *
+xdpif_get_stats(struct xdpif_ctxt *xc)
+{
+	return &xc->stats;
+}
+
+/*
+ * Add the socket to the xsk map or remove it, the frames of a
+ * queue without socket go to the host stack
+ */
+int
+xdpif_enable(struct xdpif_ctxt *xc, int enable)
+{
+	uint32_t key = xc->queue_id, value = xc->fd;
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xc->port->map_fd;
+	attr.key = (uintptr_t)&key;
+
+	if (enable) {
+		attr.value = (uintptr_t)&value;
+		attr.flags = BPF_ANY;
+		if (xdpif_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+			fprintf(stderr, "xdpif: add queue %d failed %d\n",
+					xc->queue_id, errno);
+			return -errno;
+		}
+	} else if (xdpif_bpf(BPF_MAP_DELETE_ELEM, &attr) && errno != ENOENT)
+		return -errno;
+
+	return 0;
+}
+
+static void
+xdpif_rx_release(struct xdpif_ctxt *xc)
+{
+	if (xc->rx_pending == 0)
+		return;
+
+	xdpif_cons_release(&xc->rx);
+	xdpif_prod_submit(&xc->fill);
+	xc->rx_pending = 0;
+}
+
+/*
+ * Copy the next rx frame to the iov, return its length or 0 if
+ * there is no frame. The UMEM frames go back to the fill ring
+ * in batches of XDPIF_RX_BATCH, or when the rx ring is empty.
+ */
+ssize_t
+xdpif_recv(struct xdpif_ctxt *xc, struct iovec *iov, int iovcnt)
+{
+	struct xdp_desc *desc;
+	uint32_t len, copied = 0, n;
+	char *data;
+	int i;
+
+	if (xdpif_cons_avail(&xc->rx) == 0) {
+		xdpif_rx_release(xc);
+		return 0;
+	}
+
+	desc = (struct xdp_desc *)xc->rx.ring +
+		(xc->rx.cached_cons & xc->rx.mask);
+	data = (char *)xc->umem + desc->addr;
+	len = desc->len;
+
+	for (i = 0; (i < iovcnt) && (copied < len); i++) {
+		n = len - copied;
+		if (n > iov[i].iov_len)
+			n = iov[i].iov_len;
+		memcpy(iov[i].iov_base, data + copied, n);
+		copied += n;
+	}
+
+	if (copied < len)
+		xc->stats.rx_truncated++;
+	xc->stats.rx_frames++;
+
+	((uint64_t *)xc->fill.ring)[xc->fill.cached_prod++ & xc->fill.mask] =
+		desc->addr & ~((uint64_t)XDPIF_FRAME_SIZE - 1);
+	xc->rx.cached_cons++;
+
+	if (++xc->rx_pending == XDPIF_RX_BATCH)
+		xdpif_rx_release(xc);
+
+	return copied;
+}
+
+/* take the UMEM frames of the sent frames back */
+static void
+xdpif_tx_complete(struct xdpif_ctxt *xc)
+{
+	uint32_t n;
+
+	n = xdpif_cons_avail(&xc->comp);
+	if (n == 0)
+		return;
+
+	while (n--)
+		xc->tx_free[xc->nr_tx_free++] = ((uint64_t *)xc->comp.ring)
+			[xc->comp.cached_cons++ & xc->comp.mask];
+	xdpif_cons_release(&xc->comp);
+}
+
+/*
+ * Copy a frame to a free UMEM frame and queue it to the tx ring,
+ * it is sent at the next xdpif_flush()
+ */
+int
+xdpif_send(struct xdpif_ctxt *xc, struct iovec *iov, int iovcnt)
+{
+	struct xdp_desc *desc;
+	uint32_t len = 0;
+	uint64_t addr;
+	char *data;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len > XDPIF_MAX_FRAME) {
+		xc->stats.tx_dropped++;
+		return -EMSGSIZE;
+	}
+
+	if (xc->nr_tx_free == 0) {
+		xdpif_tx_complete(xc);
+		if (xc->nr_tx_free == 0) {
+			xdpif_flush(xc);
+			xdpif_tx_complete(xc);
+		}
+		if (xc->nr_tx_free == 0) {
+			xc->stats.tx_dropped++;
+			return -EAGAIN;
+		}
+	}
+
+	addr = xc->tx_free[--xc->nr_tx_free];
+	data = (char *)xc->umem + addr;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(data, iov[i].iov_base, iov[i].iov_len);
+		data += iov[i].iov_len;
+	}
+
+	desc = (struct xdp_desc *)xc->tx.ring +
+		(xc->tx.cached_prod++ & xc->tx.mask);
+	desc->addr = addr;
+	desc->len = len;
+	desc->options = 0;
+
+	xc->tx_pending++;
+	xc->stats.tx_frames++;
+
+	return 0;
+}
+
+/*
+ * Publish the queued tx frames and wake up the kernel to send
+ * them. In copy mode the kernel only sends from sendto(), a
+ * limited number of frames each time, so kick it until the tx
+ * ring is empty.
+ */
+void
+xdpif_flush(struct xdpif_ctxt *xc)
+{
+	int i;
+
+	if (xc->tx_pending) {
+		xdpif_prod_submit(&xc->tx);
+		xc->tx_pending = 0;
+	}
+
+	for (i = 0; i < XDPIF_TX_KICKS; i++) {
+		if (__atomic_load_n(xc->tx.consumer, __ATOMIC_ACQUIRE) ==
+				xc->tx.cached_prod)
+			break;
+		if (!(__atomic_load_n(xc->tx.flags, __ATOMIC_ACQUIRE) &
+					XDP_RING_NEED_WAKEUP))
+			break;
+
+		/* in zero copy mode the driver sends them async */
+		xc->stats.tx_kicks++;
+		if (sendto(xc->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) >= 0) {
+			if (xc->zc)
+				break;
+			continue;
+		}
+		if ((errno != EAGAIN) && (errno != EBUSY))
+			break;
+	}
+
+	xdpif_tx_complete(xc);
+}
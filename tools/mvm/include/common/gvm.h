@@ -40,8 +40,8 @@
 #define GICV3_GICH_IOMEM_SIZE		0x2000
 #define GICV3_GICV_IOMEM_BASE		0x10420000
 #define GICV3_GICV_IOMEM_SIZE		0x2000
-#define GICV3_ITS_IOMEM_BASE		0x10430000
-#define GICV3_ITS_IOMEM_SIZE		0x2000
+#define GICV3_ITS_IOMEM_BASE		0x10460000
+#define GICV3_ITS_IOMEM_SIZE		0x20000
 
 #define SP805_IRQ			32
 #define SP805_CLK_RATE			100000
@@ -1,7 +1,12 @@
 #ifndef __MVM_BARRIER_H__
 #define __MVM_BARRIER_H__
 
-#ifdef __CLANG__
+#if !defined(__aarch64__) && !defined(__arm__)
+/* the benchmarks in bench/ can also be built for the build host */
+#define isb()		asm volatile("" : : : "memory")
+#define dmb(opt)	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define dsb(opt)	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(__CLANG__)
 #include <arm_acle.h>
 #define isb()		__isb(0xf)
 #define dmb(opt)	__dmb(0xf)
@@ -8,6 +8,9 @@
 #define __align_cache_line	__align(__cache_line_size__)
 #define __packed		__attribute__((__packed__))
 
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+
 #define container_of(ptr, name, member) \
 	(name *)((unsigned char *)ptr - ((unsigned char *)&(((name *)0)->member)))
 
@@ -21,6 +21,12 @@ struct vdev_ops {
 #define VDEV_TYPE_PLATFORM	(0x0)
 #define VDEV_TYPE_VIRTIO	(0x1)
 
+/*
+ * the device serializes its events itself, mvm does not take
+ * vdev->lock around them
+ */
+#define VDEV_FLAGS_OWN_LOCK	(1 << 0)
+
 struct vdev {
 	int id;
 	struct vm *vm;
@@ -17,12 +17,22 @@
 #define VRING_AVAIL_F_NO_INTERRUPT	1
 #define VRING_USED_F_NO_NOTIFY		1
 
+/* packed virtqueue, the flags of the descriptor and event */
+#define VRING_PACKED_DESC_F_AVAIL	(1 << 7)
+#define VRING_PACKED_DESC_F_USED	(1 << 15)
+
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
 #define VIRTIO_RING_F_INDIRECT_DESC	28
 #define VIRTIO_RING_F_EVENT_IDX		29
 
 #define VIRTIO_F_NOTIFY_ON_EMPTY	24
 #define VIRTIO_F_ANY_LAYOUT		27
 #define VIRTIO_F_VERSION_1		32
+#define VIRTIO_F_RING_PACKED		34
 
 #define VRING_AVAIL_ALIGN_SIZE		2
 #define VRING_USED_ALIGN_SIZE		4
@@ -83,15 +93,50 @@ struct vring_desc {
 	uint16_t next;
 } __packed;
 
+struct vring_packed_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t id;
+	uint16_t flags;
+} __packed;
+
+struct vring_packed_desc_event {
+	uint16_t off_wrap;
+	uint16_t flags;
+} __packed;
+
 struct virtio_device;
 
+/*
+ * for packed virtqueue the descriptor area is the packed
+ * descriptor ring, the driver area and the device area are
+ * the event suppression structures of the driver and the
+ * device. last_avail_idx and last_used_idx are the indexes
+ * in the descriptor ring, and the wrap counters are kept
+ * aside.
+ */
 struct virt_queue {
 	int ready;
+	int packed;
 	unsigned int num;
 	unsigned int iovec_size;
-	struct vring_desc *desc;
-	struct vring_avail *avail;
-	struct vring_used *used;
+	union {
+		struct vring_desc *desc;
+		struct vring_packed_desc *desc_packed;
+	};
+	union {
+		struct vring_avail *avail;
+		struct vring_packed_desc_event *driver_event;
+	};
+	union {
+		struct vring_used *used;
+		struct vring_packed_desc_event *device_event;
+	};
+	uint16_t avail_wrap_counter;
+	uint16_t used_wrap_counter;
+	uint16_t avail_hist_idx;
+	uint16_t *desc_ndescs;
+	uint16_t *avail_hist;
 	uint16_t last_avail_idx;
 	uint16_t avail_idx;
 	uint16_t last_used_idx;
@@ -99,6 +144,16 @@ struct virt_queue {
 	uint16_t signalled_used;
 	uint16_t signalled_used_valid;
 	uint16_t vq_index;
+	uint32_t notify_seq;
+
+	/*
+	 * serializes the notify callback with the ring setup and
+	 * reset of this queue, the vcpus and the notify fast path
+	 * handle different queues in parallel
+	 */
+	pthread_mutex_t lock;
+	uint64_t nr_lock;
+	uint64_t nr_lock_contended;
 
 	struct virtio_device *dev;
 	struct iovec *iovec;
@@ -125,10 +180,32 @@ struct virtio_device {
 	uint64_t acked_features;
 	void *config;
 	struct virtio_ops *ops;
+	int notify_fd;
+	struct mevent *notify_evt;
+
+	/*
+	 * the interrupt status is in the iomem page, which is device
+	 * memory in vm0, so no atomic can be used on it, the queues
+	 * of the device update it under this lock
+	 */
+	pthread_mutex_t irq_lock;
 };
 
+static int inline virtq_packed_desc_is_avail(struct virt_queue *vq,
+		uint16_t flags)
+{
+	return (!!(flags & VRING_PACKED_DESC_F_AVAIL) ==
+			vq->avail_wrap_counter) &&
+		(!!(flags & VRING_PACKED_DESC_F_USED) !=
+			vq->avail_wrap_counter);
+}
+
 static int inline virtq_has_descs(struct virt_queue *vq)
 {
+	if (vq->packed)
+		return virtq_packed_desc_is_avail(vq,
+			vq->desc_packed[vq->last_avail_idx].flags);
+
 	return vq->avail->idx != vq->last_avail_idx;
 }
 
@@ -169,14 +246,16 @@ static int inline virtq_has_feature(struct virt_queue *vq, int fe)
 
 static inline void virtio_send_irq(struct virtio_device *dev, int type)
 {
-	uint32_t value = 0;
+	uint32_t value;
 
+	/* the queues of a device may send irq at the same time */
+	pthread_mutex_lock(&dev->irq_lock);
 	value = ioread32(dev->vdev->iomem + VIRTIO_MMIO_INTERRUPT_STATUS);
 	rmb();
-
 	value |= type;
 	iowrite32(dev->vdev->iomem + VIRTIO_MMIO_INTERRUPT_STATUS, value);
 	wmb();
+	pthread_mutex_unlock(&dev->irq_lock);
 
 	vdev_send_irq(dev->vdev);
 }
@@ -202,7 +281,7 @@ int virtq_add_used_n(struct virt_queue *vq,
 int virtq_add_used(struct virt_queue *vq,
 		unsigned int head, uint32_t len);
 
-void virtq_notify(struct virt_queue *vq);
+int virtq_notify(struct virt_queue *vq);
 
 void virtq_add_used_and_signal(struct virt_queue *vq,
 		unsigned int head, int len);
@@ -14,6 +14,7 @@
 #include <common/hypervisor.h>
 
 struct vm;
+struct vdev;
 
 /*
  * cpuid : vcpu_id of this vcpu in the vm
@@ -90,6 +91,7 @@ struct vm {
 	struct mvm_queue queue;
 
 	struct list_head vdev_list;
+	struct vdev *last_vdev;
 
 	struct list_head vmm_area_free;
 	struct list_head vmm_area_used;
@@ -108,6 +110,16 @@ static inline void send_virq_to_vm(int virq)
 	ioctl(mvm_vm->vm_fd, IOCTL_SEND_VIRQ, (long)virq);
 }
 
+/*
+ * send a MSI to the virtual ITS of the vm, the devid and the
+ * eventid are the ones the guest mapped with MAPD and MAPTI
+ */
+static inline int send_msi_to_vm(uint32_t devid, uint32_t eventid)
+{
+	return ioctl(mvm_vm->vm_fd, IOCTL_SEND_MSI,
+			((unsigned long)devid << 32) | eventid);
+}
+
 static inline int request_virq(unsigned long flags)
 {
 	return ioctl(mvm_vm->vm_fd, IOCTL_REQUEST_VIRQ, flags);
@@ -4,15 +4,29 @@
 #include <sys/types.h>
 #include <inttypes.h>
 
+/*
+ * the traps of a vcpu are posted to a ring by the hypervisor,
+ * host_index is the count of the posted traps and guest_index
+ * is the count of the handled traps.
+ */
+#define VMCS_NR_TRAPS	16
+
+struct vmcs_trap {
+	volatile uint32_t type;
+	volatile uint32_t reason;
+	volatile int32_t  ret;
+	volatile uint32_t padding;
+	volatile uint64_t data;
+	volatile uint64_t result;
+};
+
 struct vmcs {
 	volatile uint32_t vcpu_id;
-	volatile uint32_t trap_type;
-	volatile uint32_t trap_reason;
-	volatile int32_t  trap_ret;
-	volatile uint64_t trap_data;
-	volatile uint64_t trap_result;
+	volatile uint32_t nr_traps;
 	volatile uint64_t host_index;
 	volatile uint64_t guest_index;
+	volatile uint64_t padding;
+	struct vmcs_trap traps[VMCS_NR_TRAPS];
 	volatile uint64_t data[0];
 } __align(1024);
 
@@ -0,0 +1,79 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XDP_IF_H_
+#define _XDP_IF_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * AF_XDP network backend. A xdpif_port is the XDP program and the
+ * xsk map attached to a host interface, a xdpif_ctxt is one AF_XDP
+ * socket with its UMEM bound to one queue of the interface. Frames
+ * are copied between the caller's iovec and the UMEM frames.
+ */
+#define XDPIF_MODE_AUTO		0	/* native, or generic if not supported */
+#define XDPIF_MODE_SKB		1	/* generic XDP, copy mode */
+#define XDPIF_MODE_DRV		2	/* native XDP */
+#define XDPIF_MODE_ZC		3	/* native XDP, zero copy UMEM */
+
+/* the largest frame which fits a UMEM frame */
+#define XDPIF_MAX_FRAME		1792
+
+struct xdpif_stats {
+	uint64_t	rx_frames;
+	uint64_t	rx_truncated;
+	uint64_t	tx_frames;
+	uint64_t	tx_dropped;	/* no free UMEM frame or too big */
+	uint64_t	tx_kicks;	/* sendto() to start the transmit */
+};
+
+struct xdpif_port;
+struct xdpif_ctxt;
+
+struct xdpif_port *xdpif_port_open(const char *ifname, int mode);
+void	xdpif_port_close(struct xdpif_port *port);
+int	xdpif_parse_mode(const char *str);
+
+struct xdpif_ctxt *xdpif_open(struct xdpif_port *port, int queue_id);
+void	xdpif_close(struct xdpif_ctxt *xc);
+int	xdpif_fd(struct xdpif_ctxt *xc);
+int	xdpif_enable(struct xdpif_ctxt *xc, int enable);
+ssize_t	xdpif_recv(struct xdpif_ctxt *xc, struct iovec *iov, int iovcnt);
+int	xdpif_send(struct xdpif_ctxt *xc, struct iovec *iov, int iovcnt);
+void	xdpif_flush(struct xdpif_ctxt *xc);
+struct xdpif_stats *xdpif_get_stats(struct xdpif_ctxt *xc);
+
+#endif /* _XDP_IF_H_ */
@@ -392,37 +392,56 @@ static int create_and_init_vm(struct vm *vm)
 	return 0;
 }
 
-static void vmcs_ack(struct vmcs *vmcs)
+static inline int vdev_in_range(struct vdev *vdev, uint64_t addr)
 {
-	if (vmcs->guest_index == vmcs->host_index)
-		return;
+	return ((addr >= vdev->guest_iomem) &&
+		(addr < vdev->guest_iomem + vdev->iomem_size));
+}
+
+static struct vdev *vdev_find(struct vm *vm, uint64_t addr)
+{
+	struct vdev *vdev = vm->last_vdev;
+
+	/*
+	 * the mmio traps usually hit the same vdev in a row,
+	 * so check the last hit vdev first, the vdev list is
+	 * sorted by the guest iomem address
+	 */
+	if (vdev && vdev_in_range(vdev, addr))
+		return vdev;
+
+	list_for_each_entry(vdev, &vm->vdev_list, list) {
+		if (addr < vdev->guest_iomem)
+			break;
 
-	vmcs->guest_index++;
-	wmb();
+		if (vdev_in_range(vdev, addr)) {
+			vm->last_vdev = vdev;
+			return vdev;
+		}
+	}
+
+	return NULL;
 }
 
 static int vcpu_handle_mmio(struct vm *vm, int trap_reason,
 		uint64_t trap_data, uint64_t *trap_result)
 {
-	int ret = -EIO;
+	int ret;
 	struct vdev *vdev;
-	size_t size;
-	uint64_t base;
 
-	list_for_each_entry(vdev, &vm->vdev_list, list) {
-		base = vdev->guest_iomem;
-		size = vdev->iomem_size;
-		if ((trap_data >= base) && (trap_data < base + size)) {
-			pthread_mutex_lock(&vdev->lock);
-			ret = vdev->ops->event(vdev, trap_reason,
-					trap_data, trap_result);
-			pthread_mutex_unlock(&vdev->lock);
+	vdev = vdev_find(vm, trap_data);
+	if (!vdev)
+		return -ENODEV;
 
-			return ret;
-		}
-	}
+	if (vdev->flags & VDEV_FLAGS_OWN_LOCK)
+		return vdev->ops->event(vdev, trap_reason,
+				trap_data, trap_result);
 
-	return -ENODEV;
+	pthread_mutex_lock(&vdev->lock);
+	ret = vdev->ops->event(vdev, trap_reason, trap_data, trap_result);
+	pthread_mutex_unlock(&vdev->lock);
+
+	return ret;
 }
 
 static int vcpu_handle_common_trap(struct vm *vm, int trap_reason,
@@ -452,13 +471,13 @@ static int vcpu_handle_common_trap(struct vm *vm, int trap_reason,
 	return 0;
 }
 
-static void handle_vcpu_event(struct vmcs *vmcs)
+static void handle_vcpu_trap(struct vmcs_trap *trap)
 {
 	int ret = 0;
-	uint32_t trap_type = vmcs->trap_type;
-	uint32_t trap_reason = vmcs->trap_reason;
-	uint64_t trap_data = vmcs->trap_data;
-	uint64_t trap_result = vmcs->trap_result;
+	uint32_t trap_type = trap->type;
+	uint32_t trap_reason = trap->reason;
+	uint64_t trap_data = trap->data;
+	uint64_t trap_result = trap->result;
 
 	switch (trap_type) {
 	case VMTRAP_TYPE_COMMON:
@@ -474,10 +493,28 @@ static void handle_vcpu_event(struct vmcs *vmcs)
 		break;
 	}
 
-	vmcs->trap_ret = ret;
-	vmcs->trap_result = trap_result;
+	trap->ret = ret;
+	trap->result = trap_result;
+}
 
-	vmcs_ack(vmcs);
+/*
+ * the hypervisor only sends the irq when the trap ring is
+ * empty, so handle all the pending traps for each wakeup,
+ * the mb() after the guest_index is updated pairs with the
+ * mb() in __vcpu_trap, so a trap which is posted without
+ * irq will always be seen here.
+ */
+static void handle_vcpu_event(struct vmcs *vmcs)
+{
+	uint64_t index;
+
+	while ((index = vmcs->guest_index) != vmcs->host_index) {
+		rmb();
+		handle_vcpu_trap(&vmcs->traps[index & (VMCS_NR_TRAPS - 1)]);
+		wmb();
+		vmcs->guest_index = index + 1;
+		mb();
+	}
 }
 
 void *vm_vcpu_thread(void *data)
@@ -524,8 +561,6 @@ void *vm_vcpu_thread(void *data)
 		}
 
 		eventfd_read(eventfd, &value);
-		if (value > 1)
-			pr_err("invaild vmcs state\n");
 
 		handle_vcpu_event(vmcs);
 	}
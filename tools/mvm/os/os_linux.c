@@ -136,7 +136,7 @@ static int fdt_set_gicv3(void *dtb, int node)
 	fdt_setprop(dtb, node, "interrupts", (void *)regs, 12);
 
 	/* add the its node */
-	its_node = fdt_add_subnode(dtb, node, "its@0x10330000");
+	its_node = fdt_add_subnode(dtb, node, "its@0x10460000");
 	if (its_node < 0) {
 		pr_err("add its node for gicv3 failed\n");
 		return its_node;
@@ -150,7 +150,7 @@ static int fdt_set_gicv3(void *dtb, int node)
 	regs[1] = cpu_to_fdt32(GICV3_ITS_IOMEM_BASE);
 	regs[2] = cpu_to_fdt32(0x0);
 	regs[3] = cpu_to_fdt32(GICV3_ITS_IOMEM_SIZE);
-	fdt_setprop(dtb, its_node, "reg", (void *)regs, 12);
+	fdt_setprop(dtb, its_node, "reg", (void *)regs, 16);
 
 	return 0;
 }
@@ -70,6 +70,12 @@ static int vm_hvc_handler(gp_regs *c, uint32_t id, uint64_t *args)
 		HVC_RET1(c, 0);
 		break;
 
+	case HVC_VM_SEND_MSI:
+		/* the devid is in the high 32 bits, the eventid is in the low */
+		ret = send_msi_to_vm(vm, args[1] >> 32, (uint32_t)args[1]);
+		HVC_RET1(c, ret);
+		break;
+
 	case HVC_VM_CREATE_VMCS:
 		addr = vm_create_vmcs(vm);
 		HVC_RET1(c, addr);
@@ -46,6 +46,24 @@ static void vdev_deinit(struct vdev *vdev)
 	free(vdev);
 }
 
+/*
+ * keep the vdev list sorted by the guest address, then
+ * the lookup can stop at the first vdev above the address
+ */
+static void vdev_list_add(struct vm *vm, struct vdev *vdev)
+{
+	struct vdev *tmp;
+
+	list_for_each_entry(tmp, &vm->vdev_list, list) {
+		if (vdev->gvm_paddr < tmp->gvm_paddr) {
+			list_insert_before(&tmp->list, &vdev->list);
+			return;
+		}
+	}
+
+	list_add_tail(&vm->vdev_list, &vdev->list);
+}
+
 int host_vdev_init(struct vm *vm, struct vdev *vdev,
 		unsigned long base, uint32_t size)
 {
@@ -61,7 +79,7 @@ int host_vdev_init(struct vm *vm, struct vdev *vdev,
 	vdev->host = 1;
 	vdev->list.next = NULL;
 	vdev->deinit = vdev_deinit;
-	list_add_tail(&vm->vdev_list, &vdev->list);
+	vdev_list_add(vm, vdev);
 
 	return 0;
 }
@@ -81,20 +99,48 @@ struct vdev *create_host_vdev(struct vm *vm, unsigned long base, uint32_t size)
 	return vdev;
 }
 
+static inline int vdev_in_range(struct vdev *vdev, unsigned long address)
+{
+	return ((address >= vdev->gvm_paddr) &&
+		(address < vdev->gvm_paddr + vdev->mem_size));
+}
+
+struct vdev *vdev_find(struct vm *vm, unsigned long address)
+{
+	struct vdev *vdev = vm->last_vdev;
+
+	/*
+	 * the mmio traps of a vm usually hit the same vdev
+	 * in a row, check the last hit vdev first
+	 */
+	if (vdev && vdev_in_range(vdev, address))
+		return vdev;
+
+	list_for_each_entry(vdev, &vm->vdev_list, list) {
+		if (address < vdev->gvm_paddr)
+			break;
+
+		if (vdev_in_range(vdev, address)) {
+			vm->last_vdev = vdev;
+			return vdev;
+		}
+	}
+
+	return NULL;
+}
+
 int vdev_mmio_emulation(gp_regs *regs, int write,
 		unsigned long address, unsigned long *value)
 {
 	struct vm *vm = get_current_vm();
 	struct vdev *vdev;
 
-	list_for_each_entry(vdev, &vm->vdev_list, list) {
-		if ((address >= vdev->gvm_paddr) &&
-			(address < vdev->gvm_paddr + vdev->mem_size)) {
-			if (write)
-				return vdev->write(vdev, regs, address, value);
-			else
-				return vdev->read(vdev, regs, address, value);
-		}
+	vdev = vdev_find(vm, address);
+	if (vdev) {
+		if (write)
+			return vdev->write(vdev, regs, address, value);
+		else
+			return vdev->read(vdev, regs, address, value);
 	}
 
 	/*
@@ -43,6 +43,12 @@ get_virq_desc(struct vcpu *vcpu, uint32_t virq)
 	if (virq < VM_LOCAL_VIRQ_NR)
 		return &vcpu->virq_struct->local_desc[virq];
 
+	if (virq >= VM_LPI_VIRQ_BASE) {
+		if (VIRQ_LPI_OFFSET(virq) >= vm->vlpi_nr)
+			return NULL;
+		return &vm->vlpi_desc[VIRQ_LPI_OFFSET(virq)];
+	}
+
 	if (virq >= VM_VIRQ_NR(vm->vspi_nr))
 		return NULL;
 
@@ -86,6 +92,7 @@ static int inline __send_virq(struct vcpu *vcpu, struct virq_desc *desc)
 	}
 
 	virq_set_pending(desc);
+	virq_stat_send(desc);
 	dsb();
 
 	/*
@@ -93,7 +100,7 @@ static int inline __send_virq(struct vcpu *vcpu, struct virq_desc *desc)
 	 * actvie or pending list do not change it
 	 */
 	if (desc->list.next == NULL) {
-		list_add_tail(&virq_struct->pending_list, &desc->list);
+		virq_add_pending(virq_struct, desc);
 		virq_struct->active_count++;
 	}
 
@@ -104,6 +111,30 @@ static int inline __send_virq(struct vcpu *vcpu, struct virq_desc *desc)
 	return 0;
 }
 
+#ifdef CONFIG_VIRQ_DELIVERY_STAT
+void virq_stat_send(struct virq_desc *d)
+{
+	d->send_ns = NOW();
+}
+
+/* called with the virq_struct->lock held */
+void virq_stat_deliver(struct virq_struct *vs, struct virq_desc *d)
+{
+	struct virq_delivery_stat *stat = &vs->stat;
+	unsigned long ns = NOW() - d->send_ns;
+	int bucket = ns ? fls_long(ns) - 1 : 0;
+
+	if (bucket >= VIRQ_STAT_NR_BUCKETS)
+		bucket = VIRQ_STAT_NR_BUCKETS - 1;
+
+	stat->count++;
+	stat->total_ns += ns;
+	stat->hist[bucket]++;
+	if (ns > stat->max_ns)
+		stat->max_ns = ns;
+}
+#endif
+
 static int send_virq(struct vcpu *vcpu, struct virq_desc *desc)
 {
 	int ret;
@@ -350,6 +381,25 @@ int send_virq_to_vm(struct vm *vm, uint32_t virq)
 	return send_virq(vcpu, desc);
 }
 
+/*
+ * send a message based interrupt to the vm, the devid and
+ * eventid are translated to a virq by the virq chip of the
+ * vm, for example the virtual ITS of the vgicv3
+ */
+int send_msi_to_vm(struct vm *vm, uint32_t devid, uint32_t eventid)
+{
+	struct virq_chip *vc;
+
+	if (!vm)
+		return -EINVAL;
+
+	vc = vm->virq_chip;
+	if (!vc || !vc->send_msi)
+		return -ENOENT;
+
+	return vc->send_msi(vc->inc_pdata, devid, eventid);
+}
+
 void send_vsgi(struct vcpu *sender, uint32_t sgi, cpumask_t *cpumask)
 {
 	int cpu;
@@ -380,7 +430,7 @@ void clear_pending_virq(struct vcpu *vcpu, uint32_t irq)
 	 *
 	 * check wether the virq is pending agagin, if yes
 	 * do not delete it from the pending list, instead
-	 * of add it to the tail of the pending list
+	 * of add it to the tail of its priority bucket
 	 *
 	 */
 	spin_lock_irqsave(&virq_struct->lock, flags);
@@ -390,7 +440,7 @@ void clear_pending_virq(struct vcpu *vcpu, uint32_t irq)
 	}
 
 	if (virq_is_pending(desc)) {
-		list_add_tail(&virq_struct->pending_list, &desc->list);
+		virq_add_pending(virq_struct, desc);
 		desc->state = VIRQ_STATE_PENDING;
 		goto out;
 	}
@@ -408,15 +458,17 @@ uint32_t get_pending_virq(struct vcpu *vcpu)
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 
 	spin_lock_irqsave(&virq_struct->lock, flags);
-	if (is_list_empty(&virq_struct->pending_list)) {
+	desc = virq_first_pending(virq_struct);
+	if (!desc) {
 		spin_unlock_irqrestore(&virq_struct->lock, flags);
 		return BAD_IRQ;
 	}
 
-	/* get the pending virq and delete it from pending list */
-	desc = list_first_entry(&virq_struct->pending_list,
-			struct virq_desc, list);
-	list_del(&desc->list);
+	/*
+	 * get the pending virq which has the highest priority
+	 * and move it from pending bucket to the active list
+	 */
+	virq_del_pending(virq_struct, desc);
 	list_add_tail(&virq_struct->active_list, &desc->list);
 	desc->state = VIRQ_STATE_ACTIVE;
 	virq_clear_pending(desc);
@@ -429,12 +481,8 @@ uint32_t get_pending_virq(struct vcpu *vcpu)
 int vcpu_has_irq(struct vcpu *vcpu)
 {
 	struct virq_struct *vs = vcpu->virq_struct;
-	int pend, active;
-
-	pend = is_list_empty(&vs->pending_list);
-	active = is_list_empty(&vs->active_list);
 
-	return !(pend && active);
+	return virq_has_pending(vs) || !is_list_empty(&vs->active_list);
 }
 
 void vcpu_virq_struct_reset(struct vcpu *vcpu)
@@ -445,7 +493,9 @@ void vcpu_virq_struct_reset(struct vcpu *vcpu)
 
 	virq_struct->active_count = 0;
 	spin_lock_init(&virq_struct->lock);
-	init_list(&virq_struct->pending_list);
+	for (i = 0; i < VIRQ_NR_PR_BUCKETS; i++)
+		init_list(&virq_struct->pending_list[i]);
+	virq_struct->pending_mask = 0;
 	init_list(&virq_struct->active_list);
 	virq_struct->pending_virq = 0;
 	virq_struct->pending_hirq = 0;
@@ -459,6 +509,27 @@ void vcpu_virq_struct_reset(struct vcpu *vcpu)
 	}
 }
 
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+/*
+ * the vcpu is stolen by other pcpu, route the hw irqs
+ * of the spis which bind to this vcpu to the new pcpu,
+ * the virq which is already in the list register will
+ * be deactivated on the new pcpu
+ */
+void vcpu_virq_migrate(struct vcpu *vcpu, int cpu)
+{
+	int i;
+	struct virq_desc *desc;
+	struct vm *vm = vcpu->vm;
+
+	for (i = 0; i < vm->vspi_nr; i++) {
+		desc = &vm->vspi_desc[i];
+		if (virq_is_hw(desc) && (desc->vcpu_id == vcpu->vcpu_id))
+			irq_set_affinity(desc->hno, cpu);
+	}
+}
+#endif
+
 static void update_virq_cap(struct virq_desc *desc, unsigned long flags)
 {
 	if (flags & VIRQF_CAN_WAKEUP)
@@ -482,7 +553,9 @@ void vcpu_virq_struct_init(struct vcpu *vcpu)
 
 	virq_struct->active_count = 0;
 	spin_lock_init(&virq_struct->lock);
-	init_list(&virq_struct->pending_list);
+	for (i = 0; i < VIRQ_NR_PR_BUCKETS; i++)
+		init_list(&virq_struct->pending_list[i]);
+	virq_struct->pending_mask = 0;
 	init_list(&virq_struct->active_list);
 	virq_struct->pending_virq = 0;
 	virq_struct->pending_hirq = 0;
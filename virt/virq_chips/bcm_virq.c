@@ -528,7 +528,7 @@ static int bcm2836_update_virq(struct vcpu *vcpu,
 
 static int bcm2836_enter_to_guest(struct vcpu *vcpu, void *data)
 {
-	struct virq_desc *virq, *n;
+	struct virq_desc *virq;
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 
 	/*
@@ -538,11 +538,10 @@ static int bcm2836_enter_to_guest(struct vcpu *vcpu, void *data)
 	 * guest, but it is hard to judge whether all virq
 	 * has been handled by guest vm TBD
 	 */
-	list_for_each_entry_safe(virq, n, &virq_struct->pending_list, list) {
+	while ((virq = virq_first_pending(virq_struct)) != NULL) {
 		if (!virq_is_pending(virq)) {
 			pr_err("virq is not request %d\n", virq->vno);
-			list_del(&virq->list);
-			virq->list.next = NULL;
+			virq_del_pending(virq_struct, virq);
 			continue;
 		}
 
@@ -564,7 +563,7 @@ static int bcm2836_enter_to_guest(struct vcpu *vcpu, void *data)
 		bcm2836_send_virq(vcpu, virq->vno);
 		virq_clear_pending(virq);
 		virq->state = VIRQ_STATE_ACTIVE;
-		list_del(&virq->list);
+		virq_del_pending(virq_struct, virq);
 		list_add_tail(&virq_struct->active_list, &virq->list);
 	}
 
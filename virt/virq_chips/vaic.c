@@ -122,20 +122,19 @@ static int aic_update_virq(struct vcpu *vcpu,
 static int aic_enter_to_guest(struct vcpu *vcpu, void *data)
 {
 	int fiq = 0;
-	struct virq_desc *virq, *n;
+	struct virq_desc *virq;
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 
-	list_for_each_entry_safe(virq, n, &virq_struct->pending_list, list) {
+	while ((virq = virq_first_pending(virq_struct)) != NULL) {
 		if (!virq_is_pending(virq)) {
 			pr_err("virq is not request %d\n", virq->vno);
-			list_del(&virq->list);
-			virq->list.next = NULL;
+			virq_del_pending(virq_struct, virq);
 			continue;
 		}
 
 		virq_clear_pending(virq);
 		virq->state = VIRQ_STATE_ACTIVE;
-		list_del(&virq->list);
+		virq_del_pending(virq_struct, virq);
 		list_add_tail(&virq_struct->active_list, &virq->list);
 
 		if (virq_is_fiq(virq))
@@ -46,10 +46,14 @@ int vgic_irq_enter_to_guest(struct vcpu *vcpu, void *data)
 	 * before it enter to guest
 	 */
 	int id = 0;
-	struct virq_desc *virq, *n;
+	struct virq_desc *virq;
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 
-	list_for_each_entry_safe(virq, n, &virq_struct->pending_list, list) {
+	/*
+	 * fill the list registers in priority order, each virq
+	 * taken here is removed from its pending bucket
+	 */
+	while ((virq = virq_first_pending(virq_struct)) != NULL) {
 		if (!virq_is_pending(virq)) {
 			pr_err("virq is not request %d %d\n", virq->vno, virq->id);
 			virq->state = 0;
@@ -58,8 +62,7 @@ int vgic_irq_enter_to_guest(struct vcpu *vcpu, void *data)
 				ffs_table_unmask_bit(&virq_struct->lrs_table, virq->id);
 				virq->id = VIRQ_INVALID_ID;
 			}
-			list_del(&virq->list);
-			virq->list.next = NULL;
+			virq_del_pending(virq_struct, virq);
 			continue;
 		}
 
@@ -86,10 +89,11 @@ int vgic_irq_enter_to_guest(struct vcpu *vcpu, void *data)
 		virq->id = id;
 __do_send_virq:
 		virqchip_send_virq(vcpu, virq);
+		virq_stat_deliver(virq_struct, virq);
 		virq->state = VIRQ_STATE_PENDING;
 		virq_clear_pending(virq);
 		dsb();
-		list_del(&virq->list);
+		virq_del_pending(virq_struct, virq);
 		list_add_tail(&virq_struct->active_list, &virq->list);
 	}
 
@@ -128,9 +132,18 @@ int vgic_irq_exit_from_guest(struct vcpu *vcpu, void *data)
 				virq->list.next = NULL;
 				virq_struct->active_count--;
 			} else {
+				/*
+				 * the LR is written to 0, release its id
+				 * too, otherwise the virq holds a LR which
+				 * is not valid while it waits in the pending
+				 * bucket, and a higher priority virq can not
+				 * get a LR when all of them are held like this
+				 */
 				virqchip_update_virq(vcpu, virq, VIRQ_ACTION_CLEAR);
+				ffs_table_unmask_bit(&virq_struct->lrs_table, virq->id);
+				virq->id = VIRQ_INVALID_ID;
 				list_del(&virq->list);
-				list_add_tail(&virq_struct->pending_list, &virq->list);
+				virq_add_pending(virq_struct, virq);
 			}
 		} else
 			virq->state = status;
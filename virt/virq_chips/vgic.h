@@ -9,4 +9,16 @@ int vgic_irq_enter_to_guest(struct vcpu *vcpu, void *data);
 int vgic_irq_exit_from_guest(struct vcpu *vcpu, void *data);
 int vgic_generate_virq(uint32_t *array, int virq);
 
+#ifdef CONFIG_VIRQCHIP_VGICV3_ITS
+#define VGIC_ITS_INTID_BITS	(14)
+
+struct vm;
+struct device_node;
+struct vgic_its;
+
+struct vgic_its *vgic_its_create(struct vm *vm, struct device_node *node);
+void vgic_its_set_propbaser(struct vgic_its *its, uint64_t value);
+int vgic_its_send_msi(struct vgic_its *its, uint32_t devid, uint32_t eventid);
+#endif
+
 #endif
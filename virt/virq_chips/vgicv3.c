@@ -41,6 +41,8 @@ struct vgic_gicr {
 	uint32_t gicr_ctlr;
 	uint32_t gicr_pidr2;
 	uint64_t gicr_typer;
+	uint64_t gicr_propbaser;
+	uint64_t gicr_pendbaser;
 	uint32_t gicr_ispender;
 	uint32_t gicr_enabler0;
 	uint32_t vcpu_id;
@@ -56,6 +58,9 @@ struct vgicv3_dev {
 	struct vgic_gicd gicd;
 	struct vgic_gicr *gicr[NR_CPUS];
 	int nr_lrs;
+#ifdef CONFIG_VIRQCHIP_VGICV3_ITS
+	struct vgic_its *its;
+#endif
 };
 
 #define GIC_TYPE_GICD		(0x0)
@@ -78,6 +83,7 @@ struct vgicv3_info {
 	unsigned long gich_size;
 	unsigned long gicv_base;
 	unsigned long gicv_size;
+	unsigned long maint_irq;
 };
 
 static int gicv3_nr_lr = 0;
@@ -298,11 +304,56 @@ static int vgic_gicd_mmio(struct vcpu *vcpu, struct vgic_gicd *gicd,
 		return vgic_gicd_mmio_write(vcpu, gicd, offset, value);
 }
 
-static int vgic_gicr_rd_mmio(struct vcpu *vcpu, struct vgic_gicr *gicr,
-		int read, unsigned long offset, unsigned long *value)
+#ifdef CONFIG_VIRQCHIP_VGICV3_ITS
+static void vgic_gicr_lpi_write(struct vgicv3_dev *gic, struct vgic_gicr *gicr,
+		unsigned long offset, unsigned long *value)
+{
+	if (!gic->its)
+		return;
+
+	switch (offset) {
+	case GICR_CTLR:
+		gicr->gicr_ctlr = *value & GICR_CTLR_ENABLE_LPIS;
+		break;
+	case GICR_PROPBASER:
+		/* read only after the LPIs are enabled */
+		if (gicr->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)
+			break;
+		gicr->gicr_propbaser = *value;
+		vgic_its_set_propbaser(gic->its, *value);
+		break;
+	case GICR_PENDBASER:
+		if (!(gicr->gicr_ctlr & GICR_CTLR_ENABLE_LPIS))
+			gicr->gicr_pendbaser = *value;
+		break;
+	default:
+		break;
+	}
+}
+#else
+static inline void vgic_gicr_lpi_write(struct vgicv3_dev *gic,
+		struct vgic_gicr *gicr, unsigned long offset,
+		unsigned long *value)
+{
+
+}
+#endif
+
+static int vgic_gicr_rd_mmio(struct vcpu *vcpu, struct vgicv3_dev *gic,
+		struct vgic_gicr *gicr, int read,
+		unsigned long offset, unsigned long *value)
 {
 	if (read) {
 		switch (offset) {
+		case GICR_CTLR:
+			*value = gicr->gicr_ctlr & GICR_CTLR_ENABLE_LPIS;
+			break;
+		case GICR_PROPBASER:
+			*value = gicr->gicr_propbaser;
+			break;
+		case GICR_PENDBASER:
+			*value = gicr->gicr_pendbaser;
+			break;
 		case GICR_PIDR2:
 			*value = gicr->gicr_pidr2;
 			break;
@@ -317,7 +368,7 @@ static int vgic_gicr_rd_mmio(struct vcpu *vcpu, struct vgic_gicr *gicr,
 			break;
 		}
 	} else {
-
+		vgic_gicr_lpi_write(gic, gicr, offset, value);
 	}
 
 	return 0;
@@ -460,7 +511,7 @@ out:
 	case GIC_TYPE_GICD:
 		return vgic_gicd_mmio(vcpu, gicd, read, offset, value);
 	case GIC_TYPE_GICR_RD:
-		return vgic_gicr_rd_mmio(vcpu, gicr, read, offset, value);
+		return vgic_gicr_rd_mmio(vcpu, gic, gicr, read, offset, value);
 	case GIC_TYPE_GICR_SGI:
 		return vgic_gicr_sgi_mmio(vcpu, gicr, read, offset, value);
 	case GIC_TYPE_GICR_VLPI:
@@ -529,11 +580,14 @@ static void vgic_gicr_init(struct vcpu *vcpu,
 	gicr->vlpi_base = 0;
 
 	gicr->gicr_ctlr = 0;
+	gicr->gicr_propbaser = 0;
+	gicr->gicr_pendbaser = 0;
 	gicr->gicr_ispender = 0;
 	spin_lock_init(&gicr->gicr_lock);
 
-	/* TBD */
-	gicr->gicr_typer = 0 | ((unsigned long)vcpu->vcpu_id << 32);
+	/* affinity and processor number are both the vcpu id */
+	gicr->gicr_typer = ((unsigned long)vcpu->vcpu_id << 32) |
+		(vcpu->vcpu_id << 8);
 	gicr->gicr_pidr2 = 0x3 << 4;
 }
 
@@ -566,7 +620,26 @@ static void vgic_deinit(struct vdev *vdev)
 
 static void vgic_reset(struct vdev *vdev)
 {
+	int i;
+	struct vgic_gicr *gicr;
+	struct vgicv3_dev *dev = vdev_to_vgic(vdev);
+
 	pr_notice("vgic device reset\n");
+
+	/*
+	 * the LPI state of the redistributors need to be cleared
+	 * otherwise the rebooted guest will find EnableLPIs still
+	 * set and can not program the PROPBASER and PENDBASER
+	 */
+	for (i = 0; i < vdev->vm->vcpu_nr; i++) {
+		gicr = dev->gicr[i];
+		if (!gicr)
+			continue;
+
+		gicr->gicr_ctlr = 0;
+		gicr->gicr_propbaser = 0;
+		gicr->gicr_pendbaser = 0;
+	}
 }
 
 static int64_t gicv3_read_lr(int lr)
@@ -593,7 +666,7 @@ static int64_t gicv3_read_lr(int lr)
 	}
 }
 
-static void gicv3_write_lr(int lr, uint64_t val)
+static void __gicv3_write_lr(int lr, uint64_t val)
 {
 	switch ( lr )
 	{
@@ -646,9 +719,13 @@ static void gicv3_write_lr(int lr, uint64_t val)
 		write_sysreg(val, ICH_LR15_EL2);
 		break;
 	default:
-		return;
+		break;
 	}
+}
 
+static void gicv3_write_lr(int lr, uint64_t val)
+{
+	__gicv3_write_lr(lr, val);
 	isb();
 }
 
@@ -719,11 +796,94 @@ static int gicv3_get_virq_state(struct vcpu *vcpu, struct virq_desc *virq)
 	return ((int)value);
 }
 
+#ifdef CONFIG_VIRQCHIP_VGICV3_ITS
+static int vgicv3_send_msi(void *pdata, uint32_t devid, uint32_t eventid)
+{
+	struct vgicv3_dev *dev = (struct vgicv3_dev *)pdata;
+
+	return vgic_its_send_msi(dev->its, devid, eventid);
+}
+
+/*
+ * expose the LPIs to the vm when it has a virtual ITS, the
+ * LPIs share the list registers with the other virqs
+ */
+static void vgicv3_its_init(struct vm *vm, struct vgicv3_dev *dev,
+		struct device_node *node, struct virq_chip *vc)
+{
+	int i;
+
+	dev->its = vgic_its_create(vm, node);
+	if (!dev->its)
+		return;
+
+	dev->gicd.gicd_typer &= ~(0x1f << 19);
+	dev->gicd.gicd_typer |= GICD_TYPER_LPIS;
+	dev->gicd.gicd_typer |= (VGIC_ITS_INTID_BITS - 1) << 19;
+
+	for (i = 0; i < vm->vcpu_nr; i++)
+		dev->gicr[i]->gicr_typer |= GICR_TYPER_PLPIS;
+
+	vc->send_msi = vgicv3_send_msi;
+}
+#endif
+
 static int gicv3_generate_virq(uint32_t *array, int virq)
 {
 	return vgic_generate_virq(array, virq);
 }
 
+/*
+ * whether ICH_HCR_EL2.UIE is set on this pcpu, the context of
+ * a vcpu is always saved with UIE cleared
+ */
+static DEFINE_PER_CPU(int, gicv3_hw_uie);
+
+static void gicv3_set_underflow(int enable)
+{
+	int *uie = &get_cpu_var(gicv3_hw_uie);
+	uint32_t hcr;
+
+	if (*uie == enable)
+		return;
+
+	hcr = read_sysreg32(ICH_HCR_EL2);
+	if (enable)
+		hcr |= GICH_HCR_UIE;
+	else
+		hcr &= ~GICH_HCR_UIE;
+	write_sysreg32(hcr, ICH_HCR_EL2);
+	isb();
+
+	*uie = enable;
+}
+
+/*
+ * if there are more pending virqs than the free LRs, ask
+ * for a maintenance interrupt when the guest has handled
+ * all or all but one of the LRs, then the left virqs are
+ * filled at once, do not wait an unrelated exit of the vcpu
+ */
+static int vgicv3_irq_enter_to_guest(struct vcpu *vcpu, void *data)
+{
+	vgic_irq_enter_to_guest(vcpu, data);
+	gicv3_set_underflow(virq_has_pending(vcpu->virq_struct));
+
+	return 0;
+}
+
+/*
+ * the maintenance interrupt only makes the vcpu exit, the
+ * exit path releases the handled LRs and the enter path
+ * fills them again
+ */
+static int vgicv3_maint_handler(uint32_t irq, void *data)
+{
+	gicv3_set_underflow(0);
+
+	return 0;
+}
+
 static int vgicv3_vcpu_init(struct vcpu *vcpu, void *d, unsigned long flags)
 {
 	struct vgicv3_dev *dev = (struct vgicv3_dev *)d;
@@ -746,7 +906,7 @@ static void vgicv3_init_virqchip(struct virq_chip *vc,
 	if (flags & VIRQCHIP_F_HW_VIRT) {
 		dev->nr_lrs = gicv3_nr_lr;
 		vc->exit_from_guest = vgic_irq_exit_from_guest;
-		vc->enter_to_guest = vgic_irq_enter_to_guest;
+		vc->enter_to_guest = vgicv3_irq_enter_to_guest;
 		vc->xlate = gic_xlate_irq;
 		vc->generate_virq = gicv3_generate_virq;
 		vc->send_virq = gicv3_send_virq;
@@ -822,6 +982,11 @@ struct virq_chip *vgicv3_virqchip_init(struct vm *vm,
 	vgicv3_init_virqchip(vc, vgicv3_dev, flags);
 	arm_data->sgi1r_el1_trap = vgicv3_send_sgi;
 
+#ifdef CONFIG_VIRQCHIP_VGICV3_ITS
+	if (flags & VIRQCHIP_F_HW_VIRT)
+		vgicv3_its_init(vm, vgicv3_dev, node, vc);
+#endif
+
 	return vc;
 
 release_gic:
@@ -830,48 +995,48 @@ release_gic:
 }
 VIRQCHIP_DECLARE(vgicv3_chip, gicv3_match_table, vgicv3_virqchip_init);
 
-static void gicv3_save_lrs(struct gicv3_context *c, uint32_t count)
+/*
+ * the LRs which may still be valid in hardware and whether the
+ * APRn registers are not 0, for the vcpu which is saved last
+ * time on this pcpu. The next vcpu only need to clean the ones
+ * which it does not use
+ */
+static DEFINE_PER_CPU(uint32_t, gicv3_hw_lrs);
+static DEFINE_PER_CPU(uint32_t, gicv3_hw_aprn);
+
+/*
+ * only the LRs which are allocated to a virq can be none zero,
+ * a LR is written to 0 before it is freed
+ */
+static inline uint32_t gicv3_used_lrs(struct vcpu *vcpu)
 {
-	if (count > 16)
-		panic("Unsupport LR count\n");
+	struct ffs_table *tbl = &vcpu->virq_struct->lrs_table;
+	uint32_t free = tbl->bits[0] | (tbl->bits[1] << 8);
 
-	switch (count) {
-	case 16:
-		c->ich_lr15_el2 = read_sysreg(ICH_LR15_EL2);
-	case 15:
-		c->ich_lr14_el2 = read_sysreg(ICH_LR14_EL2);
-	case 14:
-		c->ich_lr13_el2 = read_sysreg(ICH_LR13_EL2);
-	case 13:
-		c->ich_lr12_el2 = read_sysreg(ICH_LR12_EL2);
-	case 12:
-		c->ich_lr11_el2 = read_sysreg(ICH_LR11_EL2);
-	case 11:
-		c->ich_lr10_el2 = read_sysreg(ICH_LR10_EL2);
-	case 10:
-		c->ich_lr9_el2 = read_sysreg(ICH_LR9_EL2);
-	case 9:
-		c->ich_lr8_el2 = read_sysreg(ICH_LR8_EL2);
-	case 8:
-		c->ich_lr7_el2 = read_sysreg(ICH_LR7_EL2);
-	case 7:
-		c->ich_lr6_el2 = read_sysreg(ICH_LR6_EL2);
-	case 6:
-		c->ich_lr5_el2 = read_sysreg(ICH_LR5_EL2);
-	case 5:
-		c->ich_lr4_el2 = read_sysreg(ICH_LR4_EL2);
-	case 4:
-		c->ich_lr3_el2 = read_sysreg(ICH_LR3_EL2);
-	case 3:
-		c->ich_lr2_el2 = read_sysreg(ICH_LR2_EL2);
-	case 2:
-		c->ich_lr1_el2 = read_sysreg(ICH_LR1_EL2);
-	case 1:
-		c->ich_lr0_el2 = read_sysreg(ICH_LR0_EL2);
-		break;
-	default:
-		break;
+	return ~free & ((1U << gicv3_nr_lr) - 1);
+}
+
+/*
+ * ICH_ELRSR_EL2 tells which LRs have been handled by the guest,
+ * an empty LR is the same as 0 for the vgic, so only the live
+ * ones are saved, an idle vcpu does not touch the LRs at all
+ */
+static void gicv3_save_lrs(struct vcpu *vcpu, struct gicv3_context *c)
+{
+	uint32_t live = gicv3_used_lrs(vcpu);
+	uint32_t mask;
+	int i;
+
+	if (live)
+		live &= ~read_sysreg32(ICH_ELRSR_EL2);
+
+	for (mask = live; mask; mask &= mask - 1) {
+		i = __ffs(mask);
+		c->ich_lr_el2[i] = gicv3_read_lr(i);
 	}
+
+	c->lr_live = live;
+	get_cpu_var(gicv3_hw_lrs) = live;
 }
 
 static void gicv3_save_aprn(struct gicv3_context *c, uint32_t count)
@@ -890,6 +1055,10 @@ static void gicv3_save_aprn(struct gicv3_context *c, uint32_t count)
 	default:
 		panic("Unsupport aprn count\n");
 	}
+
+	c->aprn_live = c->ich_ap0r2_el2 | c->ich_ap1r2_el2 |
+		c->ich_ap0r1_el2 | c->ich_ap1r1_el2 |
+		c->ich_ap0r0_el2 | c->ich_ap1r0_el2;
 }
 
 static void gicv3_state_save(struct vcpu *vcpu, void *context)
@@ -897,11 +1066,27 @@ static void gicv3_state_save(struct vcpu *vcpu, void *context)
 	struct gicv3_context *c = (struct gicv3_context *)context;
 
 	dsb();
-	gicv3_save_lrs(c, gicv3_nr_lr);
-	gicv3_save_aprn(c, gicv3_nr_pr);
+	gicv3_save_lrs(vcpu, c);
+
+	/*
+	 * an active priority is always dropped before the virq
+	 * in the LR is deactivated, so if no LR is live the
+	 * APRn registers are 0 too. When aprn_live is 0 all
+	 * the APRn values in the context are 0
+	 */
+	if (c->lr_live) {
+		gicv3_save_aprn(c, gicv3_nr_pr);
+	} else if (c->aprn_live) {
+		c->ich_ap0r2_el2 = c->ich_ap1r2_el2 = 0;
+		c->ich_ap0r1_el2 = c->ich_ap1r1_el2 = 0;
+		c->ich_ap0r0_el2 = c->ich_ap1r0_el2 = 0;
+		c->aprn_live = 0;
+	}
+	get_cpu_var(gicv3_hw_aprn) = c->aprn_live;
+
 	c->icc_sre_el1 = read_sysreg32(ICC_SRE_EL1);
 	c->ich_vmcr_el2 = read_sysreg32(ICH_VMCR_EL2);
-	c->ich_hcr_el2 = read_sysreg32(ICH_HCR_EL2);
+	c->ich_hcr_el2 = read_sysreg32(ICH_HCR_EL2) & ~GICH_HCR_UIE;
 }
 
 static void gicv3_restore_aprn(struct gicv3_context *c, uint32_t count)
@@ -922,59 +1107,42 @@ static void gicv3_restore_aprn(struct gicv3_context *c, uint32_t count)
 	}
 }
 
-static void gicv3_restore_lrs(struct gicv3_context *c, uint32_t count)
+/*
+ * write the live LRs of this vcpu, and clean the ones which
+ * are left valid by the vcpu which ran before on this pcpu
+ */
+static void gicv3_restore_lrs(struct gicv3_context *c)
 {
-	if (count > 16)
-		panic("Unsupport LR count");
+	uint32_t *hw_lrs = &get_cpu_var(gicv3_hw_lrs);
+	uint32_t mask;
+	int i;
 
-	switch (count) {
-	case 16:
-		write_sysreg(c->ich_lr15_el2, ICH_LR15_EL2);
-	case 15:
-		write_sysreg(c->ich_lr14_el2, ICH_LR14_EL2);
-	case 14:
-		write_sysreg(c->ich_lr13_el2, ICH_LR13_EL2);
-	case 13:
-		write_sysreg(c->ich_lr12_el2, ICH_LR12_EL2);
-	case 12:
-		write_sysreg(c->ich_lr11_el2, ICH_LR11_EL2);
-	case 11:
-		write_sysreg(c->ich_lr10_el2, ICH_LR10_EL2);
-	case 10:
-		write_sysreg(c->ich_lr9_el2, ICH_LR9_EL2);
-	case 9:
-		write_sysreg(c->ich_lr8_el2, ICH_LR8_EL2);
-	case 8:
-		write_sysreg(c->ich_lr7_el2, ICH_LR7_EL2);
-	case 7:
-		write_sysreg(c->ich_lr6_el2, ICH_LR6_EL2);
-	case 6:
-		write_sysreg(c->ich_lr5_el2, ICH_LR5_EL2);
-	case 5:
-		write_sysreg(c->ich_lr4_el2, ICH_LR4_EL2);
-	case 4:
-		write_sysreg(c->ich_lr3_el2, ICH_LR3_EL2);
-	case 3:
-		write_sysreg(c->ich_lr2_el2, ICH_LR2_EL2);
-	case 2:
-		write_sysreg(c->ich_lr1_el2, ICH_LR1_EL2);
-	case 1:
-		write_sysreg(c->ich_lr0_el2, ICH_LR0_EL2);
-		break;
-	default:
-		break;
+	for (mask = *hw_lrs & ~c->lr_live; mask; mask &= mask - 1)
+		__gicv3_write_lr(__ffs(mask), 0);
+
+	for (mask = c->lr_live; mask; mask &= mask - 1) {
+		i = __ffs(mask);
+		__gicv3_write_lr(i, c->ich_lr_el2[i]);
 	}
+
+	*hw_lrs = c->lr_live;
 }
 
 static void gicv3_state_restore(struct vcpu *vcpu, void *context)
 {
 	struct gicv3_context *c = (struct gicv3_context *)context;
+	uint32_t *hw_aprn = &get_cpu_var(gicv3_hw_aprn);
+
+	gicv3_restore_lrs(c);
+	if (c->aprn_live || *hw_aprn) {
+		gicv3_restore_aprn(c, gicv3_nr_pr);
+		*hw_aprn = c->aprn_live;
+	}
 
-	gicv3_restore_lrs(c, gicv3_nr_lr);
-	gicv3_restore_aprn(c, gicv3_nr_pr);
 	write_sysreg32(c->icc_sre_el1, ICC_SRE_EL1);
 	write_sysreg32(c->ich_vmcr_el2, ICH_VMCR_EL2);
 	write_sysreg32(c->ich_hcr_el2, ICH_HCR_EL2);
+	get_cpu_var(gicv3_hw_uie) = 0;
 	dsb();
 }
 
@@ -1025,3 +1193,40 @@ int vgicv3_init(uint64_t *data, int len)
 
 	return 0;
 }
+
+static int __init_text vgicv3_maint_irq_init(void)
+{
+	if ((vgicv3_info.gicd_base == 0) || (vgicv3_info.maint_irq == 0))
+		return 0;
+
+	return request_irq(vgicv3_info.maint_irq, vgicv3_maint_handler,
+			0, "vgic maint irq", NULL);
+}
+subsys_initcall_percpu(vgicv3_maint_irq_init);
+
+/*
+ * the LRs and the APRn registers reset to UNKNOWN values, the
+ * restore path only cleans the ones which are recorded in the
+ * gicv3_hw_lrs and gicv3_hw_aprn, so clear all of them here
+ */
+static int __init_text vgicv3_hw_state_init(void)
+{
+	struct gicv3_context c;
+	int i;
+
+	if ((vgicv3_info.gicd_base == 0) || (gicv3_nr_lr == 0))
+		return 0;
+
+	for (i = 0; i < gicv3_nr_lr; i++)
+		__gicv3_write_lr(i, 0);
+
+	memset(&c, 0, sizeof(struct gicv3_context));
+	gicv3_restore_aprn(&c, gicv3_nr_pr);
+	isb();
+
+	get_cpu_var(gicv3_hw_lrs) = 0;
+	get_cpu_var(gicv3_hw_aprn) = 0;
+
+	return 0;
+}
+subsys_initcall_percpu(vgicv3_hw_state_init);
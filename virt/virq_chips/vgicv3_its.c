@@ -0,0 +1,735 @@
+/*
+ * Copyright (C) 2021 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * virtual ITS for the vgicv3, the guest programs the ITS with
+ * its command queue the same way as a real one, and the LPIs
+ * are delivered by the list registers like the SPIs. The device
+ * table and the ITT are kept by the hypervisor, so all the
+ * GITS_BASER<n> are reported as not implemented.
+ */
+
+#include <minos/minos.h>
+#include <minos/of.h>
+#include <minos/mm.h>
+#include <minos/mmu.h>
+#include <minos/bitops.h>
+#include <device/gicv3.h>
+#include <virt/vm.h>
+#include <virt/vmm.h>
+#include <virt/virq.h>
+#include <virt/vdev.h>
+#include <virt/resource.h>
+#include "vgic.h"
+
+/* 8192 LPIs, INTID 8192 - 16383, see VGIC_ITS_INTID_BITS */
+#define VGIC_ITS_NR_LPIS		(8192)
+#define VGIC_ITS_DEVID_BITS		(16)
+#define VGIC_ITS_EVENTID_BITS		(12)
+#define VGIC_ITS_ITE_SIZE		(8)
+#define VGIC_ITS_NR_COLLECTIONS		(VM_MAX_VCPU)
+#define VGIC_ITS_COLL_INVALID		(0xff)
+
+#define VGIC_ITS_CMD_SIZE		(32)
+#define VGIC_ITS_CMDQ_MAX_PAGES		(16)
+
+#define VGIC_ITS_LPI_DEFAULT_PR		(0xa0)
+
+struct vgic_ite {
+	uint16_t intid;			/* 0 - not mapped */
+	uint16_t icid;
+};
+
+struct vgic_its_device {
+	uint32_t devid;
+	uint32_t nr_events;
+	struct vgic_ite *ite;
+	struct list_head list;
+};
+
+struct vgic_its {
+	struct vdev vdev;
+	struct vm *vm;
+	spinlock_t lock;
+
+	uint32_t ctlr;
+	uint64_t typer;
+	uint64_t cbaser;
+	uint64_t cwriter;
+	uint64_t creadr;
+	void *cmdq;
+	size_t cmdq_size;
+
+	uint64_t propbaser;
+	uint8_t *prop;
+	uint32_t nr_prop;
+
+	uint8_t coll[VGIC_ITS_NR_COLLECTIONS];
+	struct list_head device_list;
+
+	/* the LPIs which are triggered when they are disabled */
+	unsigned long *lpi_pending;
+};
+
+#define vdev_to_its(vdev) \
+	(struct vgic_its *)container_of(vdev, struct vgic_its, vdev)
+
+#define its_cmd_type(cmd)	((cmd)[0] & 0xff)
+#define its_cmd_devid(cmd)	((uint32_t)((cmd)[0] >> 32))
+#define its_cmd_eventid(cmd)	((uint32_t)(cmd)[1])
+#define its_cmd_intid(cmd)	((uint32_t)((cmd)[1] >> 32))
+#define its_cmd_size(cmd)	(((cmd)[1] & 0x1f) + 1)
+#define its_cmd_icid(cmd)	((uint32_t)((cmd)[2] & 0xffff))
+#define its_cmd_rdbase(cmd)	(((cmd)[2] >> 16) & 0x7ffffffffUL)
+#define its_cmd_valid(cmd)	(!!((cmd)[2] & (1UL << 63)))
+
+/*
+ * the guest tables are in the guest's normal memory, map
+ * them to the hypervisor the same as map_vm_mem(), the table
+ * need to be continuous in the physical memory
+ */
+static void *vgic_its_map_table(struct vm *vm, unsigned long base,
+		size_t size)
+{
+	unsigned long pa, end;
+
+	pa = translate_vm_address(vm, base);
+	end = translate_vm_address(vm, base + size - 1);
+	if (!pa || (end != pa + size - 1)) {
+		pr_err("vits: table 0x%x size 0x%x is not continuous\n",
+				base, size);
+		return NULL;
+	}
+
+	if (create_host_mapping(pa, pa, size, 0))
+		return NULL;
+
+	return (void *)pa;
+}
+
+static void vgic_its_unmap_table(void *table, size_t size)
+{
+	if (table)
+		destroy_host_mapping((unsigned long)table, size);
+}
+
+static struct vgic_its_device *
+vgic_its_find_device(struct vgic_its *its, uint32_t devid)
+{
+	struct vgic_its_device *dev;
+
+	list_for_each_entry(dev, &its->device_list, list) {
+		if (dev->devid == devid)
+			return dev;
+	}
+
+	return NULL;
+}
+
+static struct vgic_ite *vgic_its_find_ite(struct vgic_its *its,
+		uint32_t devid, uint32_t eventid)
+{
+	struct vgic_its_device *dev;
+
+	dev = vgic_its_find_device(its, devid);
+	if (!dev || (eventid >= dev->nr_events))
+		return NULL;
+
+	return &dev->ite[eventid];
+}
+
+static inline int vgic_its_lpi_valid(struct vgic_its *its, uint32_t intid)
+{
+	return (intid >= VM_LPI_VIRQ_BASE) &&
+		(VIRQ_LPI_OFFSET(intid) < its->vm->vlpi_nr);
+}
+
+static struct vcpu *vgic_its_target(struct vgic_its *its, uint32_t icid)
+{
+	if ((icid >= VGIC_ITS_NR_COLLECTIONS) ||
+			(its->coll[icid] == VGIC_ITS_COLL_INVALID))
+		return NULL;
+
+	return get_vcpu_in_vm(its->vm, its->coll[icid]);
+}
+
+static int vgic_its_trigger_lpi(struct vgic_its *its, struct vgic_ite *ite)
+{
+	struct vm *vm = its->vm;
+	struct virq_desc *desc;
+	struct vcpu *vcpu;
+
+	vcpu = vgic_its_target(its, ite->icid);
+	if (!vcpu)
+		return -ENOENT;
+
+	desc = &vm->vlpi_desc[VIRQ_LPI_OFFSET(ite->intid)];
+	desc->vcpu_id = get_vcpu_id(vcpu);
+
+	/*
+	 * the LPI is disabled in the property table, keep
+	 * it pending, it will be sent when it is enabled
+	 */
+	if (!virq_is_enabled(desc)) {
+		set_bit(VIRQ_LPI_OFFSET(ite->intid), its->lpi_pending);
+		return 0;
+	}
+
+	return send_virq_to_vcpu(vcpu, ite->intid);
+}
+
+/*
+ * load the priority and the enable bit of the LPI from the
+ * property table, the guest issues INV or INVALL after it
+ * changes the table
+ */
+static void vgic_its_update_lpi(struct vgic_its *its, struct vgic_ite *ite)
+{
+	uint32_t offset = VIRQ_LPI_OFFSET(ite->intid);
+	struct virq_desc *desc = &its->vm->vlpi_desc[offset];
+	uint8_t prop;
+
+	if (!its->prop || (offset >= its->nr_prop))
+		return;
+
+	prop = its->prop[offset];
+	desc->pr = prop & 0xfc;
+
+	if (!(prop & 0x1)) {
+		virq_clear_enable(desc);
+		return;
+	}
+
+	virq_set_enable(desc);
+	if (test_and_clear_bit(offset, its->lpi_pending))
+		vgic_its_trigger_lpi(its, ite);
+}
+
+static void vgic_its_update_all(struct vgic_its *its, uint32_t icid)
+{
+	struct vgic_its_device *dev;
+	struct vgic_ite *ite;
+	int i;
+
+	list_for_each_entry(dev, &its->device_list, list) {
+		for (i = 0; i < dev->nr_events; i++) {
+			ite = &dev->ite[i];
+			if (ite->intid && (ite->icid == icid))
+				vgic_its_update_lpi(its, ite);
+		}
+	}
+}
+
+static void vgic_its_free_device(struct vgic_its *its,
+		struct vgic_its_device *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nr_events; i++) {
+		if (dev->ite[i].intid)
+			clear_bit(VIRQ_LPI_OFFSET(dev->ite[i].intid),
+					its->lpi_pending);
+	}
+
+	list_del(&dev->list);
+	free(dev->ite);
+	free(dev);
+}
+
+static int vgic_its_cmd_mapd(struct vgic_its *its, uint64_t *cmd)
+{
+	uint32_t devid = its_cmd_devid(cmd);
+	uint32_t bits = its_cmd_size(cmd);
+	struct vgic_its_device *dev;
+
+	if ((devid >> VGIC_ITS_DEVID_BITS) || (bits > VGIC_ITS_EVENTID_BITS))
+		return -EINVAL;
+
+	/* a mapped device is remapped with a new ITT */
+	dev = vgic_its_find_device(its, devid);
+	if (dev)
+		vgic_its_free_device(its, dev);
+
+	if (!its_cmd_valid(cmd))
+		return 0;
+
+	dev = zalloc(sizeof(struct vgic_its_device));
+	if (!dev)
+		return -ENOMEM;
+
+	dev->devid = devid;
+	dev->nr_events = 1 << bits;
+	dev->ite = zalloc(sizeof(struct vgic_ite) * dev->nr_events);
+	if (!dev->ite) {
+		free(dev);
+		return -ENOMEM;
+	}
+
+	list_add_tail(&its->device_list, &dev->list);
+
+	return 0;
+}
+
+static int vgic_its_cmd_mapc(struct vgic_its *its, uint64_t *cmd)
+{
+	uint32_t icid = its_cmd_icid(cmd);
+	unsigned long target = its_cmd_rdbase(cmd);
+
+	if (icid >= VGIC_ITS_NR_COLLECTIONS)
+		return -EINVAL;
+
+	if (!its_cmd_valid(cmd)) {
+		its->coll[icid] = VGIC_ITS_COLL_INVALID;
+		return 0;
+	}
+
+	/* GITS_TYPER.PTA is 0, the target is the vcpu id */
+	if (target >= its->vm->vcpu_nr)
+		return -EINVAL;
+
+	its->coll[icid] = target;
+
+	return 0;
+}
+
+static int vgic_its_cmd_mapti(struct vgic_its *its, uint64_t *cmd)
+{
+	uint32_t eventid = its_cmd_eventid(cmd);
+	uint32_t icid = its_cmd_icid(cmd);
+	uint32_t intid;
+	struct vgic_ite *ite;
+
+	if (its_cmd_type(cmd) == GITS_CMD_MAPI)
+		intid = eventid;
+	else
+		intid = its_cmd_intid(cmd);
+
+	ite = vgic_its_find_ite(its, its_cmd_devid(cmd), eventid);
+	if (!ite || !vgic_its_lpi_valid(its, intid) ||
+			(icid >= VGIC_ITS_NR_COLLECTIONS))
+		return -EINVAL;
+
+	ite->intid = intid;
+	ite->icid = icid;
+
+	return 0;
+}
+
+static int vgic_its_handle_cmd(struct vgic_its *its, uint64_t *cmd)
+{
+	struct vgic_ite *ite = NULL;
+	int type = its_cmd_type(cmd);
+
+	switch (type) {
+	case GITS_CMD_MAPD:
+		return vgic_its_cmd_mapd(its, cmd);
+	case GITS_CMD_MAPC:
+		return vgic_its_cmd_mapc(its, cmd);
+	case GITS_CMD_MAPTI:
+	case GITS_CMD_MAPI:
+		return vgic_its_cmd_mapti(its, cmd);
+	case GITS_CMD_INVALL:
+		vgic_its_update_all(its, its_cmd_icid(cmd));
+		return 0;
+	case GITS_CMD_SYNC:
+	case GITS_CMD_MOVALL:
+		/* the commands are finished when CWRITER is written */
+		return 0;
+	case GITS_CMD_MOVI:
+	case GITS_CMD_INT:
+	case GITS_CMD_CLEAR:
+	case GITS_CMD_DISCARD:
+	case GITS_CMD_INV:
+		ite = vgic_its_find_ite(its, its_cmd_devid(cmd),
+				its_cmd_eventid(cmd));
+		if (!ite || !ite->intid)
+			return -ENOENT;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	switch (type) {
+	case GITS_CMD_MOVI:
+		if (its_cmd_icid(cmd) >= VGIC_ITS_NR_COLLECTIONS)
+			return -EINVAL;
+		ite->icid = its_cmd_icid(cmd);
+		break;
+	case GITS_CMD_INT:
+		return vgic_its_trigger_lpi(its, ite);
+	case GITS_CMD_CLEAR:
+		clear_bit(VIRQ_LPI_OFFSET(ite->intid), its->lpi_pending);
+		break;
+	case GITS_CMD_DISCARD:
+		clear_bit(VIRQ_LPI_OFFSET(ite->intid), its->lpi_pending);
+		ite->intid = 0;
+		break;
+	case GITS_CMD_INV:
+		vgic_its_update_lpi(its, ite);
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * the commands are handled when the guest updates CWRITER,
+ * so CREADR always catches up CWRITER before the write trap
+ * returns, a SYNC command does not need to wait anything
+ */
+static void vgic_its_process_cmdq(struct vgic_its *its)
+{
+	uint64_t *cmd;
+	int ret;
+
+	if (!(its->ctlr & GITS_CTLR_ENABLE) || !its->cmdq)
+		return;
+
+	while (its->creadr != its->cwriter) {
+		cmd = (uint64_t *)(its->cmdq + its->creadr);
+		ret = vgic_its_handle_cmd(its, cmd);
+		if (ret)
+			pr_debug("vits: cmd 0x%x failed %d\n",
+					its_cmd_type(cmd), ret);
+
+		its->creadr += VGIC_ITS_CMD_SIZE;
+		if (its->creadr >= its->cmdq_size)
+			its->creadr = 0;
+	}
+}
+
+static void vgic_its_set_cbaser(struct vgic_its *its, uint64_t value)
+{
+	size_t size;
+
+	/* CBASER can only be changed when the ITS is disabled */
+	if (its->ctlr & GITS_CTLR_ENABLE)
+		return;
+
+	its->cbaser = value;
+	its->creadr = 0;
+	vgic_its_unmap_table(its->cmdq, its->cmdq_size);
+	its->cmdq = NULL;
+	its->cmdq_size = 0;
+
+	if (!(value & (1UL << 63)))
+		return;
+
+	size = ((value & 0xff) + 1) * PAGE_SIZE;
+	if (size > VGIC_ITS_CMDQ_MAX_PAGES * PAGE_SIZE) {
+		pr_warn("vits: command queue is too big 0x%x\n", size);
+		size = VGIC_ITS_CMDQ_MAX_PAGES * PAGE_SIZE;
+	}
+
+	its->cmdq = vgic_its_map_table(its->vm,
+			value & 0xffffffffff000UL, size);
+	if (its->cmdq)
+		its->cmdq_size = size;
+}
+
+static int vgic_its_mmio_read(struct vdev *vdev, gp_regs *regs,
+		unsigned long address, unsigned long *value)
+{
+	struct vgic_its *its = vdev_to_its(vdev);
+	unsigned long offset = address - vdev->gvm_paddr;
+
+	switch (offset) {
+	case GITS_CTLR:
+		*value = its->ctlr | GITS_CTLR_QUIESCENT;
+		break;
+	case GITS_IIDR:
+		*value = 0x43b;
+		break;
+	case GITS_TYPER:
+		*value = its->typer;
+		break;
+	case GITS_TYPER_HIGH:
+		*value = its->typer >> 32;
+		break;
+	case GITS_CBASER:
+		*value = its->cbaser;
+		break;
+	case GITS_CBASER_HIGH:
+		*value = its->cbaser >> 32;
+		break;
+	case GITS_CWRITER:
+		*value = its->cwriter;
+		break;
+	case GITS_CREADR:
+		*value = its->creadr;
+		break;
+	case GITS_PIDR2:
+		*value = 0x3 << 4;
+		break;
+	default:
+		/* GITS_BASER<n> are all type none */
+		*value = 0;
+		break;
+	}
+
+	return 0;
+}
+
+static int vgic_its_mmio_write(struct vdev *vdev, gp_regs *regs,
+		unsigned long address, unsigned long *value)
+{
+	struct vgic_its *its = vdev_to_its(vdev);
+	unsigned long offset = address - vdev->gvm_paddr;
+	unsigned long flags;
+
+	spin_lock_irqsave(&its->lock, flags);
+
+	switch (offset) {
+	case GITS_CTLR:
+		its->ctlr = *value & GITS_CTLR_ENABLE;
+		vgic_its_process_cmdq(its);
+		break;
+	case GITS_CBASER:
+		vgic_its_set_cbaser(its, *value);
+		break;
+	case GITS_CWRITER:
+		its->cwriter = *value & 0xfffe0;
+		if (its->cwriter >= its->cmdq_size)
+			its->cwriter = 0;
+		vgic_its_process_cmdq(its);
+		break;
+	case GITS_TRANSLATER:
+		/*
+		 * a cpu write carries no device id, the emulated
+		 * devices in vm0 send the MSIs by HVC_VM_SEND_MSI
+		 */
+		break;
+	default:
+		break;
+	}
+
+	spin_unlock_irqrestore(&its->lock, flags);
+
+	return 0;
+}
+
+int vgic_its_send_msi(struct vgic_its *its, uint32_t devid, uint32_t eventid)
+{
+	struct vgic_ite *ite;
+	unsigned long flags;
+	int ret = -ENOENT;
+
+	if (!its)
+		return -ENOENT;
+
+	spin_lock_irqsave(&its->lock, flags);
+
+	if (its->ctlr & GITS_CTLR_ENABLE) {
+		ite = vgic_its_find_ite(its, devid, eventid);
+		if (ite && ite->intid)
+			ret = vgic_its_trigger_lpi(its, ite);
+	}
+
+	spin_unlock_irqrestore(&its->lock, flags);
+
+	return ret;
+}
+
+/*
+ * GICR_PROPBASER is written by each vcpu with the same value,
+ * the property table is shared by all the redistributors
+ */
+void vgic_its_set_propbaser(struct vgic_its *its, uint64_t value)
+{
+	uint32_t nr_intids, idbits;
+	unsigned long flags;
+
+	if (!its || (its->propbaser == value))
+		return;
+
+	spin_lock_irqsave(&its->lock, flags);
+
+	its->propbaser = value;
+	vgic_its_unmap_table(its->prop, its->nr_prop);
+	its->prop = NULL;
+	its->nr_prop = 0;
+
+	/* the guest may write any IDbits, only 14 bits are supported */
+	idbits = (value & 0x1f) + 1;
+	if (idbits > VGIC_ITS_INTID_BITS)
+		idbits = VGIC_ITS_INTID_BITS;
+
+	nr_intids = 1UL << idbits;
+	if (nr_intids > VM_LPI_VIRQ_BASE) {
+		nr_intids -= VM_LPI_VIRQ_BASE;
+		if (nr_intids > its->vm->vlpi_nr)
+			nr_intids = its->vm->vlpi_nr;
+		its->prop = vgic_its_map_table(its->vm,
+				value & 0xffffffffff000UL, nr_intids);
+		if (its->prop)
+			its->nr_prop = nr_intids;
+	}
+
+	spin_unlock_irqrestore(&its->lock, flags);
+}
+
+static void vgic_its_lpi_init(struct vm *vm)
+{
+	struct virq_desc *desc;
+	int i;
+
+	for (i = 0; i < vm->vlpi_nr; i++) {
+		desc = &vm->vlpi_desc[i];
+		memset(desc, 0, sizeof(struct virq_desc));
+		desc->id = VIRQ_INVALID_ID;
+		desc->state = VIRQ_STATE_INACTIVE;
+		desc->type = 1;		/* LPI is always edge */
+		desc->pr = VGIC_ITS_LPI_DEFAULT_PR;
+		desc->vmid = vm->vmid;
+		desc->vno = VM_LPI_VIRQ_BASE + i;
+		desc->list.next = NULL;
+	}
+}
+
+static void vgic_its_clean(struct vgic_its *its)
+{
+	struct vgic_its_device *dev, *n;
+
+	list_for_each_entry_safe(dev, n, &its->device_list, list)
+		vgic_its_free_device(its, dev);
+
+	memset(its->coll, VGIC_ITS_COLL_INVALID, sizeof(its->coll));
+	bitmap_zero(its->lpi_pending, its->vm->vlpi_nr);
+}
+
+static void vgic_its_unmap_tables(struct vgic_its *its)
+{
+	vgic_its_unmap_table(its->cmdq, its->cmdq_size);
+	its->cmdq = NULL;
+	its->cmdq_size = 0;
+
+	vgic_its_unmap_table(its->prop, its->nr_prop);
+	its->prop = NULL;
+	its->nr_prop = 0;
+}
+
+static void vgic_its_reset(struct vdev *vdev)
+{
+	struct vgic_its *its = vdev_to_its(vdev);
+
+	pr_notice("vits device reset\n");
+
+	vgic_its_clean(its);
+	vgic_its_lpi_init(its->vm);
+
+	vgic_its_unmap_tables(its);
+	its->ctlr = 0;
+	its->cbaser = its->cwriter = its->creadr = 0;
+	its->propbaser = 0;
+}
+
+static void vgic_its_deinit(struct vdev *vdev)
+{
+	struct vgic_its *its = vdev_to_its(vdev);
+	struct vm *vm = its->vm;
+
+	vgic_its_clean(its);
+	vgic_its_unmap_tables(its);
+	vdev_release(vdev);
+
+	free(vm->vlpi_desc);
+	vm->vlpi_desc = NULL;
+	vm->vlpi_nr = 0;
+
+	free(its->lpi_pending);
+	free(its);
+}
+
+struct vgic_its *vgic_its_create(struct vm *vm, struct device_node *node)
+{
+	struct device_node *its_node;
+	struct vgic_its *its;
+	uint64_t base, size;
+	size_t desc_size;
+
+	its_node = of_find_node_by_compatible(node, gicv3_its_match_table);
+	if (!its_node)
+		return NULL;
+
+	/*
+	 * the native vm's MSIs are sent to the physical ITS, which
+	 * is not managed by minos, keep the ITS passthrough for it
+	 */
+	if (vm_is_native(vm)) {
+		pr_notice("vits: native vm uses the physical its\n");
+		return NULL;
+	}
+
+	/*
+	 * the ITS has the control frame and the translation frame,
+	 * GITS_TRANSLATER is at 0x10040 in the second 64K frame
+	 */
+	if (translate_device_address_index(its_node, &base, &size, 0))
+		return NULL;
+
+	if (size < 2 * SIZE_64K) {
+		pr_err("vits: need 128K for the its frames, got 0x%x\n", size);
+		return NULL;
+	}
+
+	its = zalloc(sizeof(struct vgic_its));
+	if (!its)
+		return NULL;
+
+	desc_size = PAGE_BALIGN(sizeof(struct virq_desc) * VGIC_ITS_NR_LPIS);
+	vm->vlpi_desc = get_free_pages(PAGE_NR(desc_size));
+	its->lpi_pending = zalloc(BITS_TO_LONGS(VGIC_ITS_NR_LPIS) *
+			sizeof(unsigned long));
+	if (!vm->vlpi_desc || !its->lpi_pending)
+		goto out;
+
+	vm->vlpi_nr = VGIC_ITS_NR_LPIS;
+	vgic_its_lpi_init(vm);
+
+	its->vm = vm;
+	spin_lock_init(&its->lock);
+	init_list(&its->device_list);
+	memset(its->coll, VGIC_ITS_COLL_INVALID, sizeof(its->coll));
+
+	/* physical LPIs, 8 bytes ITE, no GITS_BASER is needed */
+	its->typer = 1;
+	its->typer |= (VGIC_ITS_ITE_SIZE - 1) << 4;
+	its->typer |= (VGIC_ITS_EVENTID_BITS - 1) << 8;
+	its->typer |= (VGIC_ITS_DEVID_BITS - 1) << 13;
+	its->typer |= (uint64_t)vm->vcpu_nr << 24;
+
+	host_vdev_init(vm, &its->vdev, base, 2 * SIZE_64K);
+	vdev_set_name(&its->vdev, "vits");
+	its->vdev.read = vgic_its_mmio_read;
+	its->vdev.write = vgic_its_mmio_write;
+	its->vdev.reset = vgic_its_reset;
+	its->vdev.deinit = vgic_its_deinit;
+
+	/* do not map the its to the vm as a passthrough device */
+	its_node->class = DT_CLASS_VIRQCHIP;
+
+	pr_notice("vits for vm-%d at 0x%x\n", vm->vmid, base);
+
+	return its;
+
+out:
+	free(vm->vlpi_desc);
+	vm->vlpi_desc = NULL;
+	free(its->lpi_pending);
+	free(its);
+
+	return NULL;
+}
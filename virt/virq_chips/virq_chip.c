@@ -34,6 +34,19 @@ static int virqchip_enter_to_guest(void *item, void *data)
 	if (!vc)
 		return -ENOENT;
 
+	/*
+	 * the active list is only changed on the pcpu of this
+	 * vcpu, a virq which other pcpu queues after below check
+	 * is handled like the one queued after the lock is
+	 * released, so the lock is not needed when idle
+	 */
+	if (!virq_has_pending(virq_struct) &&
+			is_list_empty(&virq_struct->active_list)) {
+		if (!(vc->flags & VIRQCHIP_F_HW_VIRT))
+			arch_clear_virq_flag();
+		return 0;
+	}
+
 	/*
 	 * if there is no pending virq for this vcpu
 	 * clear the virq state in HCR_EL2 then just return
@@ -41,7 +54,7 @@ static int virqchip_enter_to_guest(void *item, void *data)
 	 */
 	spin_lock_irqsave(&virq_struct->lock, flags);
 
-	no_pending = is_list_empty(&virq_struct->pending_list);
+	no_pending = !virq_has_pending(virq_struct);
 	no_active = is_list_empty(&virq_struct->active_list);
 
 	if (no_pending && no_active) {
@@ -71,6 +84,9 @@ static int virqchip_exit_from_guest(void *item, void *data)
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 	struct virq_chip *vc = vcpu->vm->virq_chip;
 
+	if (is_list_empty(&virq_struct->active_list))
+		return 0;
+
 	if (vc && vc->exit_from_guest) {
 		spin_lock_irqsave(&virq_struct->lock, flags);
 		vc->exit_from_guest(vcpu, vc->inc_pdata);
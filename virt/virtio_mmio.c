@@ -37,6 +37,43 @@ static int virtio_mmio_read(struct vdev *vdev, gp_regs *regs,
 	return 0;
 }
 
+static int virtio_mmio_notify(struct vdev *vdev, uint32_t queue)
+{
+	struct virtio_device *dev = vdev_to_virtio(vdev);
+	void *iomem = vdev->iomem;
+	uint32_t seq, count;
+	int kick;
+
+	if (!(ioread32(iomem + VIRTIO_MMIO_DEV_FLAGS) &
+				VIRTIO_DEV_F_NOTIFY_FAST))
+		return -ENOENT;
+
+	if ((dev->notify_irq <= 0) || (queue >= VIRTIO_MMIO_NR_NOTIFY_QUEUES))
+		return -EINVAL;
+
+	/*
+	 * bump the notify sequence of the queue, then the
+	 * notify count of the device, the backend acks the
+	 * count before it scans the queues, so only kick it
+	 * when it has seen all the former notifies, the
+	 * mb() pairs with the one after the ack in mvm
+	 */
+	spin_lock(&dev->notify_lock);
+	seq = ioread32(iomem + VIRTIO_MMIO_NOTIFY_SEQ(queue));
+	iowrite32(seq + 1, iomem + VIRTIO_MMIO_NOTIFY_SEQ(queue));
+	wmb();
+	count = ioread32(iomem + VIRTIO_MMIO_NOTIFY_COUNT);
+	iowrite32(count + 1, iomem + VIRTIO_MMIO_NOTIFY_COUNT);
+	mb();
+	kick = (ioread32(iomem + VIRTIO_MMIO_NOTIFY_ACK) == count);
+	spin_unlock(&dev->notify_lock);
+
+	if (kick)
+		send_virq_to_vm(get_vm_by_id(0), dev->notify_irq);
+
+	return 0;
+}
+
 static int virtio_mmio_write(struct vdev *vdev, gp_regs *regs,
 		unsigned long address, unsigned long *write_value)
 {
@@ -97,10 +134,12 @@ static int virtio_mmio_write(struct vdev *vdev, gp_regs *regs,
 		break;
 	case VIRTIO_MMIO_QUEUE_NOTIFY:
 		/*
-		 * indicate a queue is ready, need send a
-		 * event to hvm ?
+		 * indicate a queue is ready, if the backend has
+		 * enabled the notify fast path, complete it here
+		 * without the vmcs trap
 		 */
-		trap_mmio_write_nonblock(address, write_value);
+		if (virtio_mmio_notify(vdev, value))
+			trap_mmio_write_nonblock(address, write_value);
 		break;
 	case VIRTIO_MMIO_STATUS:
 		tmp = ioread32(iomem + VIRTIO_MMIO_STATUS);
@@ -133,8 +172,13 @@ static int virtio_mmio_write(struct vdev *vdev, gp_regs *regs,
 		trap_mmio_write(address, write_value);
 		break;
 	case VIRTIO_MMIO_INTERRUPT_ACK:
+		/*
+		 * only clear the bits which the guest acked, mvm may
+		 * have set another one after the guest read the status
+		 */
 		iowrite32(0, iomem + VIRTIO_MMIO_INTERRUPT_ACK);
-		iowrite32(0, iomem + VIRTIO_MMIO_INTERRUPT_STATUS);
+		tmp = ioread32(iomem + VIRTIO_MMIO_INTERRUPT_STATUS);
+		iowrite32(tmp & ~value, iomem + VIRTIO_MMIO_INTERRUPT_STATUS);
 		break;
 	default:
 		trap_mmio_write(address, write_value);
@@ -149,6 +193,9 @@ void release_virtio_dev(struct vm *vm, struct virtio_device *dev)
 	if (!dev)
 		return;
 
+	if (dev->notify_irq > 0)
+		release_hvm_virq(dev->notify_irq);
+
 	vdev_release(&dev->vdev);
 	free(dev);
 }
@@ -189,6 +236,7 @@ static void *virtio_create_device(struct vm *vm, struct device_node *node)
 		return NULL;
 
 	memset(virtio_dev, 0, sizeof(struct virtio_device));
+	spin_lock_init(&virtio_dev->notify_lock);
 	vdev = &virtio_dev->vdev;
 	ret = host_vdev_init(vm, vdev, base, VIRTIO_DEVICE_IOMEM_SIZE);
 	if (ret)
@@ -204,6 +252,17 @@ static void *virtio_create_device(struct vm *vm, struct device_node *node)
 		return NULL;
 	}
 
+	/*
+	 * the notify virq is allocated by virtio_mmio_init()
+	 * and saved in the iomem, the device owns it from now
+	 * and releases it when the device is released
+	 */
+	virtio_dev->notify_irq = ioread32(vdev->iomem + VIRTIO_MMIO_NOTIFY_IRQ);
+#ifdef CONFIG_PLATFORM_BCM2837
+	if (virtio_dev->notify_irq)
+		virtio_dev->notify_irq += 32;
+#endif
+
 	vdev->read = virtio_mmio_read;
 	vdev->write = virtio_mmio_write;
 	vdev->deinit = virtio_dev_deinit;
@@ -222,6 +281,7 @@ int virtio_mmio_init(struct vm *vm, unsigned long gbase,
 {
 	void *iomem = NULL;
 	unsigned long hva;
+	int irq;
 
 	if (size == 0) {
 		pr_err("invaild virtio mmio size\n");
@@ -235,12 +295,25 @@ int virtio_mmio_init(struct vm *vm, unsigned long gbase,
 
 	memset(iomem, 0, size);
 
-	hva = create_hvm_iomem_map(vm, (unsigned long)iomem, size);
-	if (hva == INVALID_ADDRESS) {
-		free_pages(iomem);
-		return -ENOMEM;
+	/*
+	 * the virq which is used to notify the backend of the
+	 * queue notify fast path, the backend bind it to an
+	 * eventfd, if there is no free virq the queue notify
+	 * will go through the vmcs trap
+	 */
+	irq = alloc_hvm_virq();
+	if (irq > 0) {
+#ifdef CONFIG_PLATFORM_BCM2837
+		iowrite32(irq - 32, iomem + VIRTIO_MMIO_NOTIFY_IRQ);
+#else
+		iowrite32(irq, iomem + VIRTIO_MMIO_NOTIFY_IRQ);
+#endif
 	}
 
+	hva = create_hvm_iomem_map(vm, (unsigned long)iomem, size);
+	if (hva == INVALID_ADDRESS)
+		goto out;
+
 	/*
 	 * virtio's io memory need to mapped to host vm mem space
 	 * then the backend driver can read/write the io memory
@@ -248,11 +321,15 @@ int virtio_mmio_init(struct vm *vm, unsigned long gbase,
 	 * guest vm 's memory space
 	 */
 	if (create_guest_mapping(&vm->mm, gbase, (unsigned long)iomem,
-				size, VM_IO | VM_RO)) {
-		free_pages(iomem);
-		return -ENOMEM;
-	}
+				size, VM_IO | VM_RO))
+		goto out;
 
 	*hbase = hva;
 	return 0;
+
+out:
+	if (irq > 0)
+		release_hvm_virq(irq);
+	free_pages(iomem);
+	return -ENOMEM;
 }
@@ -152,7 +152,15 @@ void save_vcpu_context(struct task *task)
 
 void restore_vcpu_context(struct task *task)
 {
-	restore_vcpu_vmodule_state(task_to_vcpu(task));
+	struct vcpu *vcpu = task_to_vcpu(task);
+
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	if (vcpu->last_pcpu != smp_processor_id()) {
+		vcpu->last_pcpu = smp_processor_id();
+		vcpu_virq_migrate(vcpu, vcpu->last_pcpu);
+	}
+#endif
+	restore_vcpu_vmodule_state(vcpu);
 }
 
 int vcpu_can_idle(struct vcpu *vcpu)
@@ -166,23 +174,93 @@ int vcpu_can_idle(struct vcpu *vcpu)
 	return 1;
 }
 
+#ifdef CONFIG_VCPU_HALT_POLL
+#define HALT_POLL_NS_START	10000
+#define HALT_POLL_NS_MAX	CONFIG_HALT_POLL_NS_MAX
+
+/*
+ * spin before give up the pcpu, return 1 if a virq comes
+ * inside the window, stop polling when other task on this
+ * pcpu need to run
+ */
+static int vcpu_halt_poll(struct vcpu *vcpu, unsigned long start)
+{
+	unsigned long deadline = start + vcpu->halt_poll_ns;
+
+	do {
+		if (vcpu_has_irq(vcpu))
+			return 1;
+		if (need_resched())
+			break;
+		cpu_relax();
+	} while (NOW() < deadline);
+
+	return 0;
+}
+
+/*
+ * tune the poll window by how long the vcpu waited for the
+ * virq, if the wait is longer than the max window polling
+ * is wasting the pcpu, shrink it, if the wait is shorter
+ * than the max window but missed the current one, grow it
+ */
+static void vcpu_halt_poll_update(struct vcpu *vcpu, unsigned long block_ns)
+{
+	uint32_t val = vcpu->halt_poll_ns;
+
+	if (block_ns <= val)
+		return;
+
+	if (block_ns > HALT_POLL_NS_MAX) {
+		val /= 2;
+		if (val < HALT_POLL_NS_START)
+			val = 0;
+	} else if (val < HALT_POLL_NS_MAX) {
+		val = val ? val * 2 : HALT_POLL_NS_START;
+		if (val > HALT_POLL_NS_MAX)
+			val = HALT_POLL_NS_MAX;
+	}
+
+	vcpu->halt_poll_ns = val;
+}
+#endif
+
 void vcpu_idle(struct vcpu *vcpu)
 {
 	unsigned long flags;
+#ifdef CONFIG_VCPU_HALT_POLL
+	unsigned long start;
+#endif
 
-	if (vcpu_can_idle(vcpu)) {
-		task_lock_irqsave(vcpu->task, flags);
-		if (!vcpu_can_idle(vcpu)) {
-			task_unlock_irqrestore(vcpu->task, flags);
+	if (!vcpu_can_idle(vcpu))
+		return;
+
+#ifdef CONFIG_VCPU_HALT_POLL
+	start = NOW();
+	if (vcpu->halt_poll_ns) {
+		if (vcpu_halt_poll(vcpu, start)) {
+			vcpu->halt_poll_hit++;
 			return;
 		}
+		vcpu->halt_poll_miss++;
+	}
+#endif
 
-		vcpu->task->stat = TASK_STAT_SUSPEND;
-		set_task_sleep(vcpu->task, 0);
+	task_lock_irqsave(vcpu->task, flags);
+	if (!vcpu_can_idle(vcpu)) {
 		task_unlock_irqrestore(vcpu->task, flags);
-
-		sched();
+		return;
 	}
+
+	vcpu->task->stat = TASK_STAT_SUSPEND;
+	set_task_sleep(vcpu->task, 0);
+	task_unlock_irqrestore(vcpu->task, flags);
+
+	sched();
+
+#ifdef CONFIG_VCPU_HALT_POLL
+	vcpu_halt_poll_update(vcpu, NOW() - start);
+#endif
 }
 
 int vcpu_suspend(struct vcpu *vcpu, gp_regs *c,
@@ -315,12 +393,23 @@ static struct vcpu *create_vcpu(struct vm *vm, uint32_t vcpu_id)
 	char name[64];
 	struct vcpu *vcpu;
 	struct task *task;
+	unsigned long flags = 0;
+
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	/*
+	 * the vcpu of the guest vm can be stolen by an idle
+	 * pcpu, the vcpus of vm0 and the native vm keep their
+	 * affinity since their pcpus are passthroughed
+	 */
+	if (!vm_is_hvm(vm) && !vm_is_native(vm))
+		flags |= TASK_FLAGS_MIGRATE;
+#endif
 
 	/* generate the name of the vcpu task */
 	memset(name, 0, 64);
 	sprintf(name, "%s-vcpu-%d", vm->name, vcpu_id);
 	task = create_vcpu_task(name, vm->entry_point, NULL,
-			vm->vcpu_affinity[vcpu_id], 0);
+			vm->vcpu_affinity[vcpu_id], flags);
 	if (task == NULL)
 		return NULL;
 
@@ -334,6 +423,9 @@ static struct vcpu *create_vcpu(struct vm *vm, uint32_t vcpu_id)
 	vcpu->task = task;
 	vcpu->vcpu_id = vcpu_id;
 	vcpu->vm = vm;
+#ifdef CONFIG_SCHED_LOAD_BALANCE
+	vcpu->last_pcpu = task->affinity;
+#endif
 
 	if (!(vm->flags & VM_FLAGS_64BIT))
 		task->flags |= TASK_FLAGS_32BIT;
@@ -936,6 +1028,7 @@ void destroy_vm(struct vm *vm)
 	 * 5 : update the vmid bitmap
 	 * 6 : do vmodule deinit
 	 */
+	vm->last_vdev = NULL;
 	list_for_each_entry_safe(vdev, n, &vm->vdev_list, list) {
 		list_del(&vdev->list);
 		if (vdev->deinit)
@@ -1283,8 +1376,26 @@ void start_all_vm(void)
 		start_vm(vm->vmid);
 }
 
+#ifdef CONFIG_VCPU_HALT_POLL
+static void vm_show_halt_poll(void)
+{
+	struct vm *vm;
+	struct vcpu *vcpu;
+
+	printf(" VM VCPU   WINDOW(ns)          HIT         MISS\n");
+	for_each_vm(vm) {
+		vm_for_each_vcpu(vm, vcpu) {
+			printf("%3d %4d %12u %12lu %12lu\n", vm->vmid,
+				vcpu->vcpu_id, vcpu->halt_poll_ns,
+				vcpu->halt_poll_hit, vcpu->halt_poll_miss);
+		}
+	}
+}
+#endif
+
 /*
  * vm start 0 - start the vm which vmid is 0
+ * vm halt - show the halt poll statistics of each vcpu
  */
 static int vm_command_hdl(int argc, char **argv)
 {
@@ -1297,6 +1408,10 @@ static int vm_command_hdl(int argc, char **argv)
 		else
 			start_vm(vmid);
 	}
+#ifdef CONFIG_VCPU_HALT_POLL
+	else if (argc > 1 && strcmp(argv[1], "halt") == 0)
+		vm_show_halt_poll();
+#endif
 
 	return 0;
 }
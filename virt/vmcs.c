@@ -24,7 +24,10 @@
 int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 		unsigned long *result, int nonblock)
 {
+	int ret = 0;
+	uint64_t index;
 	unsigned long flags;
+	struct vmcs_trap *trap;
 	struct vcpu *vcpu = get_current_vcpu();
 	struct vmcs *vmcs = vcpu->vmcs;
 	struct vm *vm0 = get_vm_by_id(0);
@@ -47,11 +50,11 @@ int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 	local_irq_enable();
 
 	/*
-	 * wait for the last trap complete, if the gvm
+	 * wait for a free slot in the trap ring, if the gvm
 	 * has the same affinity pcpu with the vm0, need
 	 * to use sched() in case of dead lock
 	 */
-	while (vmcs->guest_index != vmcs->host_index) {
+	while ((vmcs->host_index - vmcs->guest_index) >= VMCS_NR_TRAPS) {
 		if (vcpu_affinity(vcpu) < vcpu_affinity(vm0->vcpus[0]))
 			sched_yield();
 		else
@@ -59,25 +62,30 @@ int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 		mb();
 	}
 
-	vmcs->trap_type = type;
-	vmcs->trap_reason = reason;
-	vmcs->trap_data = data;
-	vmcs->trap_ret = 0;
-	vmcs->trap_result = result ? *result : 0;
+	index = vmcs->host_index;
+	trap = &vmcs->traps[index & (VMCS_NR_TRAPS - 1)];
+	trap->type = type;
+	trap->reason = reason;
+	trap->data = data;
+	trap->ret = 0;
+	trap->result = result ? *result : 0;
+	wmb();
 
 	/*
 	 * increase the host index of the vmcs, then send the
-	 * virq to the vcpu0 of the vm0
+	 * virq to the vcpu0 of the vm0, if the vm0 is still
+	 * handling the former traps, it will find this trap
+	 * after it update the guest index, so only kick the
+	 * vm0 when the ring was empty.
 	 */
-	vmcs->host_index++;
+	vmcs->host_index = index + 1;
 	mb();
 
-	if (send_virq_to_vm(vm0, vcpu->vmcs_irq)) {
+	if ((vmcs->guest_index == index) &&
+			send_virq_to_vm(vm0, vcpu->vmcs_irq)) {
 		pr_err("vmcs failed to send virq for vm-%d\n",
 				vcpu->vm->vmid);
-		vmcs->host_index--;
-		vmcs->trap_ret = -EPERM;
-		vmcs->trap_result = 0;
+		local_irq_restore(flags);
 		return -EFAULT;
 	}
 
@@ -94,15 +102,17 @@ int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 	 * hvm's vcpu in case of dead lock
 	 */
 	if (!nonblock) {
-		while (vmcs->guest_index != vmcs->host_index) {
+		while (vmcs->guest_index <= index) {
 			if (vcpu_affinity(vcpu) < vm0->vcpu_nr)
 				sched_yield();
 			else
 				cpu_relax();
 		}
 
+		rmb();
+		ret = trap->ret;
 		if (result)
-			*result = vmcs->trap_result;
+			*result = trap->result;
 	} else {
 		if (result)
 			*result = 0;
@@ -110,7 +120,7 @@ int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 
 	local_irq_restore(flags);
 
-	return vmcs->trap_ret;
+	return ret;
 }
 
 int setup_vmcs_data(void *data, size_t size)
@@ -134,6 +144,7 @@ static void vcpu_vmcs_init(struct vcpu *vcpu)
 	}
 
 	vmcs->vcpu_id = get_vcpu_id(vcpu);
+	vmcs->nr_traps = VMCS_NR_TRAPS;
 }
 
 unsigned long vm_create_vmcs(struct vm *vm)
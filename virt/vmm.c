@@ -233,20 +233,37 @@ static inline int vmm_area_map_bk(struct mm_struct *mm, struct vmm_area *va)
 	struct mem_block *block;
 	unsigned long base = va->start;
 	unsigned long size = va->size;
+	unsigned long pbase = 0, psize = 0;
 
+	/*
+	 * map the physical contiguous blocks together, then
+	 * the 1G aligned region can be mapped as PUD block
+	 */
 	list_for_each_entry(block, &va->b_head, list) {
-		ret = create_guest_mapping(mm, base, block->phy_base,
-				MEM_BLOCK_SIZE, va->flags);
-		if (ret)
-			return ret;
+		if (psize && (block->phy_base == (pbase + psize))) {
+			psize += MEM_BLOCK_SIZE;
+		} else {
+			if (psize) {
+				ret = create_guest_mapping(mm, base, pbase,
+						psize, va->flags);
+				if (ret)
+					return ret;
+
+				base += psize;
+				size -= psize;
+			}
 
-		base += MEM_BLOCK_SIZE;
-		size -= MEM_BLOCK_SIZE;
+			pbase = block->phy_base;
+			psize = MEM_BLOCK_SIZE;
+		}
 
-		if (size == 0)
+		if (size == psize)
 			break;
 	}
 
+	if (psize)
+		return create_guest_mapping(mm, base, pbase, psize, va->flags);
+
 	return 0;
 }
 
@@ -704,11 +721,21 @@ void unmap_vm_mem(unsigned long gva, size_t size)
 	destroy_host_mapping(pa, size);
 }
 
+static unsigned long guest_pud_block(unsigned long pgd, unsigned long vir)
+{
+	unsigned long pud = *((unsigned long *)pgd + guest_pud_idx(vir));
+
+	if (get_mapping_type(PUD, pud) != VM_DES_BLOCK)
+		return 0;
+
+	return pud & VM_ADDRESS_MASK;
+}
+
 static int __vm_mmap(struct mm_struct *mm, unsigned long hvm_mmap_base,
 		unsigned long offset, unsigned long size)
 {
-	unsigned long vir, phy, value;
-	unsigned long *vm_pmd, *vm0_pmd;
+	unsigned long vir, phy, value, pud_block;
+	unsigned long *vm_pmd = NULL, *vm0_pmd;
 	uint64_t attr;
 	int i, vir_off, phy_off, count, left;
 	struct vm *vm0 = get_vm_by_id(0);
@@ -733,10 +760,17 @@ static int __vm_mmap(struct mm_struct *mm, unsigned long hvm_mmap_base,
 	attr = page_table_description(VM_DES_BLOCK | VM_NORMAL);
 
 	while (left > 0) {
-		vm_pmd = (unsigned long *)get_mapping_pmd(mm->pgd_base, vir, 0);
-		if (mapping_error(vm_pmd)) {
-			pr_err("addr 0x%x has not mapped in vm-%d\n", vir);
-			return -EPERM;
+		/*
+		 * the guest memory may be mapped as 1G block, there
+		 * is no pmd table for it, get the 2M block from it
+		 */
+		pud_block = guest_pud_block(mm->pgd_base, vir);
+		if (!pud_block) {
+			vm_pmd = (unsigned long *)get_mapping_pmd(mm->pgd_base, vir, 0);
+			if (mapping_error(vm_pmd)) {
+				pr_err("addr 0x%x has not mapped in vm-%d\n", vir);
+				return -EPERM;
+			}
 		}
 
 		vir_off = pmd_idx(vir);
@@ -744,7 +778,10 @@ static int __vm_mmap(struct mm_struct *mm, unsigned long hvm_mmap_base,
 		count = count > left ? left : count;
 
 		for (i = 0; i < count; i++) {
-			value = *(vm_pmd + vir_off);
+			if (pud_block)
+				value = pud_block + (vir & (PUD_MAP_SIZE - 1));
+			else
+				value = *(vm_pmd + vir_off);
 			value &= PAGETABLE_ATTR_MASK;
 			value |= attr;
 
@@ -812,9 +849,42 @@ struct vmm_area *vm_mmap(struct vm *vm, unsigned long offset, size_t size)
 	return va;
 }
 
+#ifdef CONFIG_VM_CONTIGUOUS_MEMORY
+#define BLOCKS_IN_PUD		(PUD_MAP_SIZE >> MEM_BLOCK_SHIFT)
+
+static struct mem_block *
+alloc_vm_mem_blocks(unsigned long base, int count, int *nr)
+{
+	struct mem_block *block;
+
+	/*
+	 * if the guest address is 1G aligned, try to get 1G
+	 * aligned contiguous memory for it, then it can be
+	 * mapped as PUD block
+	 */
+	if (IS_PUD_ALIGN(base) && (count >= BLOCKS_IN_PUD)) {
+		block = alloc_mem_blocks(BLOCKS_IN_PUD, BLOCKS_IN_PUD, GFB_VM);
+		if (block) {
+			*nr = BLOCKS_IN_PUD;
+			return block;
+		}
+	}
+
+	*nr = 1;
+	return alloc_mem_block(GFB_VM);
+}
+#else
+static struct mem_block *
+alloc_vm_mem_blocks(unsigned long base, int count, int *nr)
+{
+	*nr = 1;
+	return alloc_mem_block(GFB_VM);
+}
+#endif
+
 static int __alloc_vm_memory(struct mm_struct *mm, struct vmm_area *va)
 {
-	int i, count;
+	int i, count, nr;
 	unsigned long base;
 	struct mem_block *block;
 
@@ -829,15 +899,19 @@ static int __alloc_vm_memory(struct mm_struct *mm, struct vmm_area *va)
 	count = va->size >> MEM_BLOCK_SHIFT;
 
 	/*
-	 * here get all the memory block for the vm
-	 * TBD: get contiueous memory or not contiueous ?
+	 * here get all the memory block for the vm, the
+	 * blocks are linked in the order of guest address
 	 */
-	for (i = 0; i < count; i++) {
-		block = alloc_mem_block(GFB_VM);
+	while (count > 0) {
+		block = alloc_vm_mem_blocks(base, count, &nr);
 		if (!block)
 			return -ENOMEM;
 
-		list_add_tail(&va->b_head, &block->list);
+		for (i = 0; i < nr; i++)
+			list_add_tail(&va->b_head, &block[i].list);
+
+		count -= nr;
+		base += nr * MEM_BLOCK_SIZE;
 	}
 
 	return 0;